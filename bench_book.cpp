@@ -0,0 +1,144 @@
+#include "types.hpp"
+#include "matching_engine.hpp"
+#include <random>
+#include <iostream>
+
+// Side throughput on a deep book, the split heap entry layout against the original
+// priority queue of whole SideRecords.
+// Usage: bench_book [depth] [operations] [cancels per 10 operations]
+
+// Original layout, a heap of SideRecords with linear search by order id
+class LegacySide {
+    public:
+        LegacySide(an::Bookkeeper& bookkeeper, an::direction_t direction)
+            : q_(), bookkeeper_(bookkeeper), levels_(direction) {}
+
+        void add(an::SideRecord& rec) {
+            rec.on_book = true;
+            q_.push(rec);
+            levels_.add(rec.price, rec.shares);
+            bookkeeper_.addSide(rec);
+        }
+        void remove(an::SideRecord& rec) {
+            rec.visible = false;
+            levels_.remove(rec.price, rec.shares);
+            an::SideRecord removed(rec);
+            normalise();
+            bookkeeper_.removeSide(removed, false);
+        }
+        void removeTop() { remove(*q_.begin()); }
+        void amendSharesTop(an::shares_t diffShares) {
+            an::SideRecord& rec = *q_.begin();
+            an::shares_t oldShares = rec.shares;
+            rec.shares += diffShares;
+            levels_.amend(rec.price, diffShares);
+            bookkeeper_.amendSide(rec, oldShares);
+        }
+        bool empty() const { return q_.empty(); }
+        an::SideRecord top() { return q_.top(); }
+        // Book had no slot, every lookup was a scan
+        an::SideRecord* findRecord(an::order_id_t id, std::uint32_t) {
+            auto it = std::find_if(q_.begin(), q_.end(),
+                                   [id](const an::SideRecord& rec) { return rec.visible && (rec.id == id); });
+            return (it != q_.end()) ? &(*it) : nullptr;
+        }
+        const an::PriceLevels& levels() const { return levels_; }
+    private:
+        void normalise() {
+            while (!q_.empty() && !q_.top().visible) {
+                q_.pop();
+            }
+        }
+        an::PriorityQueue<an::SideRecord, std::deque<an::SideRecord>, an::CompareSideRecord> q_;
+        an::Bookkeeper& bookkeeper_;
+        an::PriceLevels levels_;
+};
+
+struct result_t {
+    double          seconds;
+    an::order_id_t  top_id;
+    std::size_t     levels;
+};
+
+// Half adds, the rest fills against the top or cancels by order id
+template <typename S>
+result_t run(S& side, const an::epoch_t& epoch, std::size_t depth, std::size_t operations, int cancels) {
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> tick(0, 999);
+    std::vector<an::order_id_t> live;
+    std::unordered_map<an::order_id_t, std::size_t> where;
+    std::unordered_map<an::order_id_t, std::uint32_t> slot; // As Book keeps it
+    an::order_id_t id = 0;
+    auto add = [&]() {
+        ++id;
+        an::SideRecord rec = an::DefaultSideRecord;
+        rec.id = id; rec.seq = id; rec.time = epoch.steadyClockStartTime + std::chrono::nanoseconds(id);
+        rec.direction = an::SELL; rec.price = 100.0 + tick(rng) * 0.01; rec.shares = 100; rec.visible = true;
+        side.add(rec);
+        slot[id] = rec.slot;
+        where[id] = live.size();
+        live.push_back(id);
+    };
+    auto forget = [&](an::order_id_t gone) {
+        std::size_t i = where[gone];
+        live[i] = live.back();
+        where[live[i]] = i;
+        live.pop_back();
+        where.erase(gone);
+        slot.erase(gone);
+    };
+    for (std::size_t i = 0; i < depth; ++i) {
+        add();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < operations; ++i) {
+        const int op = static_cast<int>(rng() % 10);
+        if ((op < 5) || live.empty()) {
+            add();
+        } else if (op < 10 - cancels) {
+            an::SideRecord top = side.top();
+            if (top.shares > 40) {
+                side.amendSharesTop(-40);
+            } else {
+                side.removeTop();
+                forget(top.id);
+            }
+        } else {
+            an::order_id_t gone = live[rng() % live.size()];
+            an::SideRecord* rec = side.findRecord(gone, slot[gone]);
+            side.remove(*rec);
+            forget(gone);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result_t{ seconds, side.empty() ? 0 : side.top().id, side.levels().size() };
+}
+
+int main(int argc, char* argv[]) {
+    const std::size_t depth = (argc > 1) ? std::atol(argv[1]) : 10000;
+    const std::size_t operations = (argc > 2) ? std::atol(argv[2]) : 200000;
+    const int cancels = (argc > 3) ? std::min(5, std::atoi(argv[3])) : 1;
+    const an::epoch_t epoch{ std::chrono::steady_clock::now(), std::chrono::system_clock::now() };
+    const double line = 64.0;
+
+    an::Bookkeeper legacyBk(0, 100.0, epoch);
+    LegacySide legacySide(legacyBk, an::SELL);
+    result_t legacy = run(legacySide, epoch, depth, operations, cancels);
+
+    an::Bookkeeper splitBk(0, 100.0, epoch);
+    an::Side splitSide(splitBk, an::SELL, epoch);
+    result_t split = run(splitSide, epoch, depth, operations, cancels);
+
+    std::cout << "depth=" << depth << " operations=" << operations << " cancels=" << cancels << "/10"
+              << " same_result=" << ((legacy.top_id == split.top_id) && (legacy.levels == split.levels) &&
+                                     (legacyBk.stats().sell.value == splitBk.stats().sell.value)) << std::endl
+              << "SideRecord   " << sizeof(an::SideRecord) << " bytes " << line / sizeof(an::SideRecord)
+              << " per cache line" << std::endl
+              << "side_entry_t " << sizeof(an::side_entry_t) << " bytes " << line / sizeof(an::side_entry_t)
+              << " per cache line (state " << sizeof(an::side_state_t) << ", cold " << sizeof(an::side_cold_t)
+              << ")" << std::endl
+              << "legacy " << legacy.seconds << "s " << operations / legacy.seconds << " ops/s" << std::endl
+              << "split  " << split.seconds << "s " << operations / split.seconds << " ops/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "types.hpp"
+#include "security_master.hpp"
+#include "matching_engine.hpp"
+#include "courier.hpp"
+#include <iostream>
+
+// Timestamp cost per order: a steady clock read per event against the engine
+// time read once per batch.
+// Usage: bench_clock [pairs] [batch]
+
+// Crossing SELL/BUY pairs, every pair is an order, a fill and a trade report each side
+double run(an::MatchingEngine& me, long pairs, long batch, bool cached) {
+    std::vector<std::unique_ptr<an::Execution>> orders;
+    orders.reserve(2 * pairs);
+    for (long i = 0; i < pairs; ++i) {
+        orders.push_back(std::make_unique<an::LimitOrder>(2*i+1, "Bench", an::ME, "MSFT", an::SELL, 10, 91.5));
+        orders.push_back(std::make_unique<an::LimitOrder>(2*i+2, "Bench", an::ME, "MSFT", an::BUY, 10, 91.5));
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < orders.size(); ++i) {
+        if (cached && (i % batch == 0)) {
+            me.tick();
+        }
+        me.applyOrder(std::move(orders[i]));
+        if ((i + 1) % batch == 0) {
+            me.publish();
+        }
+    }
+    me.publish();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    const long pairs = (argc > 1) ? std::atol(argv[1]) : 200000;
+    const long batch = (argc > 2) ? std::max(1L, std::atol(argv[2])) : 64;
+    const long reads = 10000000;
+
+    // Bare cost of one read
+    std::int64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < reads; ++i) {
+        sum += std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+    const double clockNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / reads;
+    an::EngineClock clock;
+    clock.tick(std::chrono::steady_clock::now());
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < reads; ++i) {
+        sum += clock.now().time_since_epoch().count();
+    }
+    const double cachedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / reads;
+
+    an::TickLadder tickdb;
+    tickdb.loadData("NXT_ticksize.txt");
+    an::SecurityDatabase secdb(an::ME, tickdb);
+    secdb.loadData("security_database.csv");
+    an::Courier courier;
+    courier.deliverTo( [](const an::location_t&, const an::transport_msg_t&) { } );
+    courier.publishTo( [](const an::market_data_t&) { } );
+    double perEvent = 0.0;
+    double perBatch = 0.0;
+    {
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+        perEvent = run(me, pairs, batch, false);
+        me.close();
+    }
+    {
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+        perBatch = run(me, pairs, batch, true);
+        me.close();
+    }
+
+    const long orders = 2 * pairs;
+    std::cout << "steady_clock::now " << clockNs << "ns engine time " << cachedNs << "ns (" << (sum & 1) << ")"
+              << std::endl
+              << "orders=" << orders << " batch=" << batch << std::endl
+              << "per event " << perEvent << "s " << static_cast<long>(orders / perEvent) << " orders/s "
+              << perEvent * 1e9 / orders << "ns/order" << std::endl
+              << "per batch " << perBatch << "s " << static_cast<long>(orders / perBatch) << " orders/s "
+              << perBatch * 1e9 / orders << "ns/order" << std::endl;
+    return 0;
+}
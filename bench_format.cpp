@@ -0,0 +1,145 @@
+#include "types.hpp"
+#include "order.hpp"
+#include "format.hpp"
+#include <iostream>
+
+// Outbound text messages per second: the original nested ostringstreams against
+// to_string (one allocation) and Formatter into a reused buffer (none). Then
+// timestamps per second, date::format against TimestampFormatter.
+// Usage: bench_format [messages]
+
+// Original to_string, streams at every level
+std::string legacyMessage(const an::location_t& origin, const an::location_t& destination) {
+    std::ostringstream os;
+    os << "origin" << '=' << origin << ':' << "destination" << '=' << destination;
+    return os.str();
+}
+
+std::string legacyResponse(an::order_id_t id, const an::location_t& origin, const an::symbol_t& symbol,
+                           an::direction_t d, an::shares_t s, an::price_t p, an::response_t r, const an::text_t& text) {
+    std::stringstream order;
+    order << "id" << '=' << id << ':' << legacyMessage(an::ME, origin) << ':' << "symbol" << '=' << symbol;
+    std::stringstream exe;
+    exe << order.str() << ':' << "direction" << '=' << an::to_string(d) << ':' << "shares" << '=' << s;
+    std::stringstream limit;
+    limit << "type" << '=' << "LIMIT" << ':' << exe.str() << ':'
+          << "price" << '=' << an::floatDecimalPlaces(p, an::MAX_PRICE_PRECISION);
+    std::ostringstream os;
+    os << limit.str() << ':' << "response" << '=' << an::to_string(r) << ':' << "text" << '=' << text;
+    return os.str();
+}
+
+std::string legacyTrade(const an::location_t& origin, an::order_id_t id, const an::symbol_t& symbol,
+                        an::direction_t d, an::shares_t s, an::price_t p) {
+    std::ostringstream os;
+    os << "type" << '=' << "TRADE" << ':' << legacyMessage(an::ME, origin) << ':'
+       << "orig_order_id" << '=' << id << ':' << "symbol" << '=' << symbol << ':'
+       << "direction" << '=' << an::to_string(d) << ':' << "shares" << '=' << s << ':'
+       << "price" << '=' << an::floatDecimalPlaces(p, an::MAX_PRICE_PRECISION);
+    return os.str();
+}
+
+std::string legacyMarketData(const an::market_data_t& md) {
+    std::ostringstream os;
+    os << "type" << '=' << "MARKETDATA" << ':' << "seq" << '=' << md.seq << ':'
+       << legacyMessage(md.origin, an::ALL) << ':' << "symbol" << '=' << md.symbol << ':';
+    if (md.have_bid) {
+        os << "bid" << '=' << an::floatDecimalPlaces(md.bid, an::MAX_PRICE_PRECISION) << ':'
+           << "bid_size" << '=' << md.bid_size << ':';
+    }
+    if (md.have_ask) {
+        os << "ask" << '=' << an::floatDecimalPlaces(md.ask, an::MAX_PRICE_PRECISION) << ':'
+           << "ask_size" << '=' << md.ask_size << ':';
+    }
+    if (md.have_last_trade) {
+        os << "last_trade_price" << '=' << an::floatDecimalPlaces(md.last_trade_price, an::MAX_PRICE_PRECISION) << ':'
+           << "last_trade_shares" << '=' << md.last_trade_shares << ':'
+           << "trade_time" << '=' << md.trade_time << ':';
+    }
+    os << "quote_time" << '=' << md.quote_time << ':'
+       << "volume" << '=' << an::floatDecimalPlaces(md.volume, an::VOLUME_OUTPUT_PRECISION);
+    return os.str();
+}
+
+int main(int argc, char* argv[]) {
+    const long messages = (argc > 1) ? std::atol(argv[1]) : 1000000;
+
+    an::LimitOrder order(1234567, "Client1", an::ME, "MSFT", an::BUY, 250, 91.53);
+    an::Response response(&order, an::ACK, "order accepted");
+    an::TradeReport trade(&order, an::BUY, 100, 91.5);
+    an::market_data_t md = an::market_data_t();
+    md.seq = 987654; md.origin = an::ME; md.symbol = "MSFT";
+    md.have_bid = true; md.bid = 91.5; md.bid_size = 300;
+    md.have_ask = true; md.ask = 91.55; md.ask_size = 1200;
+    md.have_last_trade = true; md.last_trade_price = 91.5; md.last_trade_shares = 100;
+    md.trade_time = "10:15:30.123456"; md.quote_time = "10:15:30.123789"; md.volume = 1234567.5;
+    an::MarketData data(an::ME, md);
+
+    auto legacy = [&](long i) -> std::string {
+        switch (i % 3) {
+            case 0:  return legacyResponse(1234567, "Client1", "MSFT", an::BUY, 250, 91.53, an::ACK, "order accepted");
+            case 1:  return legacyTrade("Client1", 1234567, "MSFT", an::BUY, 100, 91.5);
+            default: return legacyMarketData(md);
+        }
+    };
+    const an::Message* msgs[] = { &response, &trade, &data };
+
+    bool same = true;
+    for (long i = 0; i < 3; ++i) {
+        same = same && (legacy(i) == msgs[i]->to_string());
+    }
+
+    std::size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < messages; ++i) {
+        bytes += legacy(i).size();
+    }
+    const double legacySec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < messages; ++i) {
+        bytes += msgs[i % 3]->to_string().size();
+    }
+    const double stringSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    char buf[an::MAX_MESSAGE_SIZE];
+    an::Formatter f(buf, sizeof(buf));
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < messages; ++i) {
+        f.clear();
+        msgs[i % 3]->format(f);
+        bytes += f.size();
+    }
+    const double formatSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Timestamps a microsecond apart, as events in a busy second
+    const std::chrono::system_clock::time_point base = std::chrono::system_clock::now();
+    bool sameTime = true;
+    an::TimestampFormatter timestamp;
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < messages; ++i) {
+        std::ostringstream os;
+        os << date::format("%T", base + std::chrono::microseconds(i));
+        bytes += os.str().size();
+    }
+    const double dateSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < messages; ++i) {
+        timestamp.write(buf, base + std::chrono::microseconds(i));
+        bytes += buf[an::TimestampFormatter::SIZE - 1];
+    }
+    const double stampSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (long i = 0; i < messages; i += 9973) {
+        sameTime = sameTime && (timestamp.to_string(base + std::chrono::microseconds(i)) ==
+                                date::format("%T", base + std::chrono::microseconds(i)));
+    }
+
+    std::cout << "messages=" << messages << " same_result=" << same << " bytes=" << bytes << std::endl
+              << "ostringstream " << legacySec << "s " << static_cast<long>(messages / legacySec) << " msgs/s" << std::endl
+              << "to_string     " << stringSec << "s " << static_cast<long>(messages / stringSec) << " msgs/s" << std::endl
+              << "Formatter     " << formatSec << "s " << static_cast<long>(messages / formatSec) << " msgs/s" << std::endl
+              << "timestamps same_result=" << sameTime << std::endl
+              << "date::format       " << dateSec << "s " << static_cast<long>(messages / dateSec) << " stamps/s" << std::endl
+              << "TimestampFormatter " << stampSec << "s " << static_cast<long>(messages / stampSec) << " stamps/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "types.hpp"
+#include "security_master.hpp"
+#include "matching_engine.hpp"
+#include "courier.hpp"
+#include "gateway.hpp"
+#include <iostream>
+
+// Loopback throughput: one client sends crossing SELL/BUY limit pairs through the
+// gateway and waits for every order's COMPLETE response.
+int main(int argc, char* argv[]) {
+    namespace ip = boost::asio::ip;
+    const long pairs = (argc > 1) ? std::atol(argv[1]) : 50000;
+    const std::uint16_t port = 5060;
+
+    an::TickLadder tickdb;
+    tickdb.loadData("NXT_ticksize.txt");
+    an::SecurityDatabase secdb(an::ME, tickdb);
+    secdb.loadData("security_database.csv");
+    an::Courier courier;
+    an::MatchingEngine me(an::ME, secdb, courier, false);
+    an::Gateway gateway(courier);
+    gateway.start(port);
+
+    boost::asio::io_context io;
+    ip::tcp::socket sock(io);
+    sock.connect(ip::tcp::endpoint(ip::address::from_string("127.0.0.1"), port));
+
+    std::string orders;
+    orders.reserve(pairs * 200);
+    orders += "type=LOGIN:origin=Bench:destination=ME\n";
+    for (long i = 0; i < pairs; ++i) {
+        orders += "type=LIMIT:id=" + std::to_string(2*i+1) +
+                  ":origin=Bench:destination=ME:symbol=MSFT:direction=SELL:shares=10:price=91.5\n";
+        orders += "type=LIMIT:id=" + std::to_string(2*i+2) +
+                  ":origin=Bench:destination=ME:symbol=MSFT:direction=BUY:shares=10:price=91.5\n";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread writer( [&]{ boost::asio::write(sock, boost::asio::buffer(orders)); } );
+
+    // Count replies, both orders of each pair complete
+    const long expected = 2 * pairs;
+    long completes = 0;
+    long lines = 0;
+    boost::asio::streambuf in;
+    std::string line;
+    while (completes < expected) {
+        std::size_t n = boost::asio::read_until(sock, in, '\n'); // Buffered, one complete line
+        line.assign(boost::asio::buffers_begin(in.data()), boost::asio::buffers_begin(in.data()) + n);
+        in.consume(n);
+        ++lines;
+        completes += (line.find("response=COMPLETE") != std::string::npos);
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    writer.join();
+
+    std::cout << "orders=" << expected << " replies=" << lines
+              << " seconds=" << elapsed
+              << " orders/s=" << static_cast<long>(expected / elapsed)
+              << " msgs/s=" << static_cast<long>(lines / elapsed) << std::endl;
+
+    sock.close();
+    gateway.stop();
+    std::cout << "engine batches=" << gateway.stats().batches
+              << " max_batch=" << gateway.stats().max_batch << std::endl;
+    me.close();
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include "types.hpp"
+#include "logger.hpp"
+#include <fstream>
+#include <iostream>
+
+// Producer side cost per log call: a record into the thread's buffer, a call
+// filtered out at run time, and the old ostringstream and std::endl to a file.
+// The logger thread formats each burst outside the timed section.
+// Usage: bench_log [calls]
+
+int main(int argc, char* argv[]) {
+    const long calls = (argc > 1) ? std::atol(argv[1]) : 2000000;
+    const long burst = 500; // Records of ~100 bytes, well within LOG_BUFFER_SIZE
+
+    std::ofstream devnull("/dev/null");
+    an::counter_t written = 0;
+    an::Logger::instance().sinkTo( [&written](const char*, std::size_t n) { written += n; } );
+    const std::string symbol = "MSFT";
+
+    double logSec = 0.0;
+    for (long i = 0; i < calls; i += burst) {
+        auto start = std::chrono::steady_clock::now();
+        for (long j = i; j < i + burst; ++j) {
+            AN_INFO("order id={} symbol={} shares={} price={}", j, symbol, 250, 91.53);
+        }
+        logSec += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        an::Logger::instance().flush();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < calls; ++i) {
+        AN_DEBUG("order id={} symbol={} shares={} price={}", i, symbol, 250, 91.53);
+    }
+    const double filteredSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < calls; ++i) {
+        std::ostringstream os;
+        os << "order id=" << i << " symbol=" << symbol << " shares=" << 250
+           << " price=" << an::floatDecimalPlaces(91.53, an::MAX_PRICE_PRECISION);
+        devnull << os.str() << std::endl;
+    }
+    const double streamSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const an::log_stats_t stats = an::Logger::instance().stats();
+    an::Logger::instance().sinkTo(nullptr);
+    std::cout << "calls=" << calls << " records=" << stats.records << " dropped=" << stats.dropped
+              << " bytes=" << written << std::endl
+              << "AN_INFO          " << logSec * 1e9 / calls << "ns/call" << std::endl
+              << "AN_DEBUG filtered " << filteredSec * 1e9 / calls << "ns/call" << std::endl
+              << "ostream endl     " << streamSec * 1e9 / calls << "ns/call" << std::endl;
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "types.hpp"
+#include "fast-cpp-csv-parser/csv.h"
+#include "security_master.hpp"
+#include <fstream>
+#include <thread>
+#include <iostream>
+
+// Startup time of SecurityDatabase::loadData and loadImage on a generated universe.
+// Usage: bench_secdb [rows] [threads]
+
+void generate(const std::string& filename, std::size_t rows) {
+    std::ofstream os(filename);
+    os << "id,exchange,symbol,closing_price,outstanding_shares,born,has_died,died,tradeable,tick_ladder_id\n";
+    for (std::size_t i = 0; i < rows; ++i) {
+        bool died = (i % 20 == 0);
+        os << i + 1 << ",ME,S" << i << ',' << 1.0 + (i % 5000) * 0.25 << ',' << 1000000 + i << ','
+           << 1950 + (i % 60) << '-' << std::setw(2) << std::setfill('0') << (i % 12) + 1 << '-'
+           << std::setw(2) << (i % 28) + 1 << std::setfill(' ') << ','
+           << (died ? "Y,2010-06-30" : "N,0000-00-00") << ",Y," << (i % 12) + 1 << '\n';
+    }
+}
+
+// Row at a time through io::CSVReader and stream based dates, as loadData used to
+std::size_t loadLegacy(const std::string& filename) {
+    std::vector<an::security_record_t> securities;
+    io::CSVReader<10> in(filename);
+    in.read_header(io::ignore_no_column,
+        "id", "exchange", "symbol", "closing_price", "outstanding_shares",
+        "born", "has_died", "died", "tradeable", "tick_ladder_id");
+    std::string born; char has_died; std::string died; char tradeable;
+    an::security_record_t sr;
+    while(in.read_row(sr.id, sr.exchange, sr.symbol, sr.closing_price, sr.outstanding_shares,
+                      born, has_died, died, tradeable, sr.ladder_id) ) {
+       sr.born = an::stringToTimeT(born, "%Y-%m-%d");
+       sr.has_died = has_died == 'Y';
+       sr.died = sr.has_died ? an::stringToTimeT(died, "%Y-%m-%d") : an::MY_MAX_DATE;
+       sr.tradeable = tradeable == 'Y';
+       securities.push_back(sr);
+    }
+    return securities.size();
+}
+
+template <typename F>
+double timeIt(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    const std::size_t rows = (argc > 1) ? std::atol(argv[1]) : 1000000;
+    const unsigned threads = (argc > 2) ? std::atoi(argv[2]) : std::max(2u, std::thread::hardware_concurrency());
+    const std::string filename = "/tmp/bench_secdb.csv";
+    generate(filename, rows);
+    an::TickLadder tickdb;
+
+    std::size_t loaded = 0;
+    double single = timeIt([&] {
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData(filename);
+        loaded = secdb.securities().size();
+    });
+    double parallel = timeIt([&] {
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData(filename, threads);
+    });
+    std::cout << "rows=" << loaded << std::endl
+              << "mmap single          " << single << "s" << std::endl
+              << "mmap " << threads << " threads" << std::string(threads < 10 ? 7 : 6, ' ') << parallel << "s" << std::endl;
+
+    // Precompiled image
+    const std::string image = "/tmp/bench_secdb.img";
+    {
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData(filename);
+        secdb.saveImage(image);
+    }
+    double mapped = timeIt([&] {
+        an::TickLadder imageTickdb;
+        an::SecurityDatabase secdb(an::ME, imageTickdb);
+        secdb.loadImage(image);
+    });
+    std::cout << "image                " << mapped << "s" << std::endl;
+    std::remove(image.c_str());
+    try {
+        double legacy = timeIt([&] { (void) loadLegacy(filename); });
+        std::cout << "csv reader (legacy)  " << legacy << "s" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "csv reader (legacy)  skipped: " << e.what() << std::endl;
+    }
+    std::remove(filename.c_str());
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "types.hpp"
+#include "security_master.hpp"
+#include <random>
+#include <iostream>
+
+// Compare TickTable::validatePriceAndRound against the original linear scan of the rows.
+// Usage: bench_ticks [prices] [ladder_id]
+
+// Original implementation, walks every row
+bool validateLinear(const an::TickTable& tt, an::price_t& price, bool round = true,
+                    an::price_t epsilon = an::PRICE_EPSILON) {
+    for (const auto& ttr : tt.rows()) {
+        if ( ( ttr.have_upper && (price >= ttr.lower) && (price < ttr.upper)) ||
+             (!ttr.have_upper && (price >= ttr.lower) ) ) {
+            const an::price_t div = price / ttr.tick_size;
+            bool res = std::min(div - std::floor(div),std::abs(div - std::ceil(div))) < epsilon;
+            if (res && round) {
+                price = an::roundToAny(price,ttr.tick_size);
+            }
+            return res;
+        }
+    }
+    return false;
+}
+
+template <typename F>
+double timeIt(const std::vector<an::price_t>& prices, long& valid, F f) {
+    auto start = std::chrono::steady_clock::now();
+    valid = 0;
+    for (an::price_t p : prices) {
+        valid += f(p);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    const std::size_t count = (argc > 1) ? std::atol(argv[1]) : 10000000;
+    const an::ladder_id_t ladder = (argc > 2) ? std::atoi(argv[2]) : 12;
+    an::TickLadder tickdb;
+    tickdb.loadData("NXT_ticksize.txt");
+    const an::TickTable* tt = tickdb.find(ladder);
+    if (tt == nullptr) {
+        std::cout << "Unknown ladder " << ladder << std::endl;
+        return 1;
+    }
+
+    // Half on a tick, half random
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<an::price_t> dist(0.0, 100000.0);
+    std::vector<an::price_t> prices;
+    prices.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        an::price_t p = dist(rng);
+        if (i % 2 == 0) {
+            an::price_t r = p;
+            for (const auto& ttr : tt->rows()) {
+                if (p >= ttr.lower) {
+                    r = an::roundToAny(p, ttr.tick_size);
+                }
+            }
+            p = r;
+        }
+        prices.push_back(p);
+    }
+
+    std::size_t mismatch = 0;
+    for (std::size_t i = 0; i < std::min<std::size_t>(count, 1000000); ++i) {
+        an::price_t a = prices[i], b = prices[i];
+        if ((validateLinear(*tt, a) != tt->validatePriceAndRound(b)) || (a != b)) {
+            ++mismatch;
+        }
+    }
+
+    long validLinear = 0, validCompiled = 0;
+    double linear = timeIt(prices, validLinear, [tt](an::price_t p) { return validateLinear(*tt, p); });
+    double compiled = timeIt(prices, validCompiled, [tt](an::price_t p) { return tt->validatePriceAndRound(p); });
+
+    std::cout << "ladder=" << ladder << " bands=" << tt->rows().size() << " prices=" << count
+              << " mismatches=" << mismatch << std::endl
+              << "linear   " << linear   << "s " << (linear   * 1e9 / count) << "ns/price valid=" << validLinear << std::endl
+              << "compiled " << compiled << "s " << (compiled * 1e9 / count) << "ns/price valid=" << validCompiled << std::endl;
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "courier.hpp"
 #include "matching_engine.hpp"
+#include "logger.hpp"
 
 an::Courier::~Courier() {
     me_ = nullptr;
@@ -12,34 +13,104 @@ std::string an::Courier::to_sting() const {
 }
 
 
+void an::Courier::append(const Message& m) {
+    Formatter f(buf_.data(), buf_.size());
+    m.format(f);
+    if (f.overflow()) {
+        out_ += m.to_string(); // Longer than the buffer, rare
+    } else {
+        out_.append(buf_.data(), f.size());
+    }
+}
+
 void an::Courier::send(Response& r) {
     ++stats_.response_msgs;
-    std::cout << "Courier::send Response:" << r.to_string() << std::endl;
+    if (deliver_) {
+        deliver_(r.recipient(), format(r));
+    } else {
+        AN_INFO("Courier::send Response:{}", r.to_string());
+    }
+}
+
+void an::Courier::send(std::vector<Response>& responses) {
+    stats_.response_msgs += responses.size();
+    if (!deliver_) {
+        for (const auto& r : responses) {
+            AN_INFO("Courier::send Response:{}", r.to_string());
+        }
+        return;
+    }
+    out_.clear();
+    for (std::size_t i = 0; i < responses.size(); ++i) {
+        if (!out_.empty()) {
+            out_ += '\n'; // Framing is a line per message
+        }
+        append(responses[i]);
+        if ((i + 1 == responses.size()) || (responses[i+1].recipient() != responses[i].recipient())) {
+            deliver_(responses[i].recipient(), out_);
+            out_.clear();
+        }
+    }
 }
 
 void an::Courier::send(TradeReport& tr) {
     ++stats_.trade_report_msgs;
-    std::cout << "Courier::send TradeReport:" << tr.to_string() << std::endl;
+    if (deliver_) {
+        deliver_(tr.recipient(), format(tr));
+    } else {
+        AN_INFO("Courier::send TradeReport:{}", tr.to_string());
+    }
 }
 
 void an::Courier::send(MarketData& md) {
     ++stats_.market_data_msgs;
-    std::cout << "Courier::send MarketData:" << md.to_string() << std::endl;
+    if (publish_) {
+        publish_(md.md());
+    } else if (deliver_) {
+        deliver_(md.recipient(), format(md));
+    } else {
+        AN_INFO("Courier::send MarketData:{}", md.to_string());
+    }
+}
+
+void an::Courier::send(const symbol_t& symbol, const std::vector<level_delta_t>& deltas) {
+    ++stats_.depth_msgs;
+    if (depth_) {
+        depth_(symbol, deltas);
+    } else {
+        AN_INFO("Courier::send Depth:symbol={} levels={}", symbol, deltas.size());
+    }
+}
+
+void an::Courier::tick() {
+    if (me_ != nullptr) {
+        me_->tick();
+    }
 }
 
 void an::Courier::receive(std::unique_ptr<Order> o) {
     ++stats_.receive_msgs;
     if (me_ != nullptr) {
-        std::cout << "Courier::receive Order engine:" << o->to_string() << std::endl;
+        if (!deliver_) {
+            AN_INFO("Courier::receive Order engine:{}", o->to_string());
+        }
         Order* order = o.get();
         o.release(); // MatchingEngine now owns order
         order->applyOrder(*me_);
     } else {
         ++stats_.dropped_msgs;
-        std::cout << "Courier::receive Order dropped:" << o->to_string() << std::endl;
+        AN_WARN("Courier::receive Order dropped:{}", o->to_string());
     }
 }
 
+std::size_t an::Courier::publish() {
+    return (me_ != nullptr) ? me_->publish() : 0;
+}
+
+
+std::uint32_t an::Courier::riskSlot(const location_t& origin) {
+    return (me_ != nullptr) ? me_->riskSlot(origin) : risk_account_t::NO_SLOT;
+}
 
 void an::Courier::inscribe(an::location_t destination, MatchingEngine* me) {
     assert(!destination.empty() && "Courier::inscribe destination empty");
@@ -3,6 +3,8 @@
 
 #include "types.hpp"
 #include "order.hpp"
+#include <array>
+#include <functional>
 namespace an {
 
 
@@ -11,10 +13,11 @@ class MatchingEngine;
 struct courier_stats_t {
     courier_stats_t() 
         : response_msgs(0), trade_report_msgs(0), market_data_msgs(0), 
-          receive_msgs(0), dropped_msgs(0), inscribed_destinations(0) {}
+          depth_msgs(0), receive_msgs(0), dropped_msgs(0), inscribed_destinations(0) {}
     counter_t       response_msgs;
     counter_t       trade_report_msgs;
     counter_t       market_data_msgs;
+    counter_t       depth_msgs;
     counter_t       receive_msgs;
     counter_t       dropped_msgs; // No destination or no matching engine
     counter_t       inscribed_destinations;
@@ -22,18 +25,42 @@ struct courier_stats_t {
 
 class Courier {
     public:
-        Courier() : destination_(""), me_(nullptr), stats_() {}
+        // Outbound transport, called with the recipient (client name or ALL) and the message
+        typedef std::function<void(const location_t& recipient, const transport_msg_t& msg)> deliver_t;
+        // Market data feed, takes market data off the client connections
+        typedef std::function<void(const market_data_t& md)> publish_t;
+        // Depth of book changes for one symbol
+        typedef std::function<void(const symbol_t& symbol, const std::vector<level_delta_t>& deltas)> depth_t;
+
+        Courier() : destination_(""), me_(nullptr), stats_(), deliver_(), publish_(), depth_(), buf_(), out_() {}
         ~Courier();
 
         std::string to_sting() const;
 
         void send(Response& r);
+        // Consecutive responses to the same recipient go out in one delivery
+        void send(std::vector<Response>& responses);
         void send(TradeReport& tr);
         void send(MarketData& md);
+        void send(const symbol_t& symbol, const std::vector<level_delta_t>& deltas);
 
+        // Start of a receive cycle, the engine reads its clock once for the cycle
+        void tick();
         void receive(std::unique_ptr<Order> o);
+        // End of a receive cycle, engine publishes conflated market data
+        std::size_t publish();
 
         void inscribe(an::location_t destination, MatchingEngine* me);
+        // Any thread, the engine's pre-trade risk slot of origin, NO_SLOT without an engine
+        std::uint32_t riskSlot(const location_t& origin);
+        const location_t& destination() const { return destination_; }
+
+        // Without a transport replies are logged at LOG_INFO
+        void deliverTo(deliver_t deliver) { deliver_ = deliver; }
+        // Without a feed market data is delivered like any other reply
+        void publishTo(publish_t publish) { publish_ = publish; }
+        // Without a feed depth changes are only logged
+        void depthTo(depth_t depth) { depth_ = depth; }
 
         const courier_stats_t& stats() const {
             return stats_;
@@ -42,6 +69,21 @@ class Courier {
         location_t      destination_;
         MatchingEngine* me_;
         courier_stats_t stats_;
+        deliver_t       deliver_;
+        publish_t       publish_;
+        depth_t         depth_;
+    private:
+        // Outbound text, formatted into buf_ and copied to out_, which keeps its
+        // capacity so sends don't allocate once it has grown
+        const transport_msg_t& format(const Message& m) {
+            out_.clear();
+            append(m);
+            return out_;
+        }
+        void append(const Message& m);
+
+        std::array<char, MAX_MESSAGE_SIZE> buf_;
+        transport_msg_t out_;
 };
 
 } // an - namespace
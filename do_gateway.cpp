@@ -0,0 +1,69 @@
+#include "types.hpp"
+#include "security_master.hpp"
+#include "matching_engine.hpp"
+#include "courier.hpp"
+#include "gateway.hpp"
+#include "market_data.hpp"
+#include "shutdown.hpp"
+#include <iostream>
+
+// Stop the gateway on a signal, the main thread then closes the engine
+class GatewayShutdown: public Shutdown {
+    public:
+        explicit GatewayShutdown(an::Gateway& gateway) : Shutdown(), gateway_(gateway) { }
+        virtual ~GatewayShutdown() { }
+    protected:
+        virtual void myHandleStop(const boost::system::error_code& error, int signal_number) {
+            std::cout << "Stopping gateway signal=" << signal_number << std::endl;
+            gateway_.stop();
+        }
+    private:
+        an::Gateway& gateway_;
+};
+
+int main(int argc, char* argv[]) {
+    try {
+        const std::uint16_t myPort = (argc > 1) ? std::atoi(argv[1]) : 5050;
+        // Market data feed and its recovery service
+        const std::string myFeedAddress = (argc > 2) ? argv[2] : "127.0.0.1";
+        const std::uint16_t myFeedPort = (argc > 3) ? std::atoi(argv[3]) : 5070;
+        // Precompiled security master from do_secdb_image, CSV files if not given
+        const std::string myImage = (argc > 4) ? argv[4] : "";
+        an::TickLadder tickdb;
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        if (myImage.empty()) {
+            tickdb.loadData("NXT_ticksize.txt");
+            secdb.loadData("security_database.csv");
+        } else {
+            secdb.loadImage(myImage);
+        }
+
+        an::Courier courier;
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+        an::Gateway gateway(courier);
+        an::MarketDataPublisher feed(boost::asio::ip::udp::endpoint(
+                boost::asio::ip::make_address(myFeedAddress), myFeedPort));
+        courier.publishTo( [&feed](const an::market_data_t& md) { feed.publish(md); } );
+        courier.depthTo( [&feed](const an::symbol_t& symbol, const std::vector<an::level_delta_t>& deltas) {
+            feed.publish(symbol, deltas);
+        } );
+        feed.start(myFeedPort + 1);
+
+        std::cout << "Starting gateway on port=" << myPort << " feed=" << myFeedAddress << ":"
+                  << myFeedPort << " recovery=" << myFeedPort + 1 << std::endl;
+        GatewayShutdown shutdown(gateway);
+        gateway.start(myPort);
+        shutdown.join(); // Wait for signal
+        gateway.stop();
+        me.close();
+        feed.stop();
+        courier.publishTo(an::Courier::publish_t());
+        courier.depthTo(an::Courier::depth_t());
+        std::cout << "Exiting gateway orders=" << gateway.stats().orders
+                  << " batches=" << gateway.stats().batches << std::endl;
+    } catch(std::exception& e) {
+        std::cout << e.what() << std::endl ;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "types.hpp"
+#include "security_master.hpp"
+#include <iostream>
+
+// Compile the security database and tick ladders into a binary image for mmap startup.
+// Usage: do_secdb_image [security_database.csv] [NXT_ticksize.txt] [security_master.img]
+
+int main(int argc, char* argv[]) {
+    try {
+        const std::string mySecdb = (argc > 1) ? argv[1] : "security_database.csv";
+        const std::string myTicks = (argc > 2) ? argv[2] : "NXT_ticksize.txt";
+        const std::string myImage = (argc > 3) ? argv[3] : "security_master.img";
+        an::TickLadder tickdb;
+        tickdb.loadData(myTicks);
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData(mySecdb);
+        secdb.saveImage(myImage);
+
+        // Read it back as the engine would
+        an::TickLadder checkTickdb;
+        an::SecurityDatabase check(an::ME, checkTickdb);
+        check.loadImage(myImage);
+        std::cout << "Wrote " << myImage << " version=" << an::SECDB_IMAGE_VERSION
+                  << " securities=" << check.securities().size()
+                  << " ladders=" << checkTickdb.ladders() << " tables=" << checkTickdb.tables() << std::endl;
+    } catch(std::exception& e) {
+        std::cout << e.what() << std::endl ;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,220 @@
+#ifndef AN_FORMAT_HPP
+#define AN_FORMAT_HPP
+
+#include "types.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+namespace an {
+
+const std::size_t MAX_MESSAGE_SIZE = 1024; // Longest outbound message formatted without allocating
+
+// Writes text straight into a caller supplied buffer, no streams, locales or
+// heap. Integers and fixed point decimals are printed by hand. Writing past
+// the end is counted but dropped, like snprintf, so the caller can retry with
+// size() bytes when overflow() is set.
+class Formatter {
+    public:
+        static const int MAX_FAST_PRECISION = 9;
+
+        Formatter(char* buf, std::size_t capacity) : buf_(buf), capacity_(capacity), size_(0) { }
+        Formatter(const Formatter&) = delete;
+        Formatter& operator=(const Formatter&) = delete;
+
+        Formatter& operator<<(char c) {
+            if (size_ < capacity_) {
+                buf_[size_] = c;
+            }
+            ++size_;
+            return *this;
+        }
+        Formatter& operator<<(const char* s) {
+            write(s, std::strlen(s));
+            return *this;
+        }
+        Formatter& operator<<(const std::string& s) {
+            write(s.data(), s.size());
+            return *this;
+        }
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, char>::value &&
+                                !std::is_same<T, bool>::value, Formatter&>::type
+        operator<<(T value) {
+            typedef typename std::make_unsigned<T>::type unsigned_t;
+            unsigned_t u = static_cast<unsigned_t>(value);
+            if (value < 0) {
+                *this << '-';
+                u = static_cast<unsigned_t>(0) - u;
+            }
+            return digits(static_cast<std::uint64_t>(u));
+        }
+
+        // Same text as floatDecimalPlaces: fixed, trailing zeros trimmed to at
+        // least one decimal place. Ties and very large values go to snprintf so
+        // rounding matches it to the last digit.
+        Formatter& fixed(double value, int precision) {
+            assert(precision >= 0 && "Formatter::fixed negative precision not allowed");
+            static const double SCALE[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+            static const std::uint64_t ISCALE[] = { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL,
+                                                    1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL };
+            const double magnitude = std::fabs(value);
+            if ((precision > MAX_FAST_PRECISION) || !(magnitude < 9e15)) { // NaN fails the compare
+                return slowFixed(value, precision);
+            }
+            double whole = std::floor(magnitude);
+            const double scaled = (magnitude - whole) * SCALE[precision]; // Subtraction is exact
+            double below = std::floor(scaled);
+            const double rest = scaled - below;
+            if (std::fabs(rest - 0.5) < 1e-6) {
+                return slowFixed(value, precision); // Too close to call, round as printf does
+            }
+            std::uint64_t ipart = static_cast<std::uint64_t>(whole);
+            std::uint64_t fpart = static_cast<std::uint64_t>(below) + ((rest > 0.5) ? 1 : 0);
+            if (fpart == ISCALE[precision]) {
+                ++ipart;
+                fpart = 0;
+            }
+            if (std::signbit(value)) {
+                *this << '-';
+            }
+            digits(ipart);
+            if (precision != 0) {
+                char frac[MAX_FAST_PRECISION];
+                for (int i = precision - 1; i >= 0; --i) {
+                    frac[i] = static_cast<char>('0' + fpart % 10);
+                    fpart /= 10;
+                }
+                int len = precision;
+                while ((len > 1) && (frac[len-1] == '0')) {
+                    --len;
+                }
+                *this << '.';
+                write(frac, len);
+            }
+            return *this;
+        }
+
+        Formatter& append(const char* s, std::size_t n) {
+            write(s, n);
+            return *this;
+        }
+
+        const char* data() const { return buf_; }
+        // Bytes the text needs, more than capacity() on overflow
+        std::size_t size() const { return size_; }
+        std::size_t capacity() const { return capacity_; }
+        bool overflow() const { return size_ > capacity_; }
+        void clear() { size_ = 0; }
+        std::string str() const { return std::string(buf_, std::min(size_, capacity_)); }
+    private:
+        void write(const char* s, std::size_t n) {
+            if (size_ < capacity_) {
+                std::memcpy(buf_ + size_, s, std::min(n, capacity_ - size_));
+            }
+            size_ += n;
+        }
+        Formatter& digits(std::uint64_t u) {
+            char tmp[20];
+            int i = sizeof(tmp);
+            do {
+                tmp[--i] = static_cast<char>('0' + u % 10);
+                u /= 10;
+            } while (u != 0);
+            write(tmp + i, sizeof(tmp) - i);
+            return *this;
+        }
+        Formatter& slowFixed(double value, int precision) {
+            char tmp[512]; // Largest double is 309 digits
+            int n = std::snprintf(tmp, sizeof(tmp), "%.*f", std::min(precision, 100), value);
+            std::size_t len = (n < 0) ? 0 : std::min<std::size_t>(n, sizeof(tmp) - 1);
+            if ((precision != 0) && (len != 0)) {
+                while ((len > 0) && (tmp[len-1] == '0')) {
+                    --len;
+                }
+                if (tmp[len-1] == '.') {
+                    tmp[len++] = '0';
+                }
+            }
+            write(tmp, len);
+            return *this;
+        }
+
+        char*       buf_;
+        std::size_t capacity_;
+        std::size_t size_;
+};
+
+// Digits after the point of 1/den, e.g. 9 for nanoseconds
+constexpr int decimalDigits(std::intmax_t den) { return (den <= 1) ? 0 : 1 + decimalDigits(den / 10); }
+
+// Time of day as date::format("%T") writes a system_clock time, HH:MM:SS and
+// the sub-second digits of the clock. The HH:MM:SS prefix is kept for the
+// current second, so most calls only write the fraction.
+class TimestampFormatter {
+    public:
+        typedef std::chrono::system_clock::time_point time_point_t;
+        typedef time_point_t::duration::period period_t;
+        static_assert(period_t::num == 1, "TimestampFormatter clock period must be a fraction of a second");
+
+        static const int FRACTION_DIGITS = decimalDigits(period_t::den);
+        static const std::size_t SIZE = 8 + (FRACTION_DIGITS != 0 ? 1 + FRACTION_DIGITS : 0);
+
+        TimestampFormatter() : second_(std::numeric_limits<std::int64_t>::min()), prefix_() { }
+
+        // Writes SIZE characters, not terminated
+        void write(char* out, time_point_t time) {
+            const std::int64_t ticks = time.time_since_epoch().count();
+            std::int64_t second = ticks / period_t::den;
+            std::int64_t fraction = ticks % period_t::den;
+            if (fraction < 0) { // Floor, before 1970
+                --second;
+                fraction += period_t::den;
+            }
+            if (second != second_) {
+                setSecond(second);
+            }
+            std::memcpy(out, prefix_, 8);
+            if (FRACTION_DIGITS != 0) {
+                out[8] = '.';
+                for (int i = FRACTION_DIGITS; i > 0; --i) {
+                    out[8 + i] = static_cast<char>('0' + fraction % 10);
+                    fraction /= 10;
+                }
+            }
+        }
+        Formatter& write(Formatter& f, time_point_t time) {
+            char buf[SIZE];
+            write(buf, time);
+            return f.append(buf, SIZE);
+        }
+        std::string to_string(time_point_t time) {
+            char buf[SIZE];
+            write(buf, time);
+            return std::string(buf, SIZE);
+        }
+    private:
+        void setSecond(std::int64_t second) {
+            second_ = second;
+            std::int64_t day = second % 86400;
+            if (day < 0) {
+                day += 86400;
+            }
+            const int hms[] = { static_cast<int>(day / 3600), static_cast<int>(day / 60 % 60), static_cast<int>(day % 60) };
+            for (int i = 0; i < 3; ++i) {
+                prefix_[3*i] = static_cast<char>('0' + hms[i] / 10);
+                prefix_[3*i + 1] = static_cast<char>('0' + hms[i] % 10);
+                if (i != 2) {
+                    prefix_[3*i + 2] = ':';
+                }
+            }
+        }
+
+        std::int64_t    second_; // Of prefix_
+        char            prefix_[8]; // HH:MM:SS
+};
+
+} // an - namespace
+
+#endif
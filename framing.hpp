@@ -0,0 +1,125 @@
+#ifndef AN_FRAMING_HPP
+#define AN_FRAMING_HPP
+
+#include "types.hpp"
+#include <array>
+#include <cstring>
+
+namespace an {
+
+// Splits an inbound byte stream into terminated frames (lines) without copying.
+// Socket reads go straight into a fixed buffer (writePtr/writeSpace then commit),
+// parse() hands every complete frame to the callback as a PString pointing into
+// the buffer. A trailing partial frame is moved back to the front ready for the
+// next read, so each byte is scanned once. Frames are only valid during the callback.
+// After an overflow reset() the rest of the oversized frame, up to its terminator,
+// is discarded rather than parsed as new frames.
+template <std::size_t N, char TERMINATOR = '\n'>
+class LineFramer {
+    public:
+        static_assert(N <= PString::MAX_PSTRING_LEN, "LineFramer frame must fit in a PString");
+
+        LineFramer() : begin_(0), scan_(0), end_(0), frames_(0), overflows_(0), discarding_(false) { }
+        LineFramer(const LineFramer&) = delete;
+        LineFramer& operator=(const LineFramer&) = delete;
+
+        // Where the next read should land
+        char* writePtr() { return buf_.data() + end_; }
+        std::size_t writeSpace() const { return N - end_; }
+        void commit(std::size_t bytes) {
+            assert(bytes <= writeSpace() && "LineFramer::commit past end of buffer");
+            end_ += bytes;
+        }
+
+        // Dispatch all complete frames, returns number of frames dispatched.
+        // Empty frames (blank lines) are skipped, leading white space and a
+        // trailing '\r' are trimmed.
+        template <typename Handler>
+        std::size_t parse(Handler&& handler) {
+            std::size_t count = 0;
+            const char* base = buf_.data();
+            if (discarding_ && !discard()) {
+                return 0;
+            }
+            while (scan_ < end_) {
+                const void* found = std::memchr(base + scan_, TERMINATOR, end_ - scan_);
+                if (found == nullptr) {
+                    scan_ = end_; // Nothing more, remember how far we looked
+                    break;
+                }
+                std::size_t stop = static_cast<const char*>(found) - base;
+                std::size_t first = begin_;
+                std::size_t last = stop;
+                while ((first < last) && std::isspace(static_cast<unsigned char>(base[first]))) {
+                    ++first;
+                }
+                if ((first < last) && (base[last-1] == '\r')) {
+                    --last;
+                }
+                begin_ = scan_ = stop + 1;
+                if (first < last) {
+                    ++count;
+                    handler(PString(base + first, static_cast<std::int32_t>(last - first)));
+                }
+            }
+            frames_ += count;
+            compact();
+            return count;
+        }
+
+        // Buffer is full with no terminator, frame too long. Caller should drop
+        // the connection or call reset().
+        bool overflow() const { return (begin_ == 0) && (end_ == N); }
+        // Empty the buffer, after an overflow the following bytes up to the
+        // next terminator are dropped too
+        void reset() {
+            if (overflow()) {
+                ++overflows_;
+                discarding_ = true;
+            }
+            begin_ = scan_ = end_ = 0;
+        }
+        // Still dropping the tail of an oversized frame
+        bool discarding() const { return discarding_; }
+
+        std::size_t pending() const { return end_ - begin_; }
+        counter_t frames() const { return frames_; }
+        counter_t overflows() const { return overflows_; }
+    private:
+        // Drop up to and including the next terminator, false if none yet
+        bool discard() {
+            const void* found = std::memchr(buf_.data(), TERMINATOR, end_);
+            if (found == nullptr) {
+                begin_ = scan_ = end_ = 0;
+                return false;
+            }
+            begin_ = scan_ = static_cast<const char*>(found) - buf_.data() + 1;
+            discarding_ = false;
+            return true;
+        }
+        // Move the partial frame to the front of the buffer
+        void compact() {
+            if (begin_ == 0) {
+                return;
+            }
+            std::size_t remaining = end_ - begin_;
+            if (remaining != 0) {
+                std::memmove(buf_.data(), buf_.data() + begin_, remaining);
+            }
+            scan_ -= begin_;
+            end_ = remaining;
+            begin_ = 0;
+        }
+
+        std::array<char, N> buf_;
+        std::size_t         begin_; // Start of current (partial) frame
+        std::size_t         scan_;  // Scanned up to, no terminator before here
+        std::size_t         end_;   // End of data
+        counter_t           frames_;
+        counter_t           overflows_;
+        bool                discarding_; // Tail of an oversized frame
+};
+
+} // an - namespace
+
+#endif
@@ -0,0 +1,56 @@
+#include "gateway.hpp"
+#include <iostream>
+
+an::Gateway::Gateway(Courier& courier, int io_threads, long max_msgs)
+        : courier_(courier), server_(io_threads, max_msgs), queue_(), engine_thread_(),
+          stats_(), disconnects_(0), running_(false) {
+    server_.receiver( [this](std::unique_ptr<Order> o) { queue_.push(std::move(o)); } );
+    server_.riskSlots( [this](const location_t& origin) { return courier_.riskSlot(origin); } );
+    // Cancel on disconnect, one queued message so other sessions' orders carry
+    // on around it and the engine sends the cancels in one batch
+    server_.onDisconnect( [this](const location_t& origin) {
+        queue_.push(std::make_unique<MassCancelOrder>(0, origin, courier_.destination()));
+        disconnects_.fetch_add(1, std::memory_order_release);
+    } );
+    courier_.deliverTo( [this](const location_t& recipient, const transport_msg_t& msg) {
+        server_.send(msg + '\n', (recipient == ALL) ? "" : recipient);
+    } );
+}
+
+an::Gateway::~Gateway() {
+    stop();
+    courier_.deliverTo(Courier::deliver_t());
+}
+
+void an::Gateway::start(std::uint16_t port) {
+    assert(!running_ && "Gateway::start already running");
+    running_ = true;
+    engine_thread_ = std::thread( [this]{ runEngine(); } );
+    server_.start_server(port);
+}
+
+void an::Gateway::stop() {
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+    server_.stop();
+    server_.join_all();
+    queue_.stop();
+    engine_thread_.join();
+}
+
+void an::Gateway::runEngine() {
+    OrderQueue::batch_t batch;
+    while (queue_.pop(batch)) {
+        ++stats_.batches;
+        stats_.orders += batch.size();
+        stats_.max_batch = std::max<counter_t>(stats_.max_batch, batch.size());
+        courier_.tick(); // One engine time for the batch
+        for (auto& o : batch) {
+            courier_.receive(std::move(o));
+        }
+        courier_.publish(); // One market data update per changed book per batch
+        batch.clear();
+    }
+}
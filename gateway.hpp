@@ -0,0 +1,99 @@
+#ifndef AN_GATEWAY_HPP
+#define AN_GATEWAY_HPP
+
+#include "types.hpp"
+#include "order.hpp"
+#include "courier.hpp"
+#include "transport.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+namespace an {
+
+// Hands orders from the io threads to the engine thread. The engine takes
+// everything queued in one go so the lock is taken once per batch, not per order.
+class OrderQueue {
+    public:
+        typedef std::vector<std::unique_ptr<Order>> batch_t;
+
+        OrderQueue() : queue_(), stopped_(false) { }
+        OrderQueue(const OrderQueue&) = delete;
+        OrderQueue& operator=(const OrderQueue&) = delete;
+
+        void push(std::unique_ptr<Order> o) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue_.push_back(std::move(o));
+            }
+            ready_.notify_one();
+        }
+        // Blocks until there are orders, returns false once stopped and empty
+        bool pop(batch_t& batch) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this]{ return !queue_.empty() || stopped_; });
+            batch.swap(queue_);
+            return !batch.empty();
+        }
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopped_ = true;
+            }
+            ready_.notify_all();
+        }
+    private:
+        std::mutex              mutex_;
+        std::condition_variable ready_;
+        batch_t                 queue_;
+        bool                    stopped_;
+};
+
+struct gateway_stats_t {
+    gateway_stats_t() : orders(0), batches(0), max_batch(0) { }
+    counter_t       orders;    // Orders passed to the engine
+    counter_t       batches;   // Engine wake ups
+    counter_t       max_batch; // Largest batch
+};
+
+// Order gateway: clients connect over TCP, their lines are parsed by Author on the
+// io threads, queued to a single engine thread and applied via the Courier. Replies
+// and trade reports are routed back to the originating session by client name.
+// A lost session queues a mass cancel of its orders behind what it already sent.
+class Gateway {
+    public:
+        Gateway(Courier& courier, int io_threads = 1, long max_msgs = 100);
+        ~Gateway();
+        Gateway(const Gateway&) = delete;
+        Gateway& operator=(const Gateway&) = delete;
+
+        // Inbound order rate limits, set before start
+        void throttle(const throttle_t& t) { server_.throttle(t); }
+        void start(std::uint16_t port);
+        // Stop accepting, apply orders already queued then join all threads
+        void stop();
+
+        // Engine thread only, or after stop()
+        const gateway_stats_t& stats() const {
+            return stats_;
+        }
+        // Sessions lost, any thread
+        counter_t disconnects() const { return disconnects_.load(std::memory_order_acquire); }
+        // Throttle counters of all sessions, any thread
+        throttle_stats_t throttleStats() const { return server_.throttleStats(); }
+    private:
+        void runEngine();
+
+        Courier&                            courier_;
+        asio_generic_server<client_handler> server_;
+        OrderQueue                          queue_;
+        std::thread                         engine_thread_;
+        gateway_stats_t                     stats_;
+        std::atomic<counter_t>              disconnects_;
+        bool                                running_;
+};
+
+} // an - namespace
+
+#endif
@@ -0,0 +1,373 @@
+#ifndef AN_LOGGER_HPP
+#define AN_LOGGER_HPP
+
+#include "types.hpp"
+#include "format.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace an {
+
+enum log_level_t { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_OFF };
+
+inline const char* to_string(log_level_t l) {
+     switch (l) {
+        case LOG_DEBUG: return "DEBUG";
+        case LOG_INFO:  return "INFO";
+        case LOG_WARN:  return "WARN";
+        case LOG_ERROR: return "ERROR";
+        case LOG_OFF:   return "OFF";
+        default:
+           assert(false);
+     }
+     return "?";
+}
+
+// Calls below this level are compiled out, e.g. -DAN_LOG_LEVEL=1 drops LOG_DEBUG
+#ifndef AN_LOG_LEVEL
+#define AN_LOG_LEVEL 0
+#endif
+
+// One per call site, its address is the format id written with each record
+struct log_site_t {
+    log_level_t     level;
+    const char*     format; // "{}" for each argument
+    const char*     file;
+    int             line;
+};
+
+// AN_INFO("order id={} price={}", id, price), arguments are copied raw and
+// formatted on the logger thread. Integers, doubles (as prices), chars and
+// strings, strings are copied up to LOG_MAX_STRING.
+#define AN_LOG(LEVEL, FORMAT, ...) \
+    do { \
+        if (((LEVEL) >= AN_LOG_LEVEL) && an::Logger::enabled(LEVEL)) { \
+            static const an::log_site_t an_log_site_ = { LEVEL, FORMAT, __FILE__, __LINE__ }; \
+            an::Logger::instance().write(&an_log_site_, ##__VA_ARGS__); \
+        } \
+    } while (false)
+#define AN_DEBUG(...) AN_LOG(an::LOG_DEBUG, __VA_ARGS__)
+#define AN_INFO(...)  AN_LOG(an::LOG_INFO, __VA_ARGS__)
+#define AN_WARN(...)  AN_LOG(an::LOG_WARN, __VA_ARGS__)
+#define AN_ERROR(...) AN_LOG(an::LOG_ERROR, __VA_ARGS__)
+
+const std::size_t LOG_BUFFER_SIZE = 1 << 16; // Per producer thread, power of two
+const std::size_t LOG_MAX_STRING = 1024;
+
+namespace log_detail {
+    enum arg_t : std::uint8_t { ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_CHAR, ARG_STRING };
+
+    struct header_t {
+        std::uint32_t       size;  // Whole record, multiple of 8
+        std::uint32_t       args;  // PADDING, the rest of the buffer is unused
+        const log_site_t*   site;
+        std::int64_t        time;  // steady_clock ticks
+    };
+    const std::uint32_t PADDING = 0xffffffff;
+
+    inline std::size_t stringSize(std::size_t len) { return 1 + sizeof(std::uint32_t) + std::min(len, LOG_MAX_STRING); }
+
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value, std::size_t>::type
+    argSize(const T&) { return 1 + 8; }
+    inline std::size_t argSize(const char& ) { return 2; }
+    inline std::size_t argSize(const char* s) { return stringSize(std::strlen(s)); }
+    inline std::size_t argSize(const std::string& s) { return stringSize(s.size()); }
+
+    inline char* encodeString(char* p, const char* s, std::size_t len) {
+        const std::uint32_t n = static_cast<std::uint32_t>(std::min(len, LOG_MAX_STRING));
+        *p++ = ARG_STRING;
+        std::memcpy(p, &n, sizeof(n));
+        std::memcpy(p + sizeof(n), s, n);
+        return p + sizeof(n) + n;
+    }
+    template <typename T>
+    char* encodeWord(char* p, arg_t type, T value) {
+        *p++ = type;
+        std::memcpy(p, &value, 8);
+        return p + 8;
+    }
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, char*>::type
+    encode(char* p, const T& v) { return encodeWord(p, ARG_INT, static_cast<std::int64_t>(v)); }
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, char*>::type
+    encode(char* p, const T& v) { return encodeWord(p, ARG_UINT, static_cast<std::uint64_t>(v)); }
+    template <typename T>
+    typename std::enable_if<std::is_enum<T>::value, char*>::type
+    encode(char* p, const T& v) { return encodeWord(p, ARG_INT, static_cast<std::int64_t>(v)); }
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value, char*>::type
+    encode(char* p, const T& v) { return encodeWord(p, ARG_DOUBLE, static_cast<double>(v)); }
+    inline char* encode(char* p, const char& c) { *p++ = ARG_CHAR; *p++ = c; return p; }
+    inline char* encode(char* p, const char* s) { return encodeString(p, s, std::strlen(s)); }
+    inline char* encode(char* p, const std::string& s) { return encodeString(p, s.data(), s.size()); }
+
+    inline std::size_t argsSize() { return 0; }
+    template <typename T, typename... Rest>
+    std::size_t argsSize(const T& first, const Rest&... rest) { return argSize(first) + argsSize(rest...); }
+    inline char* encodeArgs(char* p) { return p; }
+    template <typename T, typename... Rest>
+    char* encodeArgs(char* p, const T& first, const Rest&... rest) { return encodeArgs(encode(p, first), rest...); }
+}
+
+// Single producer single consumer ring of records. The producer never blocks,
+// a record that doesn't fit is dropped and counted.
+class LogBuffer {
+    public:
+        LogBuffer() : buf_(new char[LOG_BUFFER_SIZE]), head_(0), tail_(0), dropped_(0), orphaned_(false) { }
+        LogBuffer(const LogBuffer&) = delete;
+        LogBuffer& operator=(const LogBuffer&) = delete;
+
+        // Producer, room for size bytes or nullptr
+        char* reserve(std::size_t size) {
+            const std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+            const std::uint64_t head = head_.load(std::memory_order_acquire);
+            const std::size_t index = tail & (LOG_BUFFER_SIZE - 1);
+            const std::size_t pad = (index + size > LOG_BUFFER_SIZE) ? LOG_BUFFER_SIZE - index : 0;
+            if ((size > LOG_BUFFER_SIZE / 2) || (tail + pad + size - head > LOG_BUFFER_SIZE)) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            if (pad != 0) {
+                const std::uint32_t mark[2] = { static_cast<std::uint32_t>(pad), log_detail::PADDING };
+                std::memcpy(buf_.get() + index, mark, sizeof(mark));
+                reserved_ = tail + pad;
+                return buf_.get();
+            }
+            reserved_ = tail;
+            return buf_.get() + index;
+        }
+        void commit(std::size_t size) { tail_.store(reserved_ + size, std::memory_order_release); }
+
+        // Consumer, calls read(record) for every committed record
+        template <typename Read>
+        std::size_t drain(Read&& read) {
+            std::uint64_t head = head_.load(std::memory_order_relaxed);
+            const std::uint64_t tail = tail_.load(std::memory_order_acquire);
+            std::size_t records = 0;
+            while (head != tail) {
+                const char* record = buf_.get() + (head & (LOG_BUFFER_SIZE - 1));
+                std::uint32_t mark[2];
+                std::memcpy(mark, record, sizeof(mark));
+                if (mark[1] != log_detail::PADDING) {
+                    read(record);
+                    ++records;
+                }
+                head += mark[0];
+            }
+            head_.store(head, std::memory_order_release);
+            return records;
+        }
+        bool empty() const { return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire); }
+        counter_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+        // Producer thread has exited
+        void orphan() { orphaned_.store(true, std::memory_order_release); }
+        bool orphaned() const { return orphaned_.load(std::memory_order_acquire); }
+    private:
+        std::unique_ptr<char[]>     buf_;
+        std::atomic<std::uint64_t>  head_; // Consumer
+        std::atomic<std::uint64_t>  tail_; // Producer
+        std::uint64_t               reserved_; // Producer, start of the record being written
+        std::atomic<counter_t>      dropped_;
+        std::atomic<bool>           orphaned_;
+};
+
+struct log_stats_t {
+    log_stats_t() : records(0), dropped(0), buffers(0) { }
+    counter_t       records; // Written to the sink
+    counter_t       dropped; // Buffer full
+    counter_t       buffers; // Producer threads
+};
+
+// Asynchronous logger. Hot threads write compact binary records (call site
+// plus raw arguments) to their own LogBuffer, a background thread formats
+// them and hands the text to the sink (std::cout by default). Records of one
+// thread keep their order, threads are interleaved a drain at a time.
+class Logger {
+    public:
+        typedef std::function<void(const char* text, std::size_t len)> sink_t;
+
+        static Logger& instance() {
+            static Logger logger;
+            return logger;
+        }
+        // Runtime filter, LOG_INFO to start with
+        static bool enabled(log_level_t level) { return level >= levelRef().load(std::memory_order_relaxed); }
+        static void setLevel(log_level_t level) { levelRef().store(level, std::memory_order_relaxed); }
+
+        ~Logger() {
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_one();
+            thread_.join();
+        }
+        Logger(const Logger&) = delete;
+        Logger& operator=(const Logger&) = delete;
+
+        template <typename... Args>
+        void write(const log_site_t* site, const Args&... args) {
+            const std::size_t size = (sizeof(log_detail::header_t) + log_detail::argsSize(args...) + 7) & ~std::size_t(7);
+            LogBuffer& buffer = threadBuffer();
+            char* p = buffer.reserve(size);
+            if (p == nullptr) {
+                return;
+            }
+            const log_detail::header_t header = { static_cast<std::uint32_t>(size), sizeof...(args), site,
+                                                  std::chrono::steady_clock::now().time_since_epoch().count() };
+            std::memcpy(p, &header, sizeof(header));
+            log_detail::encodeArgs(p + sizeof(header), args...);
+            buffer.commit(size);
+        }
+
+        // Format everything written so far, e.g. before checking the sink
+        void flush() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            drainAll();
+        }
+        void sinkTo(sink_t sink) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            drainAll(); // What was written goes to the old sink
+            sink_ = sink ? sink : coutSink();
+        }
+        log_stats_t stats() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            log_stats_t stats = stats_;
+            stats.buffers = buffers_.size();
+            for (const auto& buffer : buffers_) {
+                stats.dropped += buffer->dropped();
+            }
+            return stats;
+        }
+    private:
+        Logger() : mutex_(), buffers_(), sink_(coutSink()), out_(), timestamp_(), stats_(), retired_dropped_(0),
+                   steady_start_(std::chrono::steady_clock::now()), system_start_(std::chrono::system_clock::now()),
+                   wake_mutex_(), wake_(), stopping_(false), thread_() {
+            thread_ = std::thread( [this]{ run(); } );
+        }
+
+        static std::atomic<int>& levelRef() {
+            static std::atomic<int> level(LOG_INFO);
+            return level;
+        }
+        static sink_t coutSink() {
+            return [](const char* text, std::size_t len) { std::cout.write(text, len); std::cout.flush(); };
+        }
+
+        // The thread's buffer, registered on its first record
+        struct thread_buffer_t {
+            thread_buffer_t() : buffer(std::make_shared<LogBuffer>()) { }
+            ~thread_buffer_t() { buffer->orphan(); }
+            std::shared_ptr<LogBuffer> buffer;
+        };
+        LogBuffer& threadBuffer() {
+            thread_local thread_buffer_t local;
+            thread_local bool registered = false;
+            if (!registered) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                buffers_.push_back(local.buffer);
+                registered = true;
+            }
+            return *local.buffer;
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> wait(wake_mutex_);
+            while (!stopping_) {
+                wake_.wait_for(wait, std::chrono::milliseconds(1));
+                std::lock_guard<std::mutex> lock(mutex_);
+                drainAll();
+            }
+            wait.unlock();
+            std::lock_guard<std::mutex> lock(mutex_);
+            drainAll();
+        }
+        // Under mutex_
+        void drainAll() {
+            out_.clear();
+            for (auto it = buffers_.begin(); it != buffers_.end(); ) {
+                LogBuffer& buffer = **it;
+                const bool orphaned = buffer.orphaned(); // Before draining, nothing is written after
+                stats_.records += buffer.drain( [this](const char* record) { format(record); } );
+                if (orphaned) {
+                    retired_dropped_ += buffer.dropped();
+                    it = buffers_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            stats_.dropped = retired_dropped_;
+            if (!out_.empty()) {
+                sink_(out_.data(), out_.size());
+            }
+        }
+        void format(const char* record) {
+            log_detail::header_t header;
+            std::memcpy(&header, record, sizeof(header));
+            const char* arg = record + sizeof(header);
+            char buf[MAX_MESSAGE_SIZE + 64];
+            Formatter f(buf, sizeof(buf));
+            const since_t time{ std::chrono::steady_clock::duration(header.time) };
+            timestamp_.write(f, system_start_ + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                     time - steady_start_));
+            f << ' ' << an::to_string(header.site->level) << ' ';
+            const char* text = header.site->format;
+            for (std::uint32_t i = 0; i < header.args; ++i) {
+                const char* place = std::strstr(text, "{}");
+                if (place == nullptr) { // More arguments than places, they follow the text
+                    f << text << ' ';
+                    text = "";
+                } else {
+                    f.append(text, place - text);
+                    text = place + 2;
+                }
+                arg = formatArg(f, arg);
+            }
+            f << text;
+            out_.append(buf, std::min(f.size(), f.capacity()));
+            out_ += '\n';
+        }
+        static const char* formatArg(Formatter& f, const char* arg) {
+            const log_detail::arg_t type = static_cast<log_detail::arg_t>(*arg++);
+            switch (type) {
+                case log_detail::ARG_INT:    { std::int64_t v; std::memcpy(&v, arg, 8); f << v; return arg + 8; }
+                case log_detail::ARG_UINT:   { std::uint64_t v; std::memcpy(&v, arg, 8); f << v; return arg + 8; }
+                case log_detail::ARG_DOUBLE: { double v; std::memcpy(&v, arg, 8); f.fixed(v, MAX_PRICE_PRECISION); return arg + 8; }
+                case log_detail::ARG_CHAR:   f << *arg; return arg + 1;
+                case log_detail::ARG_STRING: {
+                    std::uint32_t n;
+                    std::memcpy(&n, arg, sizeof(n));
+                    f.append(arg + sizeof(n), n);
+                    return arg + sizeof(n) + n;
+                }
+                default:
+                    assert(false && "Logger::formatArg unknown argument type");
+                    return arg;
+            }
+        }
+
+        std::mutex                  mutex_; // Guards buffers_, sink_, out_ and stats_
+        std::vector<std::shared_ptr<LogBuffer>> buffers_;
+        sink_t                      sink_;
+        std::string                 out_;
+        TimestampFormatter          timestamp_;
+        log_stats_t                 stats_;
+        counter_t                   retired_dropped_; // Of orphaned buffers
+        since_t                     steady_start_;
+        std::chrono::system_clock::time_point system_start_;
+        std::mutex                  wake_mutex_;
+        std::condition_variable     wake_;
+        bool                        stopping_;
+        std::thread                 thread_;
+};
+
+} // an - namespace
+
+#endif
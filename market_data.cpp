@@ -0,0 +1,514 @@
+#include "market_data.hpp"
+#include <algorithm>
+#include <cstring>
+
+using boost::asio::ip::udp;
+using boost::asio::ip::tcp;
+
+namespace {
+    const std::size_t QUOTE_SIZE = an::MD_HEADER_SIZE + an::MD_SYMBOL_LEN + 7*sizeof(std::int64_t);
+    const std::size_t TRADE_SIZE = an::MD_HEADER_SIZE + an::MD_SYMBOL_LEN + 3*sizeof(std::int64_t);
+    const std::size_t LEVEL_SIZE = an::MD_HEADER_SIZE + an::MD_SYMBOL_LEN + 2 + 3*sizeof(std::int64_t);
+    const double PRICE_SCALE = std::pow(10, an::MAX_PRICE_PRECISION);
+    const double VOLUME_SCALE = std::pow(10, an::VOLUME_OUTPUT_PRECISION);
+
+    template <typename T>
+    inline void put(char*& p, T value) {
+        std::memcpy(p, &value, sizeof(T));
+        p += sizeof(T);
+    }
+    template <typename T>
+    inline T get(const char*& p) {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+    inline std::int64_t toFixed(double value, double scale) {
+        return std::llround(value * scale);
+    }
+    inline double fromFixed(std::int64_t value, double scale) {
+        return static_cast<double>(value) / scale;
+    }
+
+    void putHeader(char*& p, an::sequence_t seq, std::uint64_t time_ns, std::size_t size,
+                   an::md_msg_t type, std::uint8_t flags) {
+        put<an::sequence_t>(p, seq);
+        put<std::uint64_t>(p, time_ns);
+        put<std::uint16_t>(p, static_cast<std::uint16_t>(size));
+        put<std::uint8_t>(p, type);
+        put<std::uint8_t>(p, flags);
+    }
+
+    std::uint64_t nowNanos() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Sequence number is patched in after encoding
+    void setSeq(char* buf, an::sequence_t seq) {
+        std::memcpy(buf, &seq, sizeof(seq));
+    }
+}
+
+std::size_t an::encodeMarketData(const market_data_t& md, std::uint64_t time_ns, char* buf, std::size_t len) {
+    if (md.symbol.size() > MD_SYMBOL_LEN) {
+        return 0;
+    }
+    std::uint8_t flags = (md.have_bid ? MD_HAVE_BID : 0) | (md.have_ask ? MD_HAVE_ASK : 0)
+                         | (md.have_last_trade ? MD_HAVE_TRADE : 0);
+    bool quote = md.have_bid || md.have_ask || !md.have_last_trade;
+    std::size_t size = quote ? QUOTE_SIZE : TRADE_SIZE;
+    if (quote && !md.have_last_trade) {
+        size -= 3*sizeof(std::int64_t);
+    }
+    if (size > len) {
+        return 0;
+    }
+
+    char* p = buf;
+    putHeader(p, md.seq, time_ns, size, quote ? MD_QUOTE : MD_TRADE, flags);
+    std::memset(p, 0, MD_SYMBOL_LEN);
+    std::memcpy(p, md.symbol.data(), md.symbol.size());
+    p += MD_SYMBOL_LEN;
+    if (quote) {
+        put<std::int64_t>(p, md.have_bid ? toFixed(md.bid, PRICE_SCALE) : 0);
+        put<std::int64_t>(p, md.have_bid ? md.bid_size : 0);
+        put<std::int64_t>(p, md.have_ask ? toFixed(md.ask, PRICE_SCALE) : 0);
+        put<std::int64_t>(p, md.have_ask ? md.ask_size : 0);
+    }
+    if (md.have_last_trade) {
+        put<std::int64_t>(p, toFixed(md.last_trade_price, PRICE_SCALE));
+        put<std::int64_t>(p, md.last_trade_shares);
+        put<std::int64_t>(p, toFixed(md.volume, VOLUME_SCALE));
+    }
+    assert(static_cast<std::size_t>(p - buf) == size && "encodeMarketData size mismatch");
+    return size;
+}
+
+std::size_t an::encodeLevel(const symbol_t& symbol, const level_delta_t& delta, std::uint64_t time_ns,
+                            char* buf, std::size_t len) {
+    if ((symbol.size() > MD_SYMBOL_LEN) || (LEVEL_SIZE > len)) {
+        return 0;
+    }
+    char* p = buf;
+    putHeader(p, 0, time_ns, LEVEL_SIZE, MD_LEVEL, 0);
+    std::memset(p, 0, MD_SYMBOL_LEN);
+    std::memcpy(p, symbol.data(), symbol.size());
+    p += MD_SYMBOL_LEN;
+    put<std::uint8_t>(p, static_cast<std::uint8_t>(delta.action));
+    put<std::uint8_t>(p, static_cast<std::uint8_t>(delta.direction));
+    put<std::int64_t>(p, toFixed(delta.level.price, PRICE_SCALE));
+    put<std::int64_t>(p, delta.level.shares);
+    put<std::int64_t>(p, delta.level.orders);
+    assert(static_cast<std::size_t>(p - buf) == LEVEL_SIZE && "encodeLevel size mismatch");
+    return LEVEL_SIZE;
+}
+
+std::size_t an::encodeEnd(sequence_t seq, char* buf, std::size_t len) {
+    if (len < MD_HEADER_SIZE) {
+        return 0;
+    }
+    char* p = buf;
+    putHeader(p, seq, nowNanos(), MD_HEADER_SIZE, MD_END, 0);
+    return MD_HEADER_SIZE;
+}
+
+bool an::decodeHeader(const char* buf, std::size_t len, md_header_t& hdr) {
+    if (len < MD_HEADER_SIZE) {
+        return false;
+    }
+    const char* p = buf;
+    hdr.seq = get<sequence_t>(p);
+    hdr.time_ns = get<std::uint64_t>(p);
+    hdr.length = get<std::uint16_t>(p);
+    hdr.type = static_cast<md_msg_t>(get<std::uint8_t>(p));
+    hdr.flags = get<std::uint8_t>(p);
+    return (hdr.length >= MD_HEADER_SIZE) && (hdr.length <= len);
+}
+
+bool an::decodeMarketData(const char* buf, std::size_t len, market_data_t& md) {
+    md_header_t hdr;
+    if (!decodeHeader(buf, len, hdr)) {
+        return false;
+    }
+    bool have_trade = (hdr.flags & MD_HAVE_TRADE) != 0;
+    std::size_t expect;
+    switch (hdr.type) {
+        case MD_QUOTE:
+            expect = have_trade ? QUOTE_SIZE : QUOTE_SIZE - 3*sizeof(std::int64_t);
+            break;
+        case MD_TRADE:
+            expect = TRADE_SIZE;
+            have_trade = true;
+            break;
+        default:
+            return false;
+    }
+    if (hdr.length != expect) {
+        return false;
+    }
+
+    const char* p = buf + MD_HEADER_SIZE;
+    md.seq = hdr.seq;
+    md.symbol.assign(p, strnlen(p, MD_SYMBOL_LEN));
+    p += MD_SYMBOL_LEN;
+    md.have_bid = (hdr.flags & MD_HAVE_BID) != 0;
+    md.have_ask = (hdr.flags & MD_HAVE_ASK) != 0;
+    md.bid = md.ask = 0.0;
+    md.bid_size = md.ask_size = 0;
+    if (hdr.type == MD_QUOTE) {
+        md.bid = fromFixed(get<std::int64_t>(p), PRICE_SCALE);
+        md.bid_size = get<std::int64_t>(p);
+        md.ask = fromFixed(get<std::int64_t>(p), PRICE_SCALE);
+        md.ask_size = get<std::int64_t>(p);
+    }
+    md.have_last_trade = have_trade;
+    md.last_trade_price = 0.0;
+    md.last_trade_shares = 0;
+    md.volume = 0.0;
+    if (have_trade) {
+        md.last_trade_price = fromFixed(get<std::int64_t>(p), PRICE_SCALE);
+        md.last_trade_shares = get<std::int64_t>(p);
+        md.volume = fromFixed(get<std::int64_t>(p), VOLUME_SCALE);
+    }
+    std::chrono::system_clock::time_point tp{
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(hdr.time_ns)) };
+    md.quote_time = date::format("%T", tp);
+    md.trade_time = have_trade ? md.quote_time : "";
+    return true;
+}
+
+bool an::decodeLevel(const char* buf, std::size_t len, md_level_t& level) {
+    md_header_t hdr;
+    if (!decodeHeader(buf, len, hdr) || (hdr.type != MD_LEVEL) || (hdr.length != LEVEL_SIZE)) {
+        return false;
+    }
+    const char* p = buf + MD_HEADER_SIZE;
+    level.seq = hdr.seq;
+    level.symbol.assign(p, strnlen(p, MD_SYMBOL_LEN));
+    p += MD_SYMBOL_LEN;
+    const std::uint8_t action = get<std::uint8_t>(p);
+    const std::uint8_t direction = get<std::uint8_t>(p);
+    if ((action > LEVEL_CLEAR) || (direction > SELL)) {
+        return false;
+    }
+    level.delta.action = static_cast<level_action_t>(action);
+    level.delta.direction = static_cast<direction_t>(direction);
+    level.delta.level.price = fromFixed(get<std::int64_t>(p), PRICE_SCALE);
+    level.delta.level.shares = get<std::int64_t>(p);
+    level.delta.level.orders = get<std::int64_t>(p);
+    return true;
+}
+
+
+// ****************** PUBLISHER ********************
+
+an::MarketDataPublisher::MarketDataPublisher(const udp::endpoint& feed, std::size_t history_size)
+        : io_context_(), socket_(io_context_, udp::endpoint(feed.protocol(), 0)), feed_(feed),
+          acceptor_(io_context_), thread_(), mutex_(), seq_(0), history_(history_size), latest_(),
+          levels_(), stats_() {
+    assert(history_size > 0 && "MarketDataPublisher history_size must be positive");
+    if (feed.address().is_multicast()) {
+        socket_.set_option(boost::asio::ip::multicast::enable_loopback(true));
+    }
+}
+
+an::MarketDataPublisher::~MarketDataPublisher() {
+    stop();
+}
+
+void an::MarketDataPublisher::start(std::uint16_t recovery_port) {
+    assert(!thread_.joinable() && "MarketDataPublisher::start already running");
+    tcp::endpoint endpoint(tcp::v4(), recovery_port);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(tcp::acceptor::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    accept();
+    thread_ = std::thread( [this]{ io_context_.run(); } );
+}
+
+void an::MarketDataPublisher::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    io_context_.stop();
+    thread_.join();
+    boost::system::error_code ec;
+    acceptor_.close(ec);
+}
+
+an::sequence_t an::MarketDataPublisher::publish(const market_data_t& md) {
+    md_packet_t pkt;
+    pkt.size = static_cast<std::uint16_t>(encodeMarketData(md, nowNanos(), pkt.data.data(), pkt.data.size()));
+    if (pkt.size == 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.send_errors;
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pkt.seq = ++seq_;
+        setSeq(pkt.data.data(), pkt.seq);
+        history_[pkt.seq % history_.size()] = pkt;
+        latest_[md.symbol] = pkt;
+        ++stats_.published;
+    }
+    send(pkt);
+    return pkt.seq;
+}
+
+an::sequence_t an::MarketDataPublisher::publish(const symbol_t& symbol, const std::vector<level_delta_t>& deltas) {
+    sequence_t last = 0;
+    const std::uint64_t time_ns = nowNanos();
+    md_packet_t pkt;
+    for (const level_delta_t& delta : deltas) {
+        pkt.size = static_cast<std::uint16_t>(encodeLevel(symbol, delta, time_ns, pkt.data.data(), pkt.data.size()));
+        if (pkt.size == 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++stats_.send_errors;
+            return last;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pkt.seq = ++seq_;
+            setSeq(pkt.data.data(), pkt.seq);
+            history_[pkt.seq % history_.size()] = pkt;
+            const level_key_t key(static_cast<std::uint8_t>(delta.direction), toFixed(delta.level.price, PRICE_SCALE));
+            auto& levels = levels_[symbol]; // Kept when empty, the snapshot still clears it
+            if (delta.action == LEVEL_DELETE) {
+                levels.erase(key);
+            } else {
+                levels[key] = pkt;
+            }
+            ++stats_.published;
+        }
+        send(pkt);
+        last = pkt.seq;
+    }
+    return last;
+}
+
+bool an::MarketDataPublisher::send(md_packet_t& pkt) {
+    boost::system::error_code ec;
+    socket_.send_to(boost::asio::buffer(pkt.data.data(), pkt.size), feed_, 0, ec);
+    if (ec) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.send_errors; // Receivers recover via retransmit
+        return false;
+    }
+    return true;
+}
+
+an::sequence_t an::MarketDataPublisher::lastSeq() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return seq_;
+}
+
+an::publisher_stats_t an::MarketDataPublisher::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void an::MarketDataPublisher::accept() {
+    auto sock = std::make_shared<tcp::socket>(io_context_);
+    acceptor_.async_accept(*sock, [this, sock](const boost::system::error_code& ec) {
+        if (!ec) {
+            auto request = std::make_shared<boost::asio::streambuf>(256);
+            boost::asio::async_read_until(*sock, *request, '\n',
+                [this, sock, request](const boost::system::error_code& ec, std::size_t) {
+                    if (!ec) {
+                        serve(sock, request);
+                    }
+                });
+        }
+        if (acceptor_.is_open()) {
+            accept();
+        }
+    });
+}
+
+void an::MarketDataPublisher::serve(std::shared_ptr<tcp::socket> sock,
+                                    std::shared_ptr<boost::asio::streambuf> request) {
+    std::istream is(request.get());
+    std::string cmd;
+    is >> cmd;
+    auto reply = std::make_shared<std::string>();
+    if (cmd == "RETRANSMIT") {
+        sequence_t first = 0, last = 0;
+        is >> first >> last;
+        retransmit(first, last, *reply);
+    } else if (cmd == "SNAPSHOT") {
+        snapshot(*reply);
+    } else {
+        return; // Unknown request, drop the connection
+    }
+    boost::asio::async_write(*sock, boost::asio::buffer(*reply),
+        [sock, reply](const boost::system::error_code&, std::size_t) { });
+}
+
+void an::MarketDataPublisher::retransmit(sequence_t first, sequence_t last, std::string& reply) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.retransmit_requests;
+    last = std::min(last, seq_);
+    // Anything older than the ring has been overwritten
+    sequence_t oldest = (seq_ >= history_.size()) ? seq_ - history_.size() + 1 : 1;
+    for (sequence_t s = std::max(first, oldest); s <= last; ++s) {
+        const md_packet_t& pkt = history_[s % history_.size()];
+        appendPacket(reply, pkt.data.data(), pkt.size);
+        ++stats_.retransmitted;
+    }
+    char end[MD_HEADER_SIZE];
+    appendPacket(reply, end, static_cast<std::uint16_t>(encodeEnd(seq_, end, sizeof(end))));
+}
+
+void an::MarketDataPublisher::snapshot(std::string& reply) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.snapshot_requests;
+    std::vector<const md_packet_t*> pkts;
+    pkts.reserve(latest_.size());
+    for (const auto& kv : latest_) {
+        pkts.push_back(&kv.second);
+    }
+    // Each symbol's clear goes first, unsequenced, then the live levels
+    md_packet_t clear;
+    const level_delta_t all{LEVEL_CLEAR, BUY, price_level_t{0.0, 0, 0}};
+    const std::uint64_t time_ns = nowNanos();
+    for (const auto& book : levels_) {
+        clear.size = static_cast<std::uint16_t>(encodeLevel(book.first, all, time_ns, clear.data.data(), clear.data.size()));
+        appendPacket(reply, clear.data.data(), clear.size);
+        for (const auto& kv : book.second) {
+            pkts.push_back(&kv.second);
+        }
+    }
+    std::sort(pkts.begin(), pkts.end(),
+              [](const md_packet_t* a, const md_packet_t* b) { return a->seq < b->seq; });
+    for (const md_packet_t* pkt : pkts) {
+        appendPacket(reply, pkt->data.data(), pkt->size);
+        ++stats_.retransmitted;
+    }
+    char end[MD_HEADER_SIZE];
+    appendPacket(reply, end, static_cast<std::uint16_t>(encodeEnd(seq_, end, sizeof(end))));
+}
+
+void an::MarketDataPublisher::appendPacket(std::string& reply, const char* data, std::uint16_t size) {
+    reply.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    reply.append(data, size);
+}
+
+
+// ****************** RECEIVER ********************
+
+an::MarketDataReceiver::MarketDataReceiver(const udp::endpoint& feed, const tcp::endpoint& recovery)
+        : io_context_(), socket_(io_context_), recovery_(recovery), expected_(1), stats_(), depth_(), buf_() {
+    socket_.open(feed.protocol());
+    socket_.set_option(udp::socket::reuse_address(true));
+    if (feed.address().is_multicast()) {
+        socket_.bind(udp::endpoint(feed.protocol(), feed.port()));
+        socket_.set_option(boost::asio::ip::multicast::join_group(feed.address()));
+    } else {
+        socket_.bind(feed);
+    }
+}
+
+void an::MarketDataReceiver::poll(std::vector<market_data_t>& out) {
+    std::size_t len = socket_.receive(boost::asio::buffer(buf_));
+    onPacket(buf_.data(), len, out);
+}
+
+void an::MarketDataReceiver::onPacket(const char* data, std::size_t len, std::vector<market_data_t>& out) {
+    md_header_t hdr;
+    if (!decodeHeader(data, len, hdr)) {
+        return;
+    }
+    ++stats_.received;
+    if (hdr.seq < expected_) {
+        ++stats_.duplicates;
+        return;
+    }
+    if (hdr.seq > expected_) {
+        ++stats_.gaps;
+        if (!recover(hdr.seq - 1, out) && (expected_ < hdr.seq)) {
+            stats_.lost += hdr.seq - expected_;
+            expected_ = hdr.seq;
+        }
+        if (hdr.seq < expected_) {
+            return; // Recovery already delivered it
+        }
+    }
+    (void) deliver(data, len, out);
+    expected_ = hdr.seq + 1;
+}
+
+bool an::MarketDataReceiver::deliver(const char* data, std::size_t len, std::vector<market_data_t>& out) {
+    md_header_t hdr;
+    if (decodeHeader(data, len, hdr) && (hdr.type == MD_LEVEL)) {
+        md_level_t level;
+        if (!decodeLevel(data, len, level)) {
+            return false;
+        }
+        if (depth_) {
+            depth_(level);
+        }
+    } else {
+        market_data_t md;
+        if (!decodeMarketData(data, len, md)) {
+            return false;
+        }
+        out.push_back(md);
+    }
+    ++stats_.delivered;
+    return true;
+}
+
+bool an::MarketDataReceiver::recover(sequence_t last, std::vector<market_data_t>& out) {
+    try {
+        std::ostringstream req;
+        req << "RETRANSMIT " << expected_ << ' ' << last << '\n';
+        request(req.str(), false, out);
+        if (expected_ > last) {
+            return true;
+        }
+        // Publisher history no longer covers the gap, start again from its latest state
+        ++stats_.snapshots;
+        sequence_t end = request("SNAPSHOT\n", true, out);
+        expected_ = std::max(expected_, end + 1);
+        return true;
+    } catch (const boost::system::system_error&) {
+        return false;
+    }
+}
+
+an::sequence_t an::MarketDataReceiver::request(const std::string& req, bool snapshot,
+                                               std::vector<market_data_t>& out) {
+    tcp::socket sock(io_context_);
+    sock.connect(recovery_);
+    boost::asio::write(sock, boost::asio::buffer(req));
+    std::array<char, MD_MAX_PACKET> pkt;
+    for (;;) {
+        std::uint16_t size = 0;
+        boost::asio::read(sock, boost::asio::buffer(&size, sizeof(size)));
+        if (size > pkt.size()) {
+            throw boost::system::system_error(boost::asio::error::message_size);
+        }
+        boost::asio::read(sock, boost::asio::buffer(pkt.data(), size));
+        md_header_t hdr;
+        if (!decodeHeader(pkt.data(), size, hdr)) {
+            throw boost::system::system_error(boost::asio::error::invalid_argument);
+        }
+        if (hdr.type == MD_END) {
+            return hdr.seq;
+        }
+        // Snapshot holds the latest message per symbol so may skip numbers. Its
+        // levels are all applied, they follow the clear of their symbol's depth.
+        bool wanted = snapshot ? ((hdr.seq >= expected_) || (hdr.type == MD_LEVEL)) : (hdr.seq == expected_);
+        if (wanted && deliver(pkt.data(), size, out) && (hdr.seq >= expected_)) {
+            if (snapshot) {
+                stats_.lost += hdr.seq - expected_;
+            }
+            ++stats_.recovered;
+            expected_ = hdr.seq + 1;
+        }
+    }
+}
@@ -0,0 +1,190 @@
+#ifndef AN_MARKET_DATA_HPP
+#define AN_MARKET_DATA_HPP
+
+#include "types.hpp"
+#include <array>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <boost/asio.hpp>
+
+namespace an {
+
+// ****************** BINARY MARKET DATA ********************
+// One message per datagram, fields in host byte order (feeds stay on the LAN).
+// Prices are fixed point with MAX_PRICE_PRECISION decimals, volume with
+// VOLUME_OUTPUT_PRECISION decimals.
+//
+//   header  seq:u64 time_ns:u64 length:u16 type:u8 flags:u8     (20 bytes)
+//   QUOTE   symbol:char[12] bid:i64 bid_size:i64 ask:i64 ask_size:i64
+//           last:i64 last_shares:i64 volume:i64                 (last only if MD_HAVE_TRADE)
+//   TRADE   symbol:char[12] last:i64 last_shares:i64 volume:i64
+//   LEVEL   symbol:char[12] action:u8 side:u8 price:i64 shares:i64 orders:i64
+//   END     (empty, seq is the last published sequence number)
+//
+// time_ns is the publish time (system clock), receivers use it for quote_time
+// and trade_time. LEVEL is one depth of book delta (level_delta_t), shares and
+// orders are the level's totals after the change so ADD and MODIFY both set it.
+// CLEAR is only sent in snapshots, unsequenced (seq 0) ahead of the symbol's levels.
+
+enum md_msg_t : std::uint8_t { MD_QUOTE = 1, MD_TRADE = 2, MD_END = 3, MD_LEVEL = 4 };
+enum md_flag_t : std::uint8_t { MD_HAVE_BID = 1, MD_HAVE_ASK = 2, MD_HAVE_TRADE = 4 };
+
+const std::size_t MD_SYMBOL_LEN = 12;
+const std::size_t MD_HEADER_SIZE = 20;
+const std::size_t MD_MAX_PACKET = 128;
+
+struct md_header_t {
+    sequence_t      seq;
+    std::uint64_t   time_ns;
+    std::uint16_t   length; // Whole packet including header
+    md_msg_t        type;
+    std::uint8_t    flags;
+};
+
+// Decoded LEVEL packet
+struct md_level_t {
+    sequence_t      seq;
+    symbol_t        symbol;
+    level_delta_t   delta;
+};
+
+struct md_packet_t {
+    md_packet_t() : seq(0), size(0) { }
+    sequence_t                          seq;
+    std::uint16_t                       size;
+    std::array<char, MD_MAX_PACKET>     data;
+};
+
+// Returns packet size, 0 if the symbol does not fit
+std::size_t encodeMarketData(const market_data_t& md, std::uint64_t time_ns, char* buf, std::size_t len);
+std::size_t encodeLevel(const symbol_t& symbol, const level_delta_t& delta, std::uint64_t time_ns,
+                        char* buf, std::size_t len);
+std::size_t encodeEnd(sequence_t seq, char* buf, std::size_t len);
+bool decodeHeader(const char* buf, std::size_t len, md_header_t& hdr);
+// QUOTE or TRADE packet into md, false if malformed
+bool decodeMarketData(const char* buf, std::size_t len, market_data_t& md);
+// LEVEL packet into level, false if malformed
+bool decodeLevel(const char* buf, std::size_t len, md_level_t& level);
+
+
+// ****************** PUBLISHER ********************
+
+struct publisher_stats_t {
+    publisher_stats_t() : published(0), send_errors(0), retransmit_requests(0),
+                          snapshot_requests(0), retransmitted(0) { }
+    counter_t       published;
+    counter_t       send_errors;
+    counter_t       retransmit_requests;
+    counter_t       snapshot_requests;
+    counter_t       retransmitted; // Packets sent over TCP recovery
+};
+
+// Publishes market data as datagrams (unicast or multicast group) and keeps the
+// last history_size packets plus the latest quote per symbol and the latest
+// delta per depth level. A TCP service answers "RETRANSMIT <first> <last>" and
+// "SNAPSHOT" requests so receivers can recover gaps; replies are u16 length
+// prefixed packets ending with an END packet. The snapshot clears each symbol's
+// depth before its live levels so a receiver's stale levels are dropped too.
+class MarketDataPublisher {
+    public:
+        MarketDataPublisher(const boost::asio::ip::udp::endpoint& feed, std::size_t history_size = 4096);
+        ~MarketDataPublisher();
+        MarketDataPublisher(const MarketDataPublisher&) = delete;
+        MarketDataPublisher& operator=(const MarketDataPublisher&) = delete;
+
+        // Start the recovery service (own thread)
+        void start(std::uint16_t recovery_port);
+        void stop();
+
+        // Stamps the channel sequence number (md.seq is ignored) and sends
+        sequence_t publish(const market_data_t& md);
+        // One LEVEL packet per delta on the same channel, returns the last sequence number
+        sequence_t publish(const symbol_t& symbol, const std::vector<level_delta_t>& deltas);
+
+        sequence_t lastSeq() const;
+        publisher_stats_t stats() const;
+    private:
+        void accept();
+        void serve(std::shared_ptr<boost::asio::ip::tcp::socket> sock,
+                   std::shared_ptr<boost::asio::streambuf> request);
+        void retransmit(sequence_t first, sequence_t last, std::string& reply);
+        void snapshot(std::string& reply);
+        void appendPacket(std::string& reply, const char* data, std::uint16_t size);
+        // Sequence, keep and send an encoded packet, false if not sent
+        bool send(md_packet_t& pkt);
+
+        // Side and fixed point price
+        typedef std::pair<std::uint8_t, std::int64_t> level_key_t;
+
+        boost::asio::io_context             io_context_;
+        boost::asio::ip::udp::socket        socket_;
+        boost::asio::ip::udp::endpoint      feed_;
+        boost::asio::ip::tcp::acceptor      acceptor_;
+        std::thread                         thread_;
+        mutable std::mutex                  mutex_; // Guards below, publisher vs recovery thread
+        sequence_t                          seq_;
+        std::vector<md_packet_t>            history_; // Ring indexed by seq
+        std::unordered_map<symbol_t, md_packet_t> latest_;
+        std::unordered_map<symbol_t, std::map<level_key_t, md_packet_t>> levels_;
+        publisher_stats_t                   stats_;
+};
+
+
+// ****************** RECEIVER ********************
+
+struct receiver_stats_t {
+    receiver_stats_t() : received(0), delivered(0), duplicates(0), gaps(0),
+                         recovered(0), snapshots(0), lost(0) { }
+    counter_t       received;
+    counter_t       delivered;
+    counter_t       duplicates;
+    counter_t       gaps;
+    counter_t       recovered; // Messages filled in by retransmit or snapshot
+    counter_t       snapshots;
+    counter_t       lost;      // Sequence numbers that could not be recovered
+};
+
+// Delivers market data in sequence. On a gap the missing range is requested
+// from the publisher's recovery service, falling back to a snapshot when the
+// publisher's history no longer has it. Depth levels go to the depthTo hook,
+// in the same sequence, and are dropped without one.
+class MarketDataReceiver {
+    public:
+        typedef std::function<void(const md_level_t& level)> depth_t;
+
+        MarketDataReceiver(const boost::asio::ip::udp::endpoint& feed,
+                           const boost::asio::ip::tcp::endpoint& recovery);
+        MarketDataReceiver(const MarketDataReceiver&) = delete;
+        MarketDataReceiver& operator=(const MarketDataReceiver&) = delete;
+
+        // Block for one datagram, append everything now deliverable
+        void poll(std::vector<market_data_t>& out);
+        // Process one datagram received by other means
+        void onPacket(const char* data, std::size_t len, std::vector<market_data_t>& out);
+
+        void depthTo(depth_t depth) { depth_ = depth; }
+
+        sequence_t expected() const { return expected_; }
+        const receiver_stats_t& stats() const { return stats_; }
+    private:
+        // Decode a QUOTE, TRADE or LEVEL packet to out or the depth hook
+        bool deliver(const char* data, std::size_t len, std::vector<market_data_t>& out);
+        // Fill [expected_, last], false if something could not be recovered
+        bool recover(sequence_t last, std::vector<market_data_t>& out);
+        // Send request, deliver packets in order (all of a snapshot's levels), returns END sequence number
+        sequence_t request(const std::string& req, bool snapshot, std::vector<market_data_t>& out);
+
+        boost::asio::io_context             io_context_;
+        boost::asio::ip::udp::socket        socket_;
+        boost::asio::ip::tcp::endpoint      recovery_;
+        sequence_t                          expected_;
+        receiver_stats_t                    stats_;
+        depth_t                             depth_;
+        std::array<char, MD_MAX_PACKET>     buf_;
+};
+
+} // an - namespace
+
+#endif
@@ -2,23 +2,42 @@
 #include "matching_engine.hpp"
 #include "security_master.hpp"
 #include "courier.hpp"
+#include "logger.hpp"
+#include <thread>
 
 
+namespace {
+    const an::TickTable noTicks; // Rejects every price
+}
+
 an::MatchingEngine::MatchingEngine(const location_t& exchange, SecurityDatabase& secdb, 
                                    Courier& courier, bool bookkeep)
-             : seq_(1),
-             epoch_{ std::chrono::steady_clock::now(), std::chrono::system_clock::now() },
-             exchange_(exchange), secdb_(secdb), courier_(courier), book_(), stats_(), rejects_(0), open_(false) {
-    book_.reserve(secdb.securities().size() *2);
-    for (const auto& sec : secdb.securities() ) {
-        TickTable* ttPtr = secdb.tickTable(sec.ladder_id);
+             : seq_(1), md_seq_(1),
+             epoch_{ std::chrono::steady_clock::now(), std::chrono::system_clock::now() }, clock_(),
+             exchange_(exchange), courier_(courier), bookkeep_(bookkeep), book_(), symbol_book_(), dirty_(),
+             stats_(), risk_(), rejects_(0), open_(false),
+             reload_mutex_(), tables_(), listings_(), queue_mutex_(), reloads_(), retired_(), listed_(),
+             reload_pending_(false) {
+    symbol_book_.reserve(secdb.securities().size());
+    listings_.reserve(secdb.securities().size());
+    std::unordered_map<const TickTable*, const TickTable*> seen;
+    // One book per security, only live securities on this exchange are found
+    for (std::size_t i = 0; i < secdb.securities().size(); ++i) {
+        const auto& sec = secdb.securities()[i];
+        const TickTable* ttPtr = internTable(secdb.tickTable(i), seen);
+        const bool live = (secdb.find(sec.symbol) == i);
         if (ttPtr == nullptr) {
-            std::cout << sec.symbol << " skipping invalid tick_ladder_id " << sec.ladder_id << std::endl;
-            continue;
+            AN_WARN("{} not opening, invalid tick_ladder_id {}", sec.symbol, sec.ladder_id);
+            book_.emplace_back(this, sec.symbol,epoch_, noTicks, bookkeep, sec.closing_price);
+        } else {
+            book_.emplace_back(this, sec.symbol,epoch_, *ttPtr, bookkeep, sec.closing_price);
+            if (!sec.has_died && (sec.exchange == exchange)) {
+                book_.back().open();
+            }
         }
-        book_.emplace_back(this, sec.symbol,epoch_, *ttPtr, bookkeep, sec.closing_price);
-        if (!sec.has_died && (sec.exchange == exchange)) {
-            book_.back().open();
+        if (live) {
+            symbol_book_.emplace(sec.symbol, &book_.back());
+            listings_.emplace(sec.symbol, listing_t{&book_.back(), ttPtr});
         }
     }
     courier_.inscribe(exchange_, this);
@@ -34,11 +53,69 @@ void an::MatchingEngine::close() {
         book.close();
     }
     (void) stats(); // Re-calculate before clearing
+    dirty_.clear();
+    origin_book_.clear();
+    symbol_book_.clear();
     book_.clear();
     stats_.symbols = book_.size();
     open_ = false;
 }
 
+void an::MatchingEngine::startAuction() {
+    for (auto& book : book_) {
+        if (book.isOpen()) {
+            book.startAuction();
+        }
+    }
+}
+
+// Pricing only reads its own book so it is split across threads. Fills send
+// through the courier and queue market data, so they stay on this thread.
+std::size_t an::MatchingEngine::uncross(unsigned threads) {
+    std::vector<Book*> books;
+    for (auto& book : book_) {
+        if (book.inAuction()) {
+            books.push_back(&book);
+        }
+    }
+    std::vector<auction_t> auctions(books.size());
+    auto price = [&books, &auctions](std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; ++i) {
+            auctions[i] = books[i]->equilibrium();
+        }
+    };
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(books.size() / 64 + 1)));
+    if (threads == 1) {
+        price(0, books.size());
+    } else {
+        const std::size_t chunk = (books.size() + threads - 1) / threads;
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back( [&, t] {
+                try {
+                    price(std::min(books.size(), t * chunk), std::min(books.size(), (t + 1) * chunk));
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            } );
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+        for (auto& e : errors) {
+            if (e) {
+                std::rethrow_exception(e);
+            }
+        }
+    }
+    std::size_t traded = 0;
+    for (std::size_t i = 0; i < books.size(); ++i) {
+        traded += (books[i]->uncross(auctions[i]) != 0);
+    }
+    return traded;
+}
+
 std::string an::MatchingEngine::to_string() const {
     std::ostringstream os;
     for (const auto& book: book_) {
@@ -54,14 +131,22 @@ void an::MatchingEngine::applyOrder(std::unique_ptr<Execution> exe) {
         sendResponse(exe.get(), an::REJECT, "wrong destination");
         ++rejects_;
     } else {
-        SideRecord rec;
-        exe->pack(rec);
-        rec.time = std::chrono::steady_clock::now();
-        rec.seq = seq_++;
-        rec.visible = true;
         const symbol_t& symbol = exe->symbol();
         Book* book = findBook(symbol);
         if (book != nullptr) {
+            SideRecord rec;
+            exe->pack(rec);
+            // Pre-trade risk, a breach never reaches the book
+            const char* breach = risk_.enabled() ?
+                risk_.check(*exe, rec.order_type, rec.shares, rec.price, book->referencePrice()) : nullptr;
+            if (breach != nullptr) {
+                sendResponse(exe.get(), an::REJECT, breach);
+                ++rejects_;
+                return;
+            }
+            rec.time = clock_.now();
+            rec.seq = nextSeq();
+            rec.visible = true;
             book->executeOrder(rec, std::move(exe));
         } else {
             sendResponse(exe.get(), an::REJECT, "symbol not found");
@@ -96,7 +181,24 @@ void an::MatchingEngine::applyOrder(std::unique_ptr<AmendOrder> o) {
         Book* book = findBook(symbol);
         if (book != nullptr) {
             order_id_t id = o->orderId();
-            book->amendActiveOrder(id,std::move(o));
+            // Risk against the order's own account, the book rejects the rest
+            Execution* exe = risk_.enabled() ? book->activeOrder(id) : nullptr;
+            if ((exe != nullptr) && (exe->origin() != o->origin())) {
+                exe = nullptr;
+            }
+            risk_account_t previous;
+            if (exe != nullptr) {
+                previous = exe->riskAccount();
+                const char* breach = risk_.checkAmend(*exe, o->amend(), book->referencePrice());
+                if (breach != nullptr) {
+                    sendResponse(o.get(), an::REJECT, breach);
+                    ++rejects_;
+                    return;
+                }
+            }
+            if (!book->amendActiveOrder(id,std::move(o)) && (exe != nullptr)) {
+                risk_.restore(*exe, previous);
+            }
         } else {
             sendResponse(o.get(), an::REJECT, "symbol not found");
             ++rejects_;
@@ -104,17 +206,60 @@ void an::MatchingEngine::applyOrder(std::unique_ptr<AmendOrder> o) {
     }
 }
 
-an::Book* an::MatchingEngine::findBook(const symbol_t& symbol) {
-    Book* bookPtr = nullptr;
-    auto symbol_idx = secdb_.find(symbol);
-    if (symbol_idx != SecurityDatabase::npos) { // FOUND
-        // std::cout << "lookuoBook=" << symbol << " idx=" << symbol_idx << std::endl;
-        bookPtr = &book_[symbol_idx];
+void an::MatchingEngine::applyOrder(std::unique_ptr<MassCancelOrder> o) {
+    if (o->destination() != exchange_) {
+        sendResponse(o.get(), an::REJECT, "wrong destination");
+        ++rejects_;
+    } else if (!o->symbol().empty() && (findBook(o->symbol()) == nullptr)) {
+        sendResponse(o.get(), an::REJECT, "symbol not found");
+        ++rejects_;
+    } else {
+        // Only ever the sender's own orders
+        std::size_t count = massCancel(mass_cancel_t{o->origin(), o->symbol(), o->allSides(), o->direction()});
+        std::ostringstream os;
+        os << "mass cancel " << count << " orders";
+        sendResponse(o.get(), an::COMPLETE, os.str());
     }
-    return bookPtr;
 }
 
-void an::MatchingEngine::sendTradeReport(Order* o, direction_t d, shares_t s, price_t p) {
+// Scoped by origin only the books holding its orders are visited, emptied
+// books are dropped from the origin's set as they are found
+std::size_t an::MatchingEngine::massCancel(const mass_cancel_t& scope) {
+    std::vector<std::unique_ptr<Execution>> cancelled;
+    if (!scope.symbol.empty()) {
+        Book* book = findBook(scope.symbol);
+        if (book != nullptr) {
+            (void) book->massCancel(scope, cancelled);
+        }
+    } else if (!scope.origin.empty()) {
+        auto found = origin_book_.find(scope.origin);
+        if (found != origin_book_.end()) {
+            auto& books = found->second;
+            for (auto it = books.begin(); it != books.end(); ) {
+                (void) (*it)->massCancel(scope, cancelled);
+                it = (*it)->hasOrigin(scope.origin) ? std::next(it) : books.erase(it);
+            }
+            if (books.empty()) {
+                origin_book_.erase(found);
+            }
+        }
+    } else {
+        for (auto& book : book_) {
+            (void) book.massCancel(scope, cancelled);
+        }
+    }
+    std::vector<Response> responses;
+    responses.reserve(cancelled.size());
+    for (auto& exe : cancelled) {
+        risk_.release(*exe);
+        responses.emplace_back(exe.get(), an::CANCELLED, "mass cancel");
+    }
+    courier_.send(responses); // Orders must outlive their responses
+    return cancelled.size();
+}
+
+void an::MatchingEngine::sendTradeReport(Execution* o, direction_t d, shares_t s, price_t p) {
+    risk_.fill(*o, s, p);
     TradeReport tradeRep1(o, d, s, p);
     courier_.send(tradeRep1);
 }
@@ -124,6 +269,161 @@ void an::MatchingEngine::sendResponse(Message* o, response_t r, text_t t) {
     courier_.send(rep);
 }
 
+std::size_t an::MatchingEngine::publish() {
+    (void) applyReload(); // Cycle boundary, delisting cancels go out below
+    std::size_t sent = 0;
+    market_data_t md;
+    std::vector<level_delta_t> deltas;
+    for (Book* book : dirty_) {
+        if (book->publish(md)) {
+            md.seq = md_seq_++;
+            md.origin = exchange_;
+            MarketData msg(exchange_, md);
+            courier_.send(msg);
+            ++sent;
+        }
+        deltas.clear();
+        if (book->publishDepth(deltas)) {
+            courier_.send(book->symbol(), deltas);
+        }
+    }
+    dirty_.clear();
+    clock_.release(); // End of the cycle
+    return sent;
+}
+
+const an::TickTable* an::MatchingEngine::internTable(const TickTable* table,
+                                                     std::unordered_map<const TickTable*, const TickTable*>& seen) {
+    if (table == nullptr) {
+        return nullptr;
+    }
+    auto found = seen.find(table);
+    if (found != seen.end()) {
+        return found->second;
+    }
+    auto held = std::find_if(tables_.begin(), tables_.end(),
+                             [table](const std::unique_ptr<const TickTable>& tt) { return *tt == *table; });
+    if (held == tables_.end()) {
+        tables_.push_back(std::make_unique<const TickTable>(*table));
+        held = tables_.end() - 1;
+    }
+    return seen.emplace(table, held->get()).first->second;
+}
+
+// The pass over the new version is here, on the caller's thread. Books are
+// never removed, a delisted symbol's book is closed (cancelling its orders)
+// and a relisting, or a ladder valid again, gets a fresh book.
+void an::MatchingEngine::reload(std::shared_ptr<const SecurityMaster> next) {
+    std::lock_guard<std::mutex> lock(reload_mutex_);
+    std::vector<std::unique_ptr<reload_t>> retired; // Freed on this thread rather than the engine's
+    {
+        std::lock_guard<std::mutex> queue(queue_mutex_);
+        retired.swap(retired_);
+        for (const auto& listed : listed_) {
+            auto found = listings_.find(listed.first);
+            if ((found != listings_.end()) && (found->second.book == nullptr)) {
+                found->second.book = listed.second;
+            }
+        }
+        listed_.clear();
+    }
+
+    const SecurityDatabase& secdb = next->secdb();
+    auto plan = std::make_unique<reload_t>();
+    plan->symbols.reserve(secdb.securities().size());
+    std::unordered_map<symbol_t, listing_t> listings;
+    listings.reserve(secdb.securities().size());
+    std::unordered_map<const TickTable*, const TickTable*> seen;
+    for (std::size_t i = 0; i < secdb.securities().size(); ++i) {
+        const auto& sec = secdb.securities()[i];
+        if (secdb.find(sec.symbol) != i) {
+            continue; // Died, other exchange or duplicate
+        }
+        const TickTable* table = internTable(secdb.tickTable(i), seen);
+        if (table == nullptr) {
+            AN_WARN("{} not opening, invalid tick_ladder_id {}", sec.symbol, sec.ladder_id);
+        }
+        listing_t listing{nullptr, table};
+        auto found = listings_.find(sec.symbol);
+        if ((found == listings_.end()) || ((found->second.table == nullptr) && (table != nullptr))) {
+            plan->changes.push_back(reload_change_t{RELOAD_LIST, sec.symbol, nullptr, table, sec.closing_price});
+        } else {
+            listing.book = found->second.book;
+            if (found->second.table != table) {
+                plan->changes.push_back(reload_change_t{RELOAD_TICKS, sec.symbol, listing.book, table, 0.0});
+            } else if (listing.book == nullptr) {
+                plan->changes.push_back(reload_change_t{RELOAD_CARRY, sec.symbol, nullptr, table, 0.0});
+            }
+        }
+        listings.emplace(sec.symbol, listing);
+        plan->symbols.emplace(sec.symbol, listing.book);
+    }
+    for (const auto& listing : listings_) {
+        if (listings.find(listing.first) == listings.end()) {
+            plan->changes.push_back(reload_change_t{RELOAD_DELIST, listing.first, listing.second.book, nullptr, 0.0});
+        }
+    }
+    listings_.swap(listings);
+    {
+        std::lock_guard<std::mutex> queue(queue_mutex_);
+        reloads_.push_back(std::move(plan));
+    }
+    reload_pending_.store(true, std::memory_order_release);
+}
+
+// Only the changed books are visited, the symbol map is swapped whole.
+bool an::MatchingEngine::applyReload() {
+    if (!reload_pending_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    reload_pending_.store(false, std::memory_order_relaxed);
+    std::vector<std::unique_ptr<reload_t>> reloads;
+    {
+        std::lock_guard<std::mutex> queue(queue_mutex_);
+        reloads.swap(reloads_);
+    }
+    if (reloads.empty() || !open_) {
+        return false;
+    }
+    std::vector<std::pair<symbol_t, Book*>> listed;
+    for (auto& plan : reloads) {
+        for (const reload_change_t& change : plan->changes) {
+            Book* book = (change.book != nullptr) ? change.book : findBook(change.symbol);
+            switch (change.action) {
+                case RELOAD_LIST:
+                    book_.emplace_back(this, change.symbol, epoch_, (change.table != nullptr) ? *change.table : noTicks,
+                                       bookkeep_, change.closing_price);
+                    book = &book_.back();
+                    if (change.table != nullptr) {
+                        book->open();
+                    }
+                    listed.emplace_back(change.symbol, book);
+                    break;
+                case RELOAD_TICKS:
+                    assert(book != nullptr && "applyReload ticks of an unknown book");
+                    if (change.table == nullptr) {
+                        book->close();
+                    }
+                    book->setTickTable((change.table != nullptr) ? *change.table : noTicks);
+                    break;
+                case RELOAD_DELIST:
+                    assert(book != nullptr && "applyReload delist of an unknown book");
+                    book->close();
+                    book->setTickTable(noTicks);
+                    continue; // Not in the next map
+                case RELOAD_CARRY:
+                    break;
+            }
+            plan->symbols[change.symbol] = book;
+        }
+        symbol_book_.swap(plan->symbols);
+    }
+    std::lock_guard<std::mutex> queue(queue_mutex_);
+    listed_.insert(listed_.end(), listed.begin(), listed.end());
+    std::move(reloads.begin(), reloads.end(), std::back_inserter(retired_));
+    return true;
+}
+
 an::engine_stats_t an::MatchingEngine::stats() {
     if (open_) {
         stats_ = engine_stats_t();
@@ -152,12 +452,52 @@ an::engine_stats_t an::MatchingEngine::stats() {
 }
 
 // ********************************* BOOK *****************************************
+void an::PriceLevels::snapshot(std::vector<price_level_t>& out, std::size_t depth) const {
+    out.clear();
+    out.reserve(levels_.size());
+    for (const auto& kv : levels_) {
+        out.push_back(kv.second);
+    }
+    depth = std::min(depth, out.size());
+    auto better = [this](const price_level_t& lhs, const price_level_t& rhs) {
+        return (direction_ == BUY) ? (lhs.price > rhs.price) : (lhs.price < rhs.price);
+    };
+    std::partial_sort(out.begin(), out.begin() + depth, out.end(), better);
+    out.resize(depth);
+}
+
+void an::PriceLevels::crossing(std::vector<price_level_t>& out, price_t limit) const {
+    out.clear();
+    for (const auto& kv : levels_) {
+        if ((direction_ == BUY) ? (kv.second.price >= limit) : (kv.second.price <= limit)) {
+            out.push_back(kv.second);
+        }
+    }
+}
+
+void an::PriceLevels::deltas(std::vector<level_delta_t>& out) {
+    for (const auto& kv : changed_) {
+        const price_level_t& before = kv.second;
+        auto it = levels_.find(kv.first);
+        if (it == levels_.end()) {
+            if (before.orders != 0) {
+                out.push_back(level_delta_t{LEVEL_DELETE, direction_, price_level_t{before.price, 0, 0}});
+            }
+        } else if (before.orders == 0) {
+            out.push_back(level_delta_t{LEVEL_ADD, direction_, it->second});
+        } else if ((before.shares != it->second.shares) || (before.orders != it->second.orders)) {
+            out.push_back(level_delta_t{LEVEL_MODIFY, direction_, it->second});
+        }
+    }
+    changed_.clear();
+}
+
 std::string an::Side::to_string(bool verbose, bool one_list) const {
     std::ostringstream os;
     if (verbose) {
-        Side::container_type data;
-        for (const auto &rec : q_) {
-            data.push_back(rec);
+        std::vector<SideRecord> data;
+        for (const auto& e : heap_) {
+            data.push_back(record(e.slot));
         }
         std::sort( data.begin(), data.end(), std::not2(Side::value_compare(one_list)) );
         for (const auto& rec: data) {
@@ -175,10 +515,11 @@ std::string an::Side::to_string(bool verbose, bool one_list) const {
             os << std::endl;
         }
     } else {
-        Q q(q_);
-        while (!q.empty()) {
-            os << q.top().to_string(epoch_) << std::endl;
-            q.pop();
+        std::vector<side_entry_t> entries(heap_);
+        std::sort(entries.begin(), entries.end(),
+                  [this](const side_entry_t& lhs, const side_entry_t& rhs) { return cmp_(rhs, lhs); });
+        for (const auto& e : entries) {
+            os << record(e.slot).to_string(epoch_) << std::endl;
         }
     }
 
@@ -186,71 +527,82 @@ std::string an::Side::to_string(bool verbose, bool one_list) const {
 }
 
 
+// Best first walk of the heap without changing it, a node is only visited
+// after its parent so the walk stops at the first order that does not cross
+an::shares_t an::Side::available(price_t price, shares_t wanted) const {
+    shares_t total = 0;
+    if (!crossedBy(price)) {
+        return total;
+    }
+    const std::int64_t ticks = sign_ * truncate3decimalplaces(price);
+    auto worse = [this](std::size_t lhs, std::size_t rhs) { return heap_[lhs].key < heap_[rhs].key; };
+    std::vector<std::size_t>& next = scan_; // Heap indexes, best on top
+    next.clear();
+    next.push_back(0);
+    while (!next.empty() && (total < wanted)) {
+        std::pop_heap(next.begin(), next.end(), worse);
+        const std::size_t i = next.back();
+        next.pop_back();
+        const std::uint32_t slot = heap_[i].slot;
+        if (ticks < sign_ * truncate3decimalplaces(cold_[slot].price)) {
+            break; // Everything left is worse
+        }
+        if (state_[slot].visible) {
+            total += state_[slot].shares + cold_[slot].reserve;
+        }
+        for (std::size_t child = 2*i + 1; (child <= 2*i + 2) && (child < heap_.size()); ++child) {
+            next.push_back(child);
+            std::push_heap(next.begin(), next.end(), worse);
+        }
+    }
+    return total;
+}
+
 bool an::Book::marketableSide(Side& side, SideRecord& newRec, Execution* newExe) {
     bool marketable = false; // Can the new order be satisfied without adding it to the book
-    // Is there something to compare against and our new order isn't complete
-    while (!side.empty() && (newRec.shares!=0)) {
+    // Our new order isn't complete and crosses the cached best price, the top
+    // is copied only to trade with it
+    while ((newRec.shares!=0) && side.crossedBy(newRec.price)) {
         marketable = false;
         SideRecord top = side.top();
         assert(top.visible && "top should be visible");
         assert(newRec.visible && "new record should be visible");
-        if ( ((newRec.direction==an::BUY)  && compare3decimalplaces(newRec.price,top.price) >= 0) ||
-             ((newRec.direction==an::SELL) && compare3decimalplaces(newRec.price,top.price) <= 0) ) {
-            shares_t shares = std::min(newRec.shares,top.shares);
-            price_t price = top.price;
-
-            // Find active order (from book)
-            Execution* exeOld = findActiveOrder(top.id);
-            assert(exeOld != nullptr && "marketable active order null");
-
-            sendTradeReport(exeOld, newRec.direction, shares, price);
-            sendTradeReport(newExe, top.direction, shares, price);
-            if (top.shares == shares) {
-                sendResponse(exeOld, an::COMPLETE, "Top Filled");
-                side.removeTop(); // Remove top
-                removeActiveOrder(top.id);
-            } else {
+        shares_t shares = std::min(newRec.shares,top.shares);
+        price_t price = top.price;
+
+        // Find active order (from book)
+        Execution* exeOld = findActiveOrder(top.id);
+        assert(exeOld != nullptr && "marketable active order null");
+
+        sendTradeReport(exeOld, newRec.direction, shares, price);
+        sendTradeReport(newExe, top.direction, shares, price);
+        recordTrade(shares, price);
+        settleTop(side, top, exeOld, shares, price);
+        if (newRec.shares == shares) {
+            sendResponse(newExe, an::COMPLETE, "New Filled");
+            if (newRec.on_book) {
+                price_t pr = newRec.price; // Save value
+                newRec.price = price;
+                side.addVolume(newRec);
+                newRec.price = pr; // restore
+            }
+            newRec.visible = false;
+            marketable = true; // New order satistfied 
+        } else {
+            if (newRec.on_book) {
                 // Add volume for shares traded
-                shares_t shr = top.shares; // Save value
-                price_t pr = top.price; // Save value
+                shares_t shr = newRec.shares; // Save value
+                price_t pr = newRec.price; // Save value
                 
-                top.shares = shares; 
-                top.price = price;
-                side.addVolume(top);
+                newRec.shares = shares; 
+                newRec.price = price;
+                side.addVolume(newRec);
 
-                top.shares = shr; // restore
-                top.price = pr; // restore
-                side.amendSharesTop(-shares); // top.shares -= shares
+                newRec.shares = shr; // restore
+                newRec.price = pr; // restore
             }
-            if (newRec.shares == shares) {
-                sendResponse(newExe, an::COMPLETE, "New Filled");
-                if (newRec.on_book) {
-                    price_t pr = newRec.price; // Save value
-                    newRec.price = price;
-                    side.addVolume(newRec);
-                    newRec.price = pr; // restore
-                }
-                newRec.visible = false;
-                marketable = true; // New order satistfied 
-            } else {
-                if (newRec.on_book) {
-                    // Add volume for shares traded
-                    shares_t shr = newRec.shares; // Save value
-                    price_t pr = newRec.price; // Save value
-                    
-                    newRec.shares = shares; 
-                    newRec.price = price;
-                    side.addVolume(newRec);
-
-                    newRec.shares = shr; // restore
-                    newRec.price = pr; // restore
-                }
-            }
-            newRec.shares -= shares; // Reduce number of shares needed by newRec
-        } else {
-            // Not marketable if order values not matching
-            break;
         }
+        newRec.shares -= shares; // Reduce number of shares needed by newRec
     }
     return marketable;
 }
@@ -262,6 +614,22 @@ void an::Book::cancelActiveOrder(order_id_t id, std::unique_ptr<CancelOrder> o)
         sendReject(o.get(), "book not open");
         return;
     }
+    auto stop = stop_index_.find(id);
+    if (stop != stop_index_.end()) {
+        // Pending stop, not on a side
+        stop_book_t& stops = (stop->second.direction == an::BUY) ? buy_stops_ : sell_stops_;
+        auto found = stops.find(stop->second.key);
+        assert(found != stops.end() && "cancelActiveOrder stop not found");
+        if (found->second.order->origin() == o->origin()) {
+            sendCancel(found->second.order.get(), "order cancel success");
+            unindexOrigin(o->origin(), id);
+            stops.erase(found);
+            stop_index_.erase(stop);
+        } else {
+            sendReject(o.get(), "origin mismatch");
+        }
+        return;
+    }
     SideRecord* recPtr = findSideRecord(id);
     if (recPtr != nullptr) {
         assert(recPtr->visible && "cancelActiveOrder must be visible");
@@ -276,6 +644,7 @@ void an::Book::cancelActiveOrder(order_id_t id, std::unique_ptr<CancelOrder> o)
             assert(recPtr->visible == false && "cancelActiveOrder non-visible");
             sendCancel(exe,"order cancel success");
             removeActiveOrder(id);
+            updateTop();
         } else {
             sendReject(o.get(), "origin mismatch");
         }
@@ -287,26 +656,88 @@ void an::Book::cancelActiveOrder(order_id_t id, std::unique_ptr<CancelOrder> o)
 
 
 
-void an::Book::amendActiveOrder(order_id_t id, std::unique_ptr<AmendOrder> o) {
+std::size_t an::Book::massCancel(const mass_cancel_t& scope, std::vector<std::unique_ptr<Execution>>& cancelled) {
+    const std::size_t before = cancelled.size();
+    if (!open_) {
+        return 0;
+    }
+    auto pull = [&](std::unordered_set<order_id_t>& ids) {
+        for (auto it = ids.begin(); it != ids.end(); ) {
+            const order_id_t id = *it;
+            auto stop = stop_index_.find(id);
+            if (stop != stop_index_.end()) {
+                if (!scope.all_sides && (stop->second.direction != scope.direction)) {
+                    ++it;
+                    continue;
+                }
+                stop_book_t& stops = (stop->second.direction == an::BUY) ? buy_stops_ : sell_stops_;
+                auto found = stops.find(stop->second.key);
+                assert(found != stops.end() && "massCancel stop not found");
+                cancelled.push_back(std::move(found->second.order));
+                stops.erase(found);
+                stop_index_.erase(stop);
+            } else {
+                auto active = active_order_.find(id);
+                assert(active != active_order_.end() && "massCancel active order not found");
+                if (!scope.all_sides && (active->second.direction != scope.direction)) {
+                    ++it;
+                    continue;
+                }
+                Side& side = (active->second.direction == an::BUY) ? buy_ : sell_;
+                SideRecord* recPtr = side.findRecord(id, active->second.slot);
+                assert(recPtr != nullptr && "massCancel record not on side");
+                side.remove(*recPtr);
+                cancelled.push_back(std::move(active->second.order));
+                active_order_.erase(active);
+            }
+            it = ids.erase(it);
+        }
+    };
+    if (scope.origin.empty()) {
+        for (auto it = origin_order_.begin(); it != origin_order_.end(); ) {
+            pull(it->second);
+            it = it->second.empty() ? origin_order_.erase(it) : std::next(it);
+        }
+    } else {
+        auto found = origin_order_.find(scope.origin);
+        if (found != origin_order_.end()) {
+            pull(found->second);
+            if (found->second.empty()) {
+                origin_order_.erase(found);
+            }
+        }
+    }
+    const std::size_t count = cancelled.size() - before;
+    if (bookkeep_) {
+        bookkeeper_.cancel(count);
+    }
+    updateTop();
+    return count;
+}
+
+
+bool an::Book::amendActiveOrder(order_id_t id, std::unique_ptr<AmendOrder> o) {
     if (!open_) {
         sendReject(o.get(), "book not open");
-        return;
+        return false;
     }
+    bool amended = false;
     SideRecord* recPtr = findSideRecord(id);
     if (recPtr != nullptr) {
         const auto& amend = o->amend();
         if (amend.field == PRICE) {
-            bool amended = false;
             bool tick = false;
             bool mismatch = false;
-            if (tick_table_.validatePrice(amend.price)) {
+            if (tick_table_->validatePrice(amend.price) && (amend.price < Side::MAX_PRICE)) {
                 SideRecord newRec(*recPtr);
                 bool awayFromTouch = ((newRec.direction==BUY)  && (amend.price <= newRec.price)) ||
                                      ((newRec.direction==SELL) && (amend.price >= newRec.price)) ;
                 // Away from touch, (TODO not better than touch ???)
+                // In the call phase nothing matches until uncross, so just re-add
+                const bool reAdd = awayFromTouch || auction_;
                 Execution* exe = nullptr;
                 std::unique_ptr<Execution> exeNew;
-                if (awayFromTouch) {
+                if (reAdd) {
                     exe = findActiveOrder(id);
                     assert(exe != nullptr && "amendActiveOrder by price order not found");
                 } else {
@@ -323,12 +754,19 @@ void an::Book::amendActiveOrder(order_id_t id, std::unique_ptr<AmendOrder> o) {
                         s->remove(*recPtr, true); recPtr = nullptr;
                         newRec.price = amend.price;
                         newRec.visible = true;
-                        if (awayFromTouch) {
+                        if (!reAdd) {
+                            // May trade the whole iceberg, add re-splits the rest
+                            newRec.shares += newRec.reserve;
+                            newRec.reserve = 0;
+                        }
+                        if (reAdd) {
                             s->add(newRec); // Just change order book price and re-add
+                            active_order_.find(id)->second.slot = newRec.slot;
                         } else {
                             // Towards touch, might be marketable
                             assert(exeNew != nullptr && "amendActiveOrder by price order (exeNew) not found");
-                            executeOrder(newRec,std::move(exeNew));
+                            matchOrder(newRec,std::move(exeNew));
+                            electStops();
                         }
                     }
                 } else {
@@ -339,6 +777,7 @@ void an::Book::amendActiveOrder(order_id_t id, std::unique_ptr<AmendOrder> o) {
             }
             if (amended) {
                 sendAmend(o.get());
+                updateTop();
             } else if (tick) {
                 sendReject(o.get(), "Invalid tick price" );
             } else if (mismatch) {
@@ -351,15 +790,21 @@ void an::Book::amendActiveOrder(order_id_t id, std::unique_ptr<AmendOrder> o) {
             Execution* exe = findActiveOrder(id);
             assert(exe != nullptr && "amendActiveOrder price order not found");
             if (exe->origin() == o->origin()) {
-                if (exe->amend(amend)) {
+                if ((amended = exe->amend(amend)) == true) {
                     shares_t shr = recPtr->shares;
                     recPtr->shares = amend.shares;
+                    if (recPtr->peak != 0) {
+                        // Iceberg, amend is of the total and keeps the peak
+                        recPtr->reserve = std::max<shares_t>(0, amend.shares - recPtr->peak);
+                        recPtr->shares = amend.shares - recPtr->reserve;
+                    }
                     Side* s = &sell_;
                     if (recPtr->direction == BUY) {
                         s = &buy_;
                     }
                     s->amendShares(*recPtr, shr);
                     sendAmend(o.get());
+                    updateTop();
                 } else {
                     sendReject(o.get(), "Invalid amend of execution order");
                 }
@@ -370,6 +815,7 @@ void an::Book::amendActiveOrder(order_id_t id, std::unique_ptr<AmendOrder> o) {
     } else {
         sendReject(o.get(), "unknown order");
     }
+    return amended;
 }
 
 
@@ -378,50 +824,273 @@ void an::Book::executeOrder(SideRecord& rec, std::unique_ptr<Execution> exe) {
         sendReject(exe.get(),"book not open");
         return;
     }
-    if ( (rec.order_type == LIMIT) && (!tick_table_.validatePrice(rec.price)) ) {
+    if ( (rec.order_type == LIMIT) && (!tick_table_->validatePrice(rec.price)) ) {
         sendReject(exe.get(), "invalid tick size (price)");
         return;
     }
-    if (findActiveOrder(rec.id) != nullptr) {
+    if ( (rec.order_type == LIMIT) && (rec.price >= Side::MAX_PRICE) ) {
+        sendReject(exe.get(), "price too large");
+        return;
+    }
+    if ((findActiveOrder(rec.id) != nullptr) || (stop_index_.count(rec.id) != 0)) {
         sendReject(exe.get(), "Order id already on book");
         return;
     }
+    last_seq_ = std::max(last_seq_, rec.seq);
+    const tif_t tif = exe->timeInForce();
+    const price_t stop = exe->stopPrice();
+    if (auction_) {
+        if ((rec.order_type != LIMIT) || (tif != DAY) || (stop != 0.0)) {
+            sendReject(exe.get(), "not accepted in call auction");
+        } else {
+            addSideRecord(rec); // Matched at uncross
+            addActiveOrder(rec.id, std::move(exe), rec.direction, rec.slot);
+        }
+        updateTop();
+        return;
+    }
+    if (stop != 0.0) {
+        if (!tick_table_->validatePrice(stop) || (stop >= Side::MAX_PRICE)) {
+            sendReject(exe.get(), "invalid stop price");
+        } else {
+            addStop(rec, std::move(exe));
+            electStops();
+        }
+        return;
+    }
+    matchOrder(rec, std::move(exe));
+    electStops();
+}
+
+void an::Book::matchOrder(SideRecord& rec, std::unique_ptr<Execution> exe) {
+    const tif_t tif = exe->timeInForce();
+    if (tif == FOK) {
+        // Decide before any trade report, nothing to undo
+        const Side& side = (rec.direction == an::BUY) ? sell_ : buy_;
+        if (side.available(rec.price, rec.shares) < rec.shares) {
+            sendCancel(exe.get(), "fill or kill not filled");
+            return;
+        }
+    }
     if (!marketable(rec, exe.get())) {
-        if (rec.order_type == LIMIT) {
+        if ((rec.order_type == LIMIT) && (tif == DAY)) {
             // Add to queue
             addSideRecord(rec);
-            addActiveOrder(rec.id, std::move(exe), rec.direction);
+            addActiveOrder(rec.id, std::move(exe), rec.direction, rec.slot);
         } else if (rec.order_type == MARKET) {
             sendCancel(exe.get(), "no bid/ask for market order");
+        } else if (rec.order_type == LIMIT) {
+            sendCancel(exe.get(), "immediate or cancel remainder");
         } else {
-            assert(false && "executeOrder unknown order_type");
+            assert(false && "matchOrder unknown order_type");
         }
     }
+    updateTop();
 }
 
 
+void an::Book::addStop(SideRecord& rec, std::unique_ptr<Execution> exe) {
+    const stop_key_t key(stopUnits(exe->stopPrice()), rec.seq);
+    stop_book_t& stops = (rec.direction == an::BUY) ? buy_stops_ : sell_stops_;
+    assert((stops.count(key) == 0) && "addStop sequence reused");
+    stop_index_.emplace(rec.id, stop_ref_t{rec.direction, key});
+    indexOrigin(exe->origin(), rec.id);
+    stops.emplace(key, stop_order_t{rec, std::move(exe)});
+    if (last_trade_.trades != 0) {
+        // Already at or through the stop, elected by the last trade
+        const std::int64_t last = stopUnits(last_trade_.price);
+        trade_high_ = std::max(trade_high_, last);
+        trade_low_ = std::min(trade_low_, last);
+    }
+}
+
+void an::Book::electStops() {
+    std::vector<stop_order_t> elected;
+    while (open_ && !auction_ && (trade_low_ <= trade_high_)) {
+        // Buy stops at or below the highest trade, sell stops at or above the lowest
+        auto buyEnd = buy_stops_.upper_bound(stop_key_t(trade_high_, std::numeric_limits<sequence_t>::max()));
+        auto sellBegin = sell_stops_.lower_bound(stop_key_t(trade_low_, 0));
+        trade_high_ = NO_TRADE_HIGH;
+        trade_low_ = NO_TRADE_LOW;
+        for (auto it = buy_stops_.begin(); it != buyEnd; ++it) {
+            stop_index_.erase(it->second.rec.id);
+            unindexOrigin(it->second.order->origin(), it->second.rec.id);
+            elected.push_back(std::move(it->second));
+        }
+        buy_stops_.erase(buy_stops_.begin(), buyEnd);
+        for (auto it = sellBegin; it != sell_stops_.end(); ++it) {
+            stop_index_.erase(it->second.rec.id);
+            unindexOrigin(it->second.order->origin(), it->second.rec.id);
+            elected.push_back(std::move(it->second));
+        }
+        sell_stops_.erase(sellBegin, sell_stops_.end());
+        if (elected.empty()) {
+            break;
+        }
+        std::sort(elected.begin(), elected.end(),
+                  [](const stop_order_t& lhs, const stop_order_t& rhs) { return lhs.rec.seq < rhs.rec.seq; });
+        // Trades here widen the range again for the next pass. Each stop joins
+        // the book now, behind everything that rested while it waited.
+        for (auto& stop : elected) {
+            stop.rec.seq = nextSeq();
+            matchOrder(stop.rec, std::move(stop.order));
+        }
+        elected.clear();
+    }
+}
+
+void an::Book::settleTop(Side& side, SideRecord& top, Execution* exe, shares_t shares, price_t price) {
+    if ((top.shares == shares) && (top.reserve == 0)) {
+        sendResponse(exe, an::COMPLETE, "Top Filled");
+        side.removeTop(); // Remove top
+        removeActiveOrder(top.id);
+    } else {
+        // Add volume for shares traded
+        shares_t shr = top.shares; // Save value
+        price_t pr = top.price; // Save value
+
+        top.shares = shares;
+        top.price = price;
+        side.addVolume(top);
+
+        top.shares = shr; // restore
+        top.price = pr; // restore
+        side.amendSharesTop(-shares); // top.shares -= shares
+        if (top.shares == shares) {
+            side.refreshTop(); // Iceberg peak gone, show the next
+        }
+    }
+}
+
 bool an::Book::marketable(SideRecord& newRec, Execution* newExe) {
     assert(newRec.visible && "Book::marketable new record should be visible");
     bool marketable = false;
-    if (newRec.direction==an::BUY) {
-        // Compare against sell
-        marketable = marketableSide(sell_, newRec, newExe);
-    } else {
-        marketable = marketableSide(buy_, newRec, newExe);
+    Side& side = (newRec.direction==an::BUY) ? sell_ : buy_; // Compare against the other side
+    // Most flow is passive, stop at one compare
+    if (side.crossedBy(newRec.price)) {
+        marketable = marketableSide(side, newRec, newExe);
     }
     //std::cout << "Book::marketable" << " id=" << newExe->orderId() << " marketable=" << marketable << std::endl;
     return marketable;
 }
 
+bool an::Book::publish(market_data_t& md) {
+    dirty_ = false;
+    top_t current = top();
+    if (current == published_) {
+        return false;
+    }
+    published_ = current;
+    md.symbol            = symbol_;
+    md.have_bid          = current.have_bid;
+    md.bid               = current.bid;
+    md.bid_size          = current.bid_size;
+    md.have_ask          = current.have_ask;
+    md.ask               = current.ask;
+    md.ask_size          = current.ask_size;
+    md.have_last_trade   = last_trade_.trades != 0;
+    md.last_trade_price  = last_trade_.price;
+    md.last_trade_shares = last_trade_.shares;
+    md.trade_time        = md.have_last_trade ? sinceToString(last_trade_.time) : "";
+    md.quote_time        = sinceToString(now());
+    md.volume            = last_trade_.volume;
+    return true;
+}
+
+// One pass up the prices where the book crosses, from the best ask to the
+// best bid. At each price demand is the bids at or above it and supply the
+// asks at or below it.
+an::auction_t an::Book::equilibrium() const {
+    auction_t best{false, 0.0, 0, 0};
+    if (buy_.empty() || sell_.empty() || (buy_.best().price < sell_.best().price)) {
+        return best;
+    }
+    std::vector<price_level_t> bids;
+    std::vector<price_level_t> asks;
+    buy_.levels().crossing(bids, sell_.best().price);
+    sell_.levels().crossing(asks, buy_.best().price);
+    auto units = [](price_t price) { return std::llround(price * 1e7); };
+    auto ascending = [&units](const price_level_t& lhs, const price_level_t& rhs) {
+        return units(lhs.price) < units(rhs.price);
+    };
+    std::sort(bids.begin(), bids.end(), ascending);
+    std::sort(asks.begin(), asks.end(), ascending);
+
+    const price_t reference = bookkeeper_.previousClose();
+    shares_t demand = 0;
+    for (const auto& lvl : bids) {
+        demand += lvl.shares;
+    }
+    shares_t supply = 0;
+    std::size_t b = 0;
+    std::size_t a = 0;
+    while (b < bids.size()) { // No demand after the last bid
+        const bool askNext = (a < asks.size()) && (units(asks[a].price) <= units(bids[b].price));
+        const price_t price = askNext ? asks[a].price : bids[b].price;
+        while ((a < asks.size()) && (units(asks[a].price) <= units(price))) {
+            supply += asks[a++].shares;
+        }
+        const shares_t volume = std::min(demand, supply);
+        const shares_t imbalance = demand - supply;
+        if ((volume > best.volume) ||
+            ((volume == best.volume) && (std::abs(imbalance) < std::abs(best.imbalance))) ||
+            ((volume == best.volume) && (std::abs(imbalance) == std::abs(best.imbalance)) &&
+             (std::abs(price - reference) < std::abs(best.price - reference)))) {
+            best = auction_t{volume > 0, price, volume, imbalance};
+        }
+        while ((b < bids.size()) && (units(bids[b].price) <= units(price))) {
+            demand -= bids[b++].shares;
+        }
+    }
+    return best;
+}
+
+an::shares_t an::Book::uncross(const auction_t& auction) {
+    auction_ = false;
+    shares_t traded = 0;
+    if (!open_ || !auction.crossed) {
+        updateTop();
+        return traded;
+    }
+    const price_t price = auction.price;
+    while (!buy_.empty() && !sell_.empty() &&
+           (compare3decimalplaces(buy_.best().price, price) >= 0) &&
+           (compare3decimalplaces(sell_.best().price, price) <= 0)) {
+        SideRecord bid = buy_.top();
+        SideRecord ask = sell_.top();
+        Execution* bidExe = findActiveOrder(bid.id);
+        Execution* askExe = findActiveOrder(ask.id);
+        assert((bidExe != nullptr) && (askExe != nullptr) && "uncross active order null");
+        const shares_t shares = std::min(bid.shares, ask.shares);
+        sendTradeReport(bidExe, an::SELL, shares, price);
+        sendTradeReport(askExe, an::BUY, shares, price);
+        recordTrade(shares, price);
+        settleTop(buy_, bid, bidExe, shares, price);
+        settleTop(sell_, ask, askExe, shares, price);
+        traded += shares;
+    }
+    updateTop();
+    electStops();
+    return traded;
+}
+
 void an::Book::closeBook() {
     open_ = false;
     for (auto it = active_order_.begin(); it != active_order_.end(); ) {
         sendCancel(it->second.order.get(), "closing down");
         it = active_order_.erase(it);
     }
+    for (stop_book_t* stops : { &buy_stops_, &sell_stops_ }) {
+        for (auto& stop : *stops) {
+            sendCancel(stop.second.order.get(), "closing down");
+        }
+        stops->clear();
+    }
+    stop_index_.clear();
+    origin_order_.clear();
     if (bookkeep_) {
         bookkeeper_.close();
-        std::cout << symbol_ << " " << bookkeeper_.to_string() << std::endl;
+        AN_INFO("{} {}", symbol_, bookkeeper_.to_string());
     }
     assert(active_order_.empty());
 }
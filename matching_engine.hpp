@@ -3,11 +3,18 @@
 
 #include "types.hpp"
 #include "order.hpp"
+#include "risk.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
 
 namespace an {
 
 class Book;
 class SecurityDatabase ;
+class SecurityMaster ;
+class TickTable ;
 class Courier ;
 
 struct epoch_t {
@@ -15,13 +22,35 @@ struct epoch_t {
     std::chrono::system_clock::time_point systemClockStartTime;
 };
 
+// Engine time. Within a cycle (e.g. an order batch) every event shares the time
+// read when it started, so orders and fills don't each pay for a clock read.
+// Outside a cycle it reads the steady clock. Order priority is by sequence
+// number so a shared time doesn't change matching.
+class EngineClock {
+    public:
+        EngineClock() : now_(), cached_(false) { }
+        void tick(since_t time) {
+            now_ = time;
+            cached_ = true;
+        }
+        void release() { cached_ = false; }
+        since_t now() const { return cached_ ? now_ : std::chrono::steady_clock::now(); }
+    private:
+        since_t now_;
+        bool    cached_;
+};
+
+// https://stackoverflow.com/questions/18361638/converting-steady-clocktime-point-to-time-t
+// https://stackoverflow.com/questions/35282308/convert-between-c11-clocks
+inline std::chrono::system_clock::time_point sinceToSystem(since_t time, const epoch_t& epoch) {
+    return epoch.systemClockStartTime +
+           std::chrono::duration_cast<std::chrono::system_clock::duration>(time - epoch.steadyClockStartTime);
+}
+
+// "HH:MM:SS.SSSSSSSSS", each thread keeps the formatter of its current second
 inline static std::string sinceToString(since_t time, const epoch_t& epoch) {
-    std::ostringstream os;
-    // https://stackoverflow.com/questions/18361638/converting-steady-clocktime-point-to-time-t
-    // https://stackoverflow.com/questions/35282308/convert-between-c11-clocks
-    std::chrono::system_clock::time_point myTime = epoch.systemClockStartTime + (time - epoch.steadyClockStartTime);
-    os << date::format("%T",myTime); // "HH:MM:SS.SSSS";
-    return os.str();
+    thread_local TimestampFormatter timestamp;
+    return timestamp.to_string(sinceToSystem(time, epoch));
 }
 
 struct side_stat_t {
@@ -50,6 +79,15 @@ struct engine_stats_t {
     side_stat_t     sell;
 };
 
+// Orders pulled by a mass cancel. Empty origin or symbol is every origin or
+// symbol, all_sides false limits it to direction.
+struct mass_cancel_t {
+    location_t      origin;
+    symbol_t        symbol;
+    bool            all_sides;
+    direction_t     direction;
+};
+
 // ************************** MATCHING ENGINE ******************************
 
 class MatchingEngine {
@@ -61,6 +99,13 @@ class MatchingEngine {
         void close();
         std::string to_string() const;
 
+        // Call auction on every open book, orders rest without matching
+        void startAuction();
+        // Uncross every book in auction at its equilibrium price and return to
+        // continuous trading. Prices are found on up to threads threads, fills
+        // are sent from the calling thread. Returns the number of books that traded.
+        std::size_t uncross(unsigned threads = 1);
+
         void applyOrder(std::unique_ptr<Execution> o);
         //void applyOrder(std::unique_ptr<LimitOrder> o) {
         //    std::unique_ptr<Execution> exe(o.release());
@@ -73,31 +118,116 @@ class MatchingEngine {
             
         void applyOrder(std::unique_ptr<CancelOrder> o);
         void applyOrder(std::unique_ptr<AmendOrder> o);
+        void applyOrder(std::unique_ptr<MassCancelOrder> o);
+
+        // Cancel every live order in scope, responses go to the Courier in one
+        // batch. Returns the number of orders cancelled.
+        std::size_t massCancel(const mass_cancel_t& scope);
+        // Book has live orders of origin, kept so a mass cancel only visits those books
+        void addOriginBook(const location_t& origin, Book* book) { origin_book_[origin].insert(book); }
 
-        void sendTradeReport(Order* o, direction_t d, shares_t s, price_t p);
+        void sendTradeReport(Execution* o, direction_t d, shares_t s, price_t p);
         void sendResponse(Message* o, response_t r, text_t t);
 
+        // Pre-trade limits, checked before an order reaches its book. Off until set.
+        void setDefaultRiskLimits(const risk_limits_t& limits) { risk_.setDefaultLimits(limits); }
+        void setRiskLimits(const location_t& origin, const risk_limits_t& limits) { risk_.setLimits(origin, limits); }
+        const client_risk_t* risk(const location_t& origin) const { return risk_.find(origin); }
+        // Any thread, resolved once per session and stamped on its orders (Order::setRiskSlot)
+        std::uint32_t riskSlot(const location_t& origin) { return risk_.slotFor(origin); }
+        // Order left its book unfilled (cancel or reject)
+        void releaseRisk(Execution* exe) { risk_.release(*exe); }
+
+        // Book top changed, published on the next publish()
+        void markDirty(Book* book) { dirty_.push_back(book); }
+        // Next order sequence, stops take one when elected
+        sequence_t nextSeq() { return seq_++; }
+        // Start of a cycle, the clock is read once for everything up to publish()
+        void tick(since_t time = std::chrono::steady_clock::now()) { clock_.tick(time); }
+        since_t now() const { return clock_.now(); }
+        // Send one MarketData per changed book, returns number sent. Called once
+        // per cycle (e.g. order batch) so bursts on a symbol are conflated.
+        std::size_t publish();
+
+        // Queue a new security master version, safe from any thread. The changes
+        // are worked out here, the engine applies them at the start of its next
+        // publish() cycle. next may be released once this returns.
+        void reload(std::shared_ptr<const SecurityMaster> next);
+        // Engine thread, apply queued reloads: list new symbols, close delisted
+        // ones, move changed books to their new tick tables and swap in the
+        // prebuilt symbol map. False if none pending.
+        bool applyReload();
+
         const epoch_t& epoch() const {
             return epoch_;
         }
         engine_stats_t stats() ;
     private:
         //void applyOrder(std::unique_ptr<Execution> o);
-        Book* findBook(const symbol_t& symbol);
+        Book* findBook(const symbol_t& symbol) {
+            auto found = symbol_book_.find(symbol);
+            return (found != symbol_book_.end()) ? found->second : nullptr;
+        }
+
+        // One security master change, worked out by reload()
+        enum reload_action_t { RELOAD_LIST, RELOAD_TICKS, RELOAD_DELIST, RELOAD_CARRY };
+        struct reload_change_t {
+            reload_action_t     action;
+            symbol_t            symbol;
+            Book*               book;  // Null if listed by a reload not yet applied, found by symbol
+            const TickTable*    table; // Null if the ladder is invalid
+            price_t             closing_price;
+        };
+        struct reload_t {
+            std::vector<reload_change_t>        changes;
+            std::unordered_map<symbol_t, Book*> symbols; // Next symbol_book_, listed books filled in when applied
+        };
+        struct listing_t {
+            Book*               book;
+            const TickTable*    table;
+        };
+        // Reload side, an equal table already held or a copy of this one. Books
+        // point at these so a version is not kept once reload() returns.
+        const TickTable* internTable(const TickTable* table, std::unordered_map<const TickTable*, const TickTable*>& seen);
 
         sequence_t            seq_;
+        sequence_t            md_seq_; // Market data
         epoch_t               epoch_;
+        EngineClock           clock_;
         location_t            exchange_;
-        SecurityDatabase&     secdb_;
         Courier&              courier_;
-        std::vector<Book>     book_;
+        bool                  bookkeep_;
+        std::deque<Book>      book_; // Stable addresses, books are only added
+        std::unordered_map<symbol_t, Book*> symbol_book_; // Live securities on this exchange
+        std::vector<Book*>    dirty_; // Books to publish
+        std::unordered_map<location_t, std::unordered_set<Book*>> origin_book_; // May include emptied books
         engine_stats_t        stats_;
+        PreTradeRisk          risk_;
         counter_t             rejects_; // Non book rejects
         bool                  open_;
+        // Reload side, serialised by reload_mutex_
+        std::mutex            reload_mutex_;
+        std::vector<std::unique_ptr<const TickTable>> tables_; // Interned, only added
+        std::unordered_map<symbol_t, listing_t> listings_; // As of the last queued reload
+        // Shared, held briefly by both sides
+        std::mutex            queue_mutex_;
+        std::vector<std::unique_ptr<reload_t>> reloads_; // Queued in order
+        std::vector<std::unique_ptr<reload_t>> retired_; // Applied, freed by the next reload() caller
+        std::vector<std::pair<symbol_t, Book*>> listed_; // Books applied reloads listed, for listings_
+        std::atomic<bool>     reload_pending_;
 };
 
 // ************************** BOOK ******************************
 
+// Call auction price, most shares executable then least imbalance then
+// nearest the previous close
+struct auction_t {
+    bool        crossed;
+    price_t     price;
+    shares_t    volume;     // Executable at price
+    shares_t    imbalance;  // Buy less sell shares at price
+};
+
 
 struct SideRecord {
     std::string to_string(const epoch_t& epoch) const {
@@ -115,10 +245,14 @@ struct SideRecord {
     shares_t    shares;
     bool        visible;
     bool        on_book;
+    std::uint32_t slot; // Where Side keeps it, set by Side::add
+    shares_t    reserve;    // Iceberg shares not yet shown
+    shares_t    peak;       // Iceberg display size, zero for a plain order
 };
 
 // In the priority queue SELL (ASK) should be ascending price/time, conversely
-// in BUY (BID) the price should descending price/ascedning time.
+// in BUY (BID) the price should descending price/ascedning time. Sequence is
+// assigned with the time so it stands in for time.
 // For convenience added price_desc_ as sometimes we want to show output in descending price.
 struct CompareSideRecord {
     CompareSideRecord(bool one_list=false) : one_list_(one_list) {}
@@ -133,11 +267,9 @@ struct CompareSideRecord {
         } else if (!one_list_ && (lhs.price != rhs.price)) {
             result = ((lhs.direction==an::BUY)  && lhs.price < rhs.price) ||
                      ((lhs.direction==an::SELL) && lhs.price > rhs.price) ;
-        } else if (one_list_ && (lhs.time != rhs.time)) {
-            result = ((lhs.direction==an::BUY)  && (lhs.time > rhs.time)) || // Ascending times
-                     ((lhs.direction==an::SELL) && (lhs.time < rhs.time)) ;  // Descending times
-        } else if (!one_list_ && (lhs.time != rhs.time)) {
-            result = lhs.time > rhs.time; // Ascending times
+        } else if (one_list_) {
+            result = ((lhs.direction==an::BUY)  && (lhs.seq > rhs.seq)) || // Ascending sequence
+                     ((lhs.direction==an::SELL) && (lhs.seq < rhs.seq)) ;  // Descending sequence
         } else {
             result = lhs.seq > rhs.seq; // Ascending sequence
         }
@@ -149,7 +281,51 @@ struct CompareSideRecord {
 
 static const SideRecord DefaultSideRecord =
    { .id=0, .seq=0, .time=since_t(), .order_type=an::LIMIT,
-     .direction=an::BUY, .price=0.0, .shares=0, .visible=false, .on_book=false };
+     .direction=an::BUY, .price=0.0, .shares=0, .visible=false, .on_book=false, .slot=0,
+     .reserve=0, .peak=0 };
+
+// Side keeps a SideRecord in three parts. The heap holds only the priority key
+// and a slot, so sifting touches four entries per cache line instead of one
+// SideRecord. Quantity and visibility are read at the top of the book, the
+// rest only when an order is reported.
+// The key orders a side with one unsigned compare, best on top of a max heap:
+//   bits 63..24  price in PRICE_EPSILON units, inverted on the SELL side
+//   bits 23..0   sequence rank, inverted so the earlier order is better
+struct side_entry_t {
+    std::uint64_t   key;
+    std::uint32_t   slot;
+};
+
+struct side_state_t {
+    shares_t        shares;
+    bool            visible;
+};
+
+struct side_cold_t {
+    order_id_t      id;
+    sequence_t      seq;
+    since_t         time;
+    price_t         price;
+    order_t         order_type;
+    std::uint32_t   rank; // Low bits of the key
+    shares_t        peak;
+    shares_t        reserve;
+};
+
+// Best level of a side, kept as the top changes so the book can test for a
+// cross without going to the heap. ticks is the price in thousandths, negated
+// on the BUY side so that one compare serves either side.
+struct side_best_t {
+    std::int64_t    ticks;
+    price_t         price;
+    shares_t        shares; // All orders at price
+};
+
+struct CompareSideEntry {
+    bool operator()(const side_entry_t& lhs, const side_entry_t& rhs) const {
+        return lhs.key < rhs.key;
+    }
+};
 
 
 struct bookkeeper_stats_t {
@@ -206,8 +382,8 @@ class Bookkeeper {
             bks_.last_trade_price = price;
             bks_.last_trade_time = since;
         }
-        void cancel() {
-            ++bks_.cancels;
+        void cancel(counter_t count = 1) {
+            bks_.cancels += count;
         }
         void amend() {
             ++bks_.amends;
@@ -257,6 +433,10 @@ class Bookkeeper {
             s->volume += (side.shares - oldShares) * side.price;
         }
 
+        price_t previousClose() const {
+            return previous_close_;
+        }
+
         void close() {
             bks_.close_price = bks_.last_trade_price;
             if (bks_.trades !=0) {
@@ -305,12 +485,89 @@ struct PriorityQueue : std::priority_queue<T,C,P> {
     typename C::const_iterator cend() const { return std::priority_queue<T, C, P>::c.cend(); }
 };
 
+// Aggregated depth for one side, price -> total shares and order count.
+// Updated per order event in O(1), levels are ordered only when a snapshot
+// is requested. Changes are conflated per level until deltas() is called.
+class PriceLevels {
+    public:
+        explicit PriceLevels(direction_t direction) : direction_(direction), levels_(), changed_() { }
+
+        void add(price_t price, shares_t shares) {
+            price_level_t& lvl = touch(price);
+            lvl.shares += shares;
+            ++lvl.orders;
+        }
+        void remove(price_t price, shares_t shares) {
+            auto it = levels_.find(key(price));
+            assert(it != levels_.end() && "PriceLevels::remove unknown level");
+            remember(it->first, &it->second);
+            it->second.shares -= shares;
+            if (--it->second.orders == 0) {
+                levels_.erase(it);
+            }
+        }
+        void amend(price_t price, shares_t diffShares) {
+            auto it = levels_.find(key(price));
+            assert(it != levels_.end() && "PriceLevels::amend unknown level");
+            remember(it->first, &it->second);
+            it->second.shares += diffShares;
+        }
+
+        // Null if no orders at price
+        const price_level_t* find(price_t price) const {
+            auto it = levels_.find(key(price));
+            return (it != levels_.end()) ? &it->second : nullptr;
+        }
+        std::size_t size() const { return levels_.size(); }
+        bool changed() const { return !changed_.empty(); }
+
+        // Best depth levels, best price first
+        void snapshot(std::vector<price_level_t>& out, std::size_t depth) const;
+        // Levels at limit or better, unordered
+        void crossing(std::vector<price_level_t>& out, price_t limit) const;
+        // Append one delta per level changed since the last call
+        void deltas(std::vector<level_delta_t>& out);
+    private:
+        typedef std::int64_t price_key_t;
+        static price_key_t key(price_t price) {
+            return std::llround(price * PRICE_SCALE);
+        }
+        price_level_t& touch(price_t price) {
+            price_key_t k = key(price);
+            auto it = levels_.find(k);
+            if (it == levels_.end()) {
+                remember(k, nullptr);
+                it = levels_.emplace(k, price_level_t{price, 0, 0}).first;
+            } else {
+                remember(k, &it->second);
+            }
+            return it->second;
+        }
+        // Keep the level as it was at the first change this cycle
+        void remember(price_key_t k, const price_level_t* lvl) {
+            changed_.emplace(k, (lvl != nullptr) ? *lvl : price_level_t{0.0, 0, 0});
+        }
+
+        static constexpr double PRICE_SCALE = 1e7; // MAX_PRICE_PRECISION
+        direction_t                                       direction_;
+        std::unordered_map<price_key_t, price_level_t>    levels_;
+        std::unordered_map<price_key_t, price_level_t>    changed_; // Level before change, orders zero if new
+};
+
 class Side {
     public:
+        static const int RANK_BITS = 24;
+        static const std::uint64_t MAX_RANK = (std::uint64_t(1) << RANK_BITS) - 1;
+        static const std::uint64_t MAX_PRICE_UNITS = (std::uint64_t(1) << (64 - RANK_BITS)) - 1;
+        // Largest price a key holds, about 109951 at MAX_PRICE_PRECISION
+        static constexpr price_t MAX_PRICE = MAX_PRICE_UNITS / 1e7;
+
         Side(Bookkeeper& bookkeeper, direction_t direction, const epoch_t& epoch) 
-            : bookkeeper_(bookkeeper), direction_(direction), epoch_(epoch) {}
-        Side(const Side& s) : q_(s.q_), bookkeeper_(s.bookkeeper_), 
-            direction_(s.direction_), epoch_(s.epoch_) {}
+            : bookkeeper_(bookkeeper), direction_(direction), epoch_(epoch), levels_(direction),
+              cmp_(), heap_(), state_(), cold_(), free_(), found_(DefaultSideRecord),
+              price_mask_(direction == an::SELL ? MAX_PRICE_UNITS : 0), seq_base_(0), rank_base_(0), last_seq_(0),
+              sign_(direction == an::SELL ? 1 : -1), best_(side_best_t{NO_BEST, 0.0, 0}), scan_() {}
+        Side(const Side& s) = default;
         ~Side() {}
 
         std::string to_string(bool verbose=false, bool one_list=false) const;
@@ -318,104 +575,280 @@ class Side {
         void add(SideRecord& rec) {
             assert(rec.visible && "Side.add record not visible");
             assert(rec.direction == direction_ && "Side.add wrong direction");
+            const std::uint32_t r = rank(rec); // Before allocate, may reuse rec's old slot
+            if ((rec.peak != 0) && (rec.shares > rec.peak)) {
+                rec.reserve += rec.shares - rec.peak; // Iceberg, show a peak
+                rec.shares = rec.peak;
+            }
             rec.on_book = true;
-            q_.push(rec);
+            rec.slot = allocate(rec, r);
+            heap_.push_back(side_entry_t{key(rec.price, r), rec.slot});
+            std::push_heap(heap_.begin(), heap_.end(), cmp_);
+            levels_.add(rec.price, rec.shares);
+            if (level(rec.price) == topLevel()) {
+                refreshBest();
+            }
             bookkeeper_.addSide(rec);
         }
         void addVolume(SideRecord& rec) {
             bookkeeper_.addSideVolume(rec);
         }
+        // rec from top() or findRecord()
         void remove(SideRecord& rec, bool removeVolume = false) {
             assert(rec.direction == direction_ && "Side.remove wrong direction");
+            assert(state_[rec.slot].visible && "Side.remove record not on side");
+            const bool atBest = (level(rec.price) == topLevel());
             rec.visible = false;
+            state_[rec.slot].visible = false;
+            levels_.remove(rec.price, rec.shares);
             normalise();
+            if (atBest) {
+                refreshBest();
+            }
             bookkeeper_.removeSide(rec, removeVolume);
         }
 
         void removeTop( bool removeVolume = false ) {
-            assert(!q_.empty() && "removeTop from empty queue");
-            assert(q_.begin()->id == top().id && "removeTop first vector element and top same"),
-            remove(*q_.begin(),removeVolume); // front()
+            assert(!heap_.empty() && "removeTop from empty queue");
+            SideRecord rec = top();
+            remove(rec, removeVolume);
         }
 
         void amendShares(SideRecord& rec, shares_t oldShares) {
             assert(rec.direction == direction_ && "Side.amend wrong direction");
+            state_[rec.slot].shares = rec.shares;
+            cold_[rec.slot].reserve = rec.reserve;
+            levels_.amend(rec.price, rec.shares - oldShares);
+            if (level(rec.price) == topLevel()) {
+                best_.shares += rec.shares - oldShares;
+            }
             bookkeeper_.amendSide(rec, oldShares);
         }
         void amendSharesTop(shares_t diffShares) {
-            assert(!q_.empty() && "amendSharesTop from empty queue");
-            SideRecord& rec = *q_.begin(); // front()
+            assert(!heap_.empty() && "amendSharesTop from empty queue");
+            SideRecord rec = top();
             shares_t oldShares = rec.shares;
             rec.shares += diffShares;
             amendShares(rec, oldShares);
         }
+        // Iceberg peak traded out, show the next peak from the reserve. The same
+        // slot is re-ranked behind its price, no cancel and new order.
+        void refreshTop() {
+            assert(!heap_.empty() && "refreshTop from empty queue");
+            const std::uint32_t slot = heap_.front().slot;
+            side_cold_t& cold = cold_[slot];
+            assert((cold.reserve != 0) && "Side.refreshTop no reserve");
+            const std::uint32_t r = nextRank(); // Renumbering keeps slot on top
+            SideRecord rec = record(slot);
+            const shares_t oldShares = rec.shares;
+            rec.shares += std::min(cold.peak, cold.reserve);
+            rec.reserve = cold.reserve -= rec.shares - oldShares;
+            state_[slot].shares = rec.shares;
+            cold.rank = r;
+            levels_.amend(rec.price, rec.shares - oldShares);
+            std::pop_heap(heap_.begin(), heap_.end(), cmp_);
+            assert((heap_.back().slot == slot) && "Side.refreshTop lost top");
+            heap_.back().key = key(cold.price, r);
+            std::push_heap(heap_.begin(), heap_.end(), cmp_);
+            refreshBest();
+            bookkeeper_.amendSide(rec, oldShares);
+        }
 
         bool empty() const {
-            return q_.empty();
+            return heap_.empty();
         }
 
         void pop() {
-            q_.pop();
+            const std::uint32_t slot = heap_.front().slot;
+            if (state_[slot].visible) {
+                levels_.remove(cold_[slot].price, state_[slot].shares);
+            }
+            popEntry();
             normalise();
+            refreshBest();
         }
 
-        SideRecord top() {
-            return q_.top();
+        // Would an order at price trade against this side, never when empty
+        bool crossedBy(price_t price) const {
+            return sign_ * truncate3decimalplaces(price) >= best_.ticks;
         }
+        const side_best_t& best() const {
+            return best_;
+        }
+        // Shares an order at price could take from this side, counting iceberg
+        // reserves, stops once wanted is reached
+        shares_t available(price_t price, shares_t wanted) const;
 
-        struct MatchOrderId { // Functor
-            explicit MatchOrderId(an::order_id_t order_id) : order_id_(order_id) { }
-            bool operator()(const an::SideRecord& rec) const { return rec.id == order_id_; }
-            an::order_id_t order_id_;
-        };
+        SideRecord top() const {
+            return record(heap_.front().slot);
+        }
+
+        // Valid until the next findRecord(), changes go back through amendShares() or remove()
+        SideRecord* findRecord(order_id_t id, std::uint32_t slot) {
+            if ((slot >= state_.size()) || !state_[slot].visible || (cold_[slot].id != id)) {
+                return nullptr;
+            }
+            found_ = record(slot);
+            return &found_;
+        }
+        // Linear, Book finds records by the slot it keeps per order
         SideRecord* findRecord(order_id_t id) {
-            SideRecord* found = nullptr;
-            auto it = std::find_if(q_.begin(), q_.end(), MatchOrderId(id));
-            if (it != q_.end()) {
-                found = &(*it);
+            for (std::uint32_t slot = 0; slot < state_.size(); ++slot) {
+                if (state_[slot].visible && (cold_[slot].id == id)) {
+                    return findRecord(id, slot);
+                }
             }
-            return found;
+            return nullptr;
+        }
+        const PriceLevels& levels() const {
+            return levels_;
         }
-        const auto& q() const {
-            return q_;
+        PriceLevels& levels() {
+            return levels_;
         }
-        using container_type = std::deque<SideRecord>;
         using value_compare = CompareSideRecord;
-        using Q = PriorityQueue<SideRecord, container_type, value_compare > ;
     private:
-        // Remove non-visible elements from top
-        void normalise() {
-            while (!q_.empty()) {
-                const SideRecord& top = q_.top();
-                if(!top.visible) {
-                    q_.pop();
+        SideRecord record(std::uint32_t slot) const {
+            const side_cold_t& cold = cold_[slot];
+            const side_state_t& state = state_[slot];
+            return SideRecord{ cold.id, cold.seq, cold.time, cold.order_type, direction_,
+                               cold.price, state.shares, state.visible, true, slot,
+                               cold.reserve, cold.peak };
+        }
+        // High bits of the key
+        std::uint64_t level(price_t price) const {
+            const std::uint64_t units = static_cast<std::uint64_t>(std::llround(price * 1e7));
+            assert(units <= MAX_PRICE_UNITS && "Side price too large for key");
+            return units ^ price_mask_;
+        }
+        std::uint64_t key(price_t price, std::uint64_t rank) const {
+            return (level(price) << RANK_BITS) | (MAX_RANK - rank);
+        }
+        std::uint64_t topLevel() const {
+            return heap_.empty() ? MAX_PRICE_UNITS + 1 : (heap_.front().key >> RANK_BITS);
+        }
+        void refreshBest() {
+            if (heap_.empty()) {
+                best_ = side_best_t{NO_BEST, 0.0, 0};
+                return;
+            }
+            const price_t price = cold_[heap_.front().slot].price;
+            best_ = side_best_t{sign_ * truncate3decimalplaces(price), price, levels_.find(price)->shares};
+        }
+        // Rank follows sequence, an amended order re-added with its seq keeps its rank
+        std::uint32_t rank(const SideRecord& rec) {
+            if (rec.on_book && (rec.slot < cold_.size()) && (cold_[rec.slot].id == rec.id) &&
+                (cold_[rec.slot].seq == rec.seq)) {
+                return cold_[rec.slot].rank;
+            }
+            if ((rec.seq < seq_base_) || (rank_base_ + (rec.seq - seq_base_) > MAX_RANK)) {
+                renumber(rec.seq);
+            }
+            last_seq_ = std::max(last_seq_, rec.seq);
+            return static_cast<std::uint32_t>(rank_base_ + (rec.seq - seq_base_));
+        }
+        // Behind every order so far, later sequences rank after it
+        std::uint32_t nextRank() {
+            const sequence_t seq = last_seq_ + 1;
+            if (rank_base_ + (seq - seq_base_) >= MAX_RANK) {
+                renumber(seq);
+            }
+            const std::uint64_t r = rank_base_ + (seq - seq_base_);
+            rank_base_ = r + 1;
+            seq_base_ = seq;
+            return static_cast<std::uint32_t>(r);
+        }
+        // Ranks ran out, live orders keep their order as 0..n-1 and seq starts after them
+        void renumber(sequence_t seq) {
+            std::vector<side_entry_t> live;
+            live.reserve(heap_.size());
+            for (const auto& e : heap_) {
+                if (state_[e.slot].visible) {
+                    live.push_back(e);
                 } else {
-                    break;
+                    free_.push_back(e.slot);
                 }
             }
+            assert(live.size() < MAX_RANK && "Side too deep to renumber");
+            std::sort(live.begin(), live.end(), [this](const side_entry_t& lhs, const side_entry_t& rhs) {
+                return cold_[lhs.slot].rank < cold_[rhs.slot].rank;
+            });
+            for (std::uint32_t i = 0; i < live.size(); ++i) {
+                side_cold_t& cold = cold_[live[i].slot];
+                cold.rank = i;
+                live[i].key = key(cold.price, i);
+            }
+            heap_.swap(live);
+            std::make_heap(heap_.begin(), heap_.end(), cmp_);
+            rank_base_ = heap_.size();
+            seq_base_ = seq;
+        }
+        std::uint32_t allocate(const SideRecord& rec, std::uint32_t rank) {
+            std::uint32_t slot;
+            if (free_.empty()) {
+                slot = static_cast<std::uint32_t>(state_.size());
+                state_.emplace_back();
+                cold_.emplace_back();
+            } else {
+                slot = free_.back();
+                free_.pop_back();
+            }
+            state_[slot] = side_state_t{rec.shares, true};
+            cold_[slot] = side_cold_t{rec.id, rec.seq, rec.time, rec.price, rec.order_type, rank,
+                                      rec.peak, rec.reserve};
+            return slot;
+        }
+        // Drop the top entry and free its slot
+        void popEntry() {
+            free_.push_back(heap_.front().slot);
+            std::pop_heap(heap_.begin(), heap_.end(), cmp_);
+            heap_.pop_back();
+        }
+        // Remove non-visible elements from top
+        void normalise() {
+            while (!heap_.empty() && !state_[heap_.front().slot].visible) {
+                popEntry();
+            }
         }
-        Q q_;
         Bookkeeper& bookkeeper_;
         direction_t direction_;
         const epoch_t& epoch_;
+        PriceLevels levels_;
+        CompareSideEntry                cmp_;
+        std::vector<side_entry_t>       heap_;   // Priority order
+        std::vector<side_state_t>       state_;  // By slot
+        std::vector<side_cold_t>        cold_;   // By slot
+        std::vector<std::uint32_t>      free_;   // Slots to reuse
+        SideRecord                      found_;
+        std::uint64_t                   price_mask_; // Inverts SELL prices
+        sequence_t                      seq_base_;   // seq_base_ has rank rank_base_
+        std::uint64_t                   rank_base_;
+        sequence_t                      last_seq_;   // Highest added
+        std::int64_t                    sign_;       // Of best_.ticks
+        side_best_t                     best_;
+        mutable std::vector<std::size_t> scan_;      // available() frontier, keeps its capacity
+        static const std::int64_t NO_BEST = std::numeric_limits<std::int64_t>::max();
 };
 
 
-class TickTable ;
-
 class Book {
     public:
-        explicit Book(MatchingEngine* me, symbol_t sym, epoch_t& epoch, TickTable& tt, bool bookkeep, price_t closing_price)
-            : me_(me), symbol_(sym), open_(false), active_order_(), epoch_(epoch), tick_table_(tt), 
+        explicit Book(MatchingEngine* me, symbol_t sym, epoch_t& epoch, const TickTable& tt, bool bookkeep, price_t closing_price)
+            : me_(me), symbol_(sym), open_(false), auction_(false), active_order_(), epoch_(epoch), tick_table_(&tt), 
               bookkeep_(bookkeep), bookkeeper_(
                 std::chrono::system_clock::to_time_t(date::floor<date::days>(std::chrono::system_clock::now())),
                 closing_price, epoch_), 
-              buy_(bookkeeper_, an::BUY, epoch_), sell_(bookkeeper_, an::SELL, epoch_) {
+              buy_(bookkeeper_, an::BUY, epoch_), sell_(bookkeeper_, an::SELL, epoch_),
+              dirty_(false), published_(), last_trade_(), buy_stops_(), sell_stops_(), stop_index_(),
+              trade_high_(NO_TRADE_HIGH), trade_low_(NO_TRADE_LOW), last_seq_(0), origin_order_() {
         }
 
         Book(const Book& book)
-            : me_(book.me_), symbol_(book.symbol_), epoch_(book.epoch_), tick_table_(book.tick_table_),
-              bookkeep_(book.bookkeep_), bookkeeper_(book.bookkeeper_), buy_(book.buy_), sell_(book.sell_) {
+            : me_(book.me_), symbol_(book.symbol_), open_(false), auction_(false), epoch_(book.epoch_), tick_table_(book.tick_table_),
+              bookkeep_(book.bookkeep_), bookkeeper_(book.bookkeeper_), buy_(book.buy_), sell_(book.sell_),
+              dirty_(book.dirty_), published_(book.published_), last_trade_(book.last_trade_),
+              buy_stops_(), sell_stops_(), stop_index_(), trade_high_(NO_TRADE_HIGH), trade_low_(NO_TRADE_LOW),
+              last_seq_(book.last_seq_), origin_order_() {
             assert(book.open_!=true && "Cannot copy open book");
         }
 
@@ -426,18 +859,32 @@ class Book {
 
         void open() { assert(!open_); open_ = true; }
         bool isOpen() const { return open_; }
+        // Call phase, orders are added without matching until uncross()
+        void startAuction() { assert(open_); auction_ = true; }
+        bool inAuction() const { return auction_; }
+        // Equilibrium of the resting orders, read only so books can be priced in parallel
+        auction_t equilibrium() const;
+        // Trade everything that crosses at the auction price, back to continuous
+        // trading. Returns shares traded.
+        shares_t uncross(const auction_t& auction);
+        shares_t uncross() { return uncross(equilibrium()); }
         void close() {
+            auction_ = false;
             if (open_) {
                 bookkeeper_.close();
                 closeBook(); open_ = false;
             }
             assert(active_order_.empty() && "active orders empty after closeBook()");
+            assert(stop_index_.empty() && "stops empty after closeBook()");
         }
         bool matchSymbol(const symbol_t& symbol) { return symbol == symbol_; }
+        // Ladder change on reload, the table must outlive the book
+        void setTickTable(const TickTable& tt) { tick_table_ = &tt; }
 
         // Live orders, used for lookups
-        void addActiveOrder(order_id_t id, std::unique_ptr<Execution> o, direction_t d) {
-            active_order_.emplace(id, std::move(open_order{id, std::move(o), d}));
+        void addActiveOrder(order_id_t id, std::unique_ptr<Execution> o, direction_t d, std::uint32_t slot) {
+            indexOrigin(o->origin(), id);
+            active_order_.emplace(id, std::move(open_order{id, std::move(o), d, slot}));
         }
 
         void addSideRecord(SideRecord& rec) {
@@ -455,22 +902,117 @@ class Book {
 
         void cancelActiveOrder(order_id_t id, std::unique_ptr<CancelOrder> o); 
 
-        void amendActiveOrder(order_id_t id, std::unique_ptr<AmendOrder> o); 
+        // Remove the live orders (resting and stops) in scope without responding,
+        // ownership moves to cancelled. The symbol in scope is not checked.
+        std::size_t massCancel(const mass_cancel_t& scope, std::vector<std::unique_ptr<Execution>>& cancelled);
+        bool hasOrigin(const location_t& origin) const { return origin_order_.count(origin) != 0; }
+
+        // True if amended, any reject has been sent
+        bool amendActiveOrder(order_id_t id, std::unique_ptr<AmendOrder> o);
+        // Resting order, null if none
+        Execution* activeOrder(order_id_t id) { return findActiveOrder(id); }
 
         void executeOrder(SideRecord& rec, std::unique_ptr<Execution> exe);
 
         const Bookkeeper& bookkeeper() const {
             return bookkeeper_;
         }
+
+        // Top of book, depth or last trade changed since last published
+        bool dirty() const { return dirty_; }
+        // Fill md with the current top of book and clear dirty, false if
+        // nothing changed since the last publish (e.g. top restored)
+        bool publish(market_data_t& md);
+        // Level changes since the last call, conflated per price
+        bool publishDepth(std::vector<level_delta_t>& deltas) {
+            buy_.levels().deltas(deltas);
+            sell_.levels().deltas(deltas);
+            return !deltas.empty();
+        }
+        // Best depth levels of each side
+        void depth(std::vector<price_level_t>& bids, std::vector<price_level_t>& asks, std::size_t depth) const {
+            buy_.levels().snapshot(bids, depth);
+            sell_.levels().snapshot(asks, depth);
+        }
+        const symbol_t& symbol() const { return symbol_; }
+        // Mid of the best bid and ask, else the last trade, else the previous close
+        price_t referencePrice() const {
+            if (!buy_.empty() && !sell_.empty()) {
+                return (buy_.best().price + sell_.best().price) / 2.0;
+            }
+            return (last_trade_.trades != 0) ? last_trade_.price : bookkeeper_.previousClose();
+        }
     private:
+        struct top_t {
+            top_t() : have_bid(false), bid(0.0), bid_size(0), have_ask(false), ask(0.0), ask_size(0), trades(0) { }
+            bool operator==(const top_t& rhs) const {
+                return (have_bid == rhs.have_bid) && (bid == rhs.bid) && (bid_size == rhs.bid_size) &&
+                       (have_ask == rhs.have_ask) && (ask == rhs.ask) && (ask_size == rhs.ask_size) &&
+                       (trades == rhs.trades);
+            }
+            bool        have_bid;
+            price_t     bid;
+            shares_t    bid_size;
+            bool        have_ask;
+            price_t     ask;
+            shares_t    ask_size;
+            counter_t   trades;
+        };
+        struct last_trade_t {
+            last_trade_t() : trades(0), price(0.0), shares(0), time(), volume(0.0) { }
+            counter_t   trades;
+            price_t     price;
+            shares_t    shares;
+            since_t     time;
+            volume_t    volume;
+        };
+
+        top_t top() {
+            top_t t;
+            if ((t.have_bid = !buy_.empty()) == true) {
+                t.bid = buy_.best().price;
+                t.bid_size = buy_.best().shares;
+            }
+            if ((t.have_ask = !sell_.empty()) == true) {
+                t.ask = sell_.best().price;
+                t.ask_size = sell_.best().shares;
+            }
+            t.trades = last_trade_.trades;
+            return t;
+        }
+        // After every order event, queue the book for publishing once per cycle
+        // if the top or any level changed
+        void updateTop() {
+            if (!dirty_ && (buy_.levels().changed() || sell_.levels().changed() || !(top() == published_))) {
+                dirty_ = true;
+                if (me_ != nullptr) {
+                    me_->markDirty(this);
+                }
+            }
+        }
+        void recordTrade(shares_t shares, price_t price) {
+            const std::int64_t units = stopUnits(price);
+            trade_high_ = std::max(trade_high_, units);
+            trade_low_ = std::min(trade_low_, units);
+            ++last_trade_.trades;
+            last_trade_.price = price;
+            last_trade_.shares = shares;
+            last_trade_.time = now();
+            last_trade_.volume += price * shares;
+        }
+
+        // Engine sequence, a book without an engine continues after the highest seen
+        sequence_t nextSeq() {
+            return (me_ != nullptr) ? me_->nextSeq() : ++last_seq_;
+        }
         void sendResponse(Message* o, response_t r, text_t t) {
             if (me_ != nullptr) {
                 me_->sendResponse(o, r, t);
             }
         }
-        void sendTradeReport(Order* o, direction_t d, shares_t s, price_t p) {
+        void sendTradeReport(Execution* o, direction_t d, shares_t s, price_t p) {
             if (bookkeep_) {
-                bookkeeper_.trade(d, s, p, std::chrono::steady_clock::now());
+                bookkeeper_.trade(d, s, p, now());
             }
             if (me_ != nullptr) {
                 me_->sendTradeReport(o,d,s,p);
@@ -480,6 +1022,9 @@ class Book {
             if (bookkeep_) {
                 bookkeeper_.cancel();
             }
+            if (me_ != nullptr) {
+                me_->releaseRisk(exe);
+            }
             sendResponse(exe, an::CANCELLED, text);
         }
         void sendAmend(Order* o) {
@@ -494,6 +1039,12 @@ class Book {
             }
             sendResponse(o, an::REJECT, text);
         }
+        void sendReject(Execution* exe, const text_t& text) {
+            if (me_ != nullptr) {
+                me_->releaseRisk(exe);
+            }
+            sendReject(static_cast<Order*>(exe), text);
+        }
 
         // Can the new order (execution) be satisfied without adding it to the book
         bool marketable(SideRecord& newRec, Execution* exe);
@@ -506,6 +1057,7 @@ class Book {
             if (search != active_order_.end()) {
                 found = search->second.order.get();
                 if (release) {
+                    unindexOrigin(found->origin(), id);
                     search->second.order.release();
                     (void) active_order_.erase(search);
                     //assert(count==1 && "findActiveOrder id not found");
@@ -514,8 +1066,29 @@ class Book {
             return found;
         }
         void removeActiveOrder(order_id_t id) {
-            auto count = active_order_.erase(id);
-            assert(count==1 && "removeActiveOrder id not found");
+            auto search = active_order_.find(id);
+            assert(search != active_order_.end() && "removeActiveOrder id not found");
+            unindexOrigin(search->second.order->origin(), id);
+            active_order_.erase(search);
+        }
+        // Live order ids by origin, the first order of an origin registers the book with the engine
+        void indexOrigin(const location_t& origin, order_id_t id) {
+            auto found = origin_order_.find(origin);
+            if (found == origin_order_.end()) {
+                found = origin_order_.emplace(origin, std::unordered_set<order_id_t>()).first;
+                if (me_ != nullptr) {
+                    me_->addOriginBook(origin, this);
+                }
+            }
+            found->second.insert(id);
+        }
+        void unindexOrigin(const location_t& origin, order_id_t id) {
+            auto found = origin_order_.find(origin);
+            assert(found != origin_order_.end() && "unindexOrigin origin not found");
+            found->second.erase(id);
+            if (found->second.empty()) {
+                origin_order_.erase(found);
+            }
         }
 
         SideRecord* findSideRecord(order_id_t id) {
@@ -523,13 +1096,16 @@ class Book {
             auto search = active_order_.find(id);
             if (search != active_order_.end()) {
                 if (search->second.direction == an::BUY) {
-                    found = buy_.findRecord(id);
+                    found = buy_.findRecord(id, search->second.slot);
                 } else {
-                    found = sell_.findRecord(id);
+                    found = sell_.findRecord(id, search->second.slot);
                 }
             }
             return found;
         }
+        since_t now() const {
+            return (me_ != nullptr) ? me_->now() : std::chrono::steady_clock::now();
+        }
         std::string sinceToString(since_t time) const {
             return an::sinceToString(time, epoch_);
         }
@@ -538,23 +1114,61 @@ class Book {
             order_id_t                  id;
             std::unique_ptr<Execution>  order;
             direction_t                 direction;
+            std::uint32_t               slot; // In its Side
         };
         //typedef std::vector<SideRecord> Side;
         typedef std::unordered_map<order_id_t, open_order> active_order_t;
         //typedef PriorityQueue<SideRecord, std::deque<SideRecord>, CompareSideRecord > Side;
 
+        // Stops waiting for a trade at or through their stop price, keyed by stop
+        // price then sequence. Buy stops are elected from the front, sell stops
+        // from the back, so each trade finds them in O(log n + k).
+        typedef std::pair<std::int64_t, sequence_t> stop_key_t;
+        struct stop_order_t {
+            SideRecord                  rec;
+            std::unique_ptr<Execution>  order;
+        };
+        struct stop_ref_t {
+            direction_t                 direction;
+            stop_key_t                  key;
+        };
+        typedef std::map<stop_key_t, stop_order_t> stop_book_t;
+        static constexpr std::int64_t NO_TRADE_HIGH = std::numeric_limits<std::int64_t>::min();
+        static constexpr std::int64_t NO_TRADE_LOW = std::numeric_limits<std::int64_t>::max();
+        static std::int64_t stopUnits(price_t price) { return std::llround(price * 1e7); }
+
+        // Hold a stop until a trade reaches its stop price
+        void addStop(SideRecord& rec, std::unique_ptr<Execution> exe);
+        // Execute every stop reached by the trades since the last call, in
+        // sequence order, until no more are elected
+        void electStops();
+        // Match a validated order and rest, or cancel, what is left
+        void matchOrder(SideRecord& rec, std::unique_ptr<Execution> exe);
         bool marketableSide(Side& side, SideRecord& newRec, Execution* newExe);
+        // Resting top, already reported, traded shares at price
+        void settleTop(Side& side, SideRecord& top, Execution* exe, shares_t shares, price_t price);
 
         MatchingEngine* me_;
         symbol_t        symbol_;
         bool            open_;
+        bool            auction_;
         active_order_t  active_order_;
         epoch_t&        epoch_;
-        TickTable&      tick_table_;
+        const TickTable* tick_table_;
         bool            bookkeep_;
         Bookkeeper      bookkeeper_;
         Side            buy_;
         Side            sell_;
+        bool            dirty_;
+        top_t           published_;
+        last_trade_t    last_trade_;
+        stop_book_t     buy_stops_;
+        stop_book_t     sell_stops_;
+        std::unordered_map<order_id_t, stop_ref_t> stop_index_; // Pending stops by order id
+        std::int64_t    trade_high_; // Trade price range since stops were last elected
+        std::int64_t    trade_low_;
+        sequence_t      last_seq_;   // Highest order sequence seen, books without an engine continue from it
+        std::unordered_map<location_t, std::unordered_set<order_id_t>> origin_order_;
 }; // Book
 
 
@@ -4,6 +4,7 @@
 #include <sstream>
 #include <algorithm>
 #include <bitset>
+#include <cstring>
 #include <boost/algorithm/string.hpp>
 #include <boost/operators.hpp>
 #include <boost/functional/hash.hpp>
@@ -11,36 +12,56 @@
 const char DELIMITOR = ':';
 const char SEPERATOR = '=';
 
+namespace {
+    // Formats into a stack buffer, only a message longer than it is formatted twice
+    template <typename Write>
+    std::string formatString(Write write) {
+        char buf[an::MAX_MESSAGE_SIZE];
+        an::Formatter f(buf, sizeof(buf));
+        write(f);
+        if (!f.overflow()) {
+            return std::string(buf, f.size());
+        }
+        std::string s(f.size(), '\0');
+        an::Formatter all(&s[0], s.size());
+        write(all);
+        return s;
+    }
+}
+
 
 an::Message::Message(location_t origin, location_t dest)   
     : origin_(origin), destination_(dest), reverse_direction_(false) {
 }
 
 std::string an::Message::to_string() const {
-    std::ostringstream os;
-    os << "origin" << SEPERATOR << (reverse_direction_ ? destination_ : origin_ )  << DELIMITOR
-       << "destination" << SEPERATOR << (reverse_direction_ ? origin_ : destination_ ) ;
-    return os.str();
+    return formatString( [this](Formatter& f) { Message::format(f); } );
+}
+void an::Message::format(Formatter& f) const {
+    f << "origin" << SEPERATOR << (reverse_direction_ ? destination_ : origin_ )  << DELIMITOR
+      << "destination" << SEPERATOR << (reverse_direction_ ? origin_ : destination_ ) ;
 }
 an::Message::~Message() { }
 
 
 
 std::string an::Login::to_string() const {
-    std::stringstream os;
-    os << "type" << SEPERATOR << "LOGIN" << DELIMITOR
-       << Message::to_string();
-    return os.str();
+    return formatString( [this](Formatter& f) { format(f); } );
+}
+void an::Login::format(Formatter& f) const {
+    f << "type" << SEPERATOR << "LOGIN" << DELIMITOR;
+    Message::format(f);
 }
 
 an::Login::~Login() { }
 
 std::string an::Order::to_string() const {
-    std::stringstream ss;
-    ss << "id" << SEPERATOR << order_id_ << DELIMITOR
-       << Message::to_string() << DELIMITOR
-       << "symbol" << SEPERATOR << symbol_ ;
-    return ss.str();
+    return formatString( [this](Formatter& f) { Order::format(f); } );
+}
+void an::Order::format(Formatter& f) const {
+    f << "id" << SEPERATOR << order_id_ << DELIMITOR;
+    Message::format(f);
+    f << DELIMITOR << "symbol" << SEPERATOR << symbol_ ;
 }
 
 an::Order::~Order() { }
@@ -80,10 +101,11 @@ struct SplitResult {
     PString value;
 };
 
-StrIter mySplit2(SplitResult& res, StrIter myBegin, StrIter myEnd) {
-    assert(sizeof(std::size_t) == sizeof(StrIter::difference_type) && "size_t and difference_type are the same size");
-    StrIter myDelim=std::find(myBegin, myEnd, DELIMITOR); // one=a or one=a:two=b myDelim [end] or one=a[:]
-    StrIter myEq=std::find(myBegin, myDelim, SEPERATOR); // myEq= one[=]
+using CharIter = const char*;
+
+CharIter mySplit2(SplitResult& res, CharIter myBegin, CharIter myEnd) {
+    CharIter myDelim=std::find(myBegin, myEnd, DELIMITOR); // one=a or one=a:two=b myDelim [end] or one=a[:]
+    CharIter myEq=std::find(myBegin, myDelim, SEPERATOR); // myEq= one[=]
     if (myEq==myDelim) { // Not found, end
          std::string token(myBegin, myDelim);
          std::ostringstream os;
@@ -97,7 +119,7 @@ StrIter mySplit2(SplitResult& res, StrIter myBegin, StrIter myEnd) {
          os << "Bad tag too long (>" << MAX_TAG_SIZE << ") [" << token << "]";
          throw an::OrderError(os.str());
     }
-    res.tag.assign(&*myBegin,len);  // one
+    res.tag.assign(myBegin,len);  // one
     len = std::distance(++myEq,myDelim);
     if (len > MAX_VALUE_SIZE) {
          std::string token(myEq, myDelim);
@@ -105,7 +127,7 @@ StrIter mySplit2(SplitResult& res, StrIter myBegin, StrIter myEnd) {
          os << "Bad value too long (>" << MAX_VALUE_SIZE << ") [" << token << "]";
          throw an::OrderError(os.str());
     }
-    res.value.assign(&*myEq,len); // a
+    res.value.assign(myEq,len); // a
     if (myDelim != myEnd) { //one=a[:]
         ++myDelim; // [t]wo=b
     }
@@ -116,7 +138,7 @@ StrIter mySplit2(SplitResult& res, StrIter myBegin, StrIter myEnd) {
 enum class Tag : std::size_t { 
     None, Type, Id, Origin, Destination, Symbol,
     // Order
-    Direction, Shares, Price,
+    Direction, Shares, Price, Display, Tif, Stop,
     // MarketData
 // type=MARKETDATA:origin=ME:destination=:symbol=MSFT:bid=100.0:bid_size=100:ask=101.0:ask_size=10:last_trade_price=100.1:last_trade_shares=50:trade_time=2018-01-01 12:00:00.00000:quote_time=2018-01-01 12:01:00.00000:volume=5005.0
     Bid, BidSize, Ask, AskSize, 
@@ -130,7 +152,7 @@ const std::string& to_string(Tag t) {
     static const std::vector<std::string> TAG_NAME {
         "None", "Type", "Id/Seq", "Origin", "Destination", "Symbol",
         // Order
-        "Direction", "Shares", "Price",
+        "Direction", "Shares", "Price", "Display", "Tif", "Stop",
         // MarketData
         "Bid", "BidSize", "Ask", "AskSize",
         "LastTradePrice", "LastTradeShares", "TradeTime",
@@ -160,7 +182,7 @@ void checkFlags(TagFlags expected, TagFlags got) {
     }
 }
 
-enum class convert_t { INTEGER, UINTEGER, POSITIVE_INTEGER, NATURAL_UINTEGER, NATURAL_INTEGER, STRING, PSTRING, FLOAT, DIRECTION }; 
+enum class convert_t { INTEGER, UINTEGER, POSITIVE_INTEGER, NATURAL_UINTEGER, NATURAL_INTEGER, STRING, PSTRING, FLOAT, DIRECTION, TIF }; 
 typedef bool indicator_t;
 
 class Reader {
@@ -189,6 +211,10 @@ class Reader {
                convert_t convert = convert_t::DIRECTION, bool select = false ) 
             : description_(description), field_(field), direction(res), 
               indicator_(resIndicator), convert_(convert) { }
+        Reader(PString description, Tag field, an::tif_t* res, bool* resIndicator = nullptr,
+               convert_t convert = convert_t::TIF, bool select = false ) 
+            : description_(description), field_(field), tif(res), 
+              indicator_(resIndicator), convert_(convert) { }
         ~Reader() {
             integer = nullptr; 
             indicator_ = nullptr;
@@ -203,6 +229,7 @@ class Reader {
             bool ok = false;
             char* stop = nullptr;
             an::direction_t myDirection = an::BUY;
+            an::tif_t myTif = an::DAY;
             switch (convert_) {
                 case convert_t::UINTEGER:
                 case convert_t::NATURAL_UINTEGER:
@@ -243,7 +270,11 @@ class Reader {
                     break;
                 case convert_t::FLOAT:
                     {
-                        double myFloat = std::strtod(value.to_string().c_str(), &stop); // TODO
+                        // Values are bounded by MAX_VALUE_SIZE so copy to the stack to terminate
+                        char buf[MAX_VALUE_SIZE+1];
+                        std::memcpy(buf, value.str_, value.length_);
+                        buf[value.length_] = '\0';
+                        double myFloat = std::strtod(buf, &stop);
                         if (*stop != '\0') {
                             break; // Error
                         }
@@ -260,6 +291,18 @@ class Reader {
                     }
                     *direction = myDirection; ok = true;
                     break;
+                case convert_t::TIF:
+                    if (value == PString("DAY")) {
+                        myTif = an::DAY;
+                    } else if (value == PString("IOC")) {
+                        myTif = an::IOC;
+                    } else if (value == PString("FOK")) {
+                        myTif = an::FOK;
+                    } else {
+                        break; // Error
+                    }
+                    *tif = myTif; ok = true;
+                    break;
                 default:
                     assert(false && "to invalid conversion");
             }
@@ -282,6 +325,7 @@ class Reader {
             std::string*        str;
             double*             number;
             an::direction_t*    direction;
+            an::tif_t*          tif;
         };
         indicator_t*     indicator_;          // Was result set, if nullptr don't apply
         convert_t        convert_;            // Conversion
@@ -313,13 +357,16 @@ class an::Result {
 class an::OrderResult : public an::Result {
     public:
         OrderResult() : myId(0), myOrigin(), myDestination(), mySymbol(),
-                        myDirection(an::BUY), myPrice(0.0), myShares(0) { }
+                        myDirection(an::BUY), myPrice(0.0), myShares(0), myDisplay(0), myTif(an::DAY), myStop(0.0) { }
 
         virtual an::Message* dispatch(an::Author& a) const {
             return createOrder(a,*this);
         }
         virtual void reset() {
             Result::reset();
+            myDisplay = 0;
+            myTif = an::DAY;
+            myStop = 0.0;
         }
     public:
         order_id_t       myId;
@@ -329,6 +376,9 @@ class an::OrderResult : public an::Result {
         direction_t      myDirection;
         price_t          myPrice;
         shares_t         myShares;
+        shares_t         myDisplay;
+        tif_t            myTif;
+        price_t          myStop;
 };
 
 class an::MarketDataResult : public an::Result {
@@ -419,14 +469,25 @@ struct Creator {
     an::Order* operator()(const an::OrderResult& res) const {
         an::Order* myOrder = nullptr;
         if (res.myType == PString("LIMIT")) {
-            an::LimitOrder*  o = new an::LimitOrder(res.myId, res.myOrigin, res.myDestination, res.mySymbol, res.myDirection, res.myShares, res.myPrice);
+            an::LimitOrder*  o = new an::LimitOrder(res.myId, res.myOrigin, res.myDestination, res.mySymbol, res.myDirection, res.myShares, res.myPrice, res.myDisplay);
+            o->setTimeInForce(res.myTif);
+            o->setStopPrice(res.myStop);
             myOrder = o;
         } else if (res.myType == PString("MARKET")) {
             an::MarketOrder* o = new an::MarketOrder(res.myId, res.myOrigin, res.myDestination, res.mySymbol, res.myDirection, res.myShares);
+            o->setTimeInForce(res.myTif);
+            o->setStopPrice(res.myStop);
             myOrder = o;
         } else if (res.myType == PString("CANCEL")) {
             an::CancelOrder* o = new an::CancelOrder(res.myId, res.myOrigin, res.myDestination, res.mySymbol);
             myOrder = o;
+        } else if (res.myType == PString("MASSCANCEL")) {
+            an::MassCancelOrder* o = new an::MassCancelOrder(res.myId, res.myOrigin, res.myDestination,
+                                                             res.myFlags[an::ord(Tag::Symbol)] ? res.mySymbol : an::symbol_t());
+            if (res.myFlags[an::ord(Tag::Direction)]) {
+                o->setDirection(res.myDirection);
+            }
+            myOrder = o;
         } else if (res.myType == PString("AMEND")) {
             an::AmendOrder*  o = nullptr;
             if (res.myFlags[an::ord(Tag::Price)]) {
@@ -497,6 +558,10 @@ struct an::AuthorImpl {
            ,{ PString("price"),        Reader(PString("price"),       Tag::Price,       &orderRes_.myPrice) }
            ,{ PString("shares"),       Reader(PString("shares"),      Tag::Shares,      &orderRes_.myShares,
                                                       nullptr,        convert_t::NATURAL_INTEGER ) }
+           ,{ PString("display"),      Reader(PString("display"),     Tag::Display,     &orderRes_.myDisplay,
+                                                      nullptr,        convert_t::NATURAL_INTEGER ) }
+           ,{ PString("tif"),          Reader(PString("tif"),         Tag::Tif,         &orderRes_.myTif) }
+           ,{ PString("stop"),         Reader(PString("stop"),        Tag::Stop,        &orderRes_.myStop) }
         }, orderType_{
             { PString("LIMIT"),
               TagHandler{ 
@@ -504,14 +569,15 @@ struct an::AuthorImpl {
                 .flags    = TagFlags( STD_FLAGS | TagFlags((1 << ord(Tag::Symbol)) | (1 << ord(Tag::Direction)) 
                                                 | (1 << ord(Tag::Shares)) | (1 << ord(Tag::Price))) ),
                 .select   = TagFlags(0),
-                .optional = {} } 
+                .optional = { TagFlags(1 << ord(Tag::Display)), TagFlags(1 << ord(Tag::Tif)),
+                              TagFlags(1 << ord(Tag::Stop)) } } 
             },
             { PString("MARKET"),
               TagHandler{ 
                 .create   = Creator(PString("MARKET")),
                 .flags    = TagFlags( STD_FLAGS | TagFlags((1 << ord(Tag::Symbol)) | (1 << ord(Tag::Direction)) | (1 << ord(Tag::Shares)) ) ),
                 .select   = TagFlags(0),
-                .optional = {} } 
+                .optional = { TagFlags(1 << ord(Tag::Tif)), TagFlags(1 << ord(Tag::Stop)) } } 
             },
             { PString("CANCEL"),
               TagHandler{ 
@@ -520,6 +586,13 @@ struct an::AuthorImpl {
                 .select   = TagFlags(0),
                 .optional = {} } 
             },
+            { PString("MASSCANCEL"),
+              TagHandler{ 
+                .create   = Creator(PString("MASSCANCEL")),
+                .flags    = TagFlags( STD_FLAGS ),
+                .select   = TagFlags(0),
+                .optional = { TagFlags(1 << ord(Tag::Symbol)), TagFlags(1 << ord(Tag::Direction)) } } 
+            },
             { PString("AMEND"),
               TagHandler{ 
                 .create   = Creator(PString("AMEND")),
@@ -596,7 +669,7 @@ struct an::AuthorImpl {
             }
         }, loginRes_() { 
     }
-    void parse(Result& res, const std::string& input, const std::unordered_map<PString,Reader>& inputFields);
+    void parse(Result& res, PString input, const std::unordered_map<PString,Reader>& inputFields);
 
     // Messages
     std::unordered_map<PString,Reader> orderFields_;
@@ -620,9 +693,9 @@ an::Author::~Author() {
 
 
 
-void an::AuthorImpl::parse(an::Result& inRes, const std::string& input, const std::unordered_map<PString,Reader>& inputFields) {
-    StrIter myEnd = input.cend();
-    StrIter myBegin = input.cbegin();
+void an::AuthorImpl::parse(an::Result& inRes, PString input, const std::unordered_map<PString,Reader>& inputFields) {
+    CharIter myBegin = input.str_;
+    CharIter myEnd = input.str_ + input.length_;
     SplitResult split;
     TagFlags myPrevFlags;
 
@@ -742,29 +815,37 @@ an::MarketData* an::Author::createMarketData(const an::MarketDataResult& res) co
 }
 
 
-an::Order* an::Author::makeOrder(const std::string& input) {
+an::Order* an::Author::makeOrder(PString input) {
     impl_->orderRes_.reset();
     impl_->parse(impl_->orderRes_, input, impl_->orderFields_); 
     return createOrder(impl_->orderRes_);
 }
 
-an::Login* an::Author::makeLogin(const std::string& input) {
+an::Order* an::Author::makeOrder(const std::string& input) {
+    return makeOrder(PString(input));
+}
+
+an::Login* an::Author::makeLogin(PString input) {
     impl_->loginRes_.reset();
     impl_->parse(impl_->loginRes_, input, impl_->loginFields_); 
     return createLogin(impl_->loginRes_);
 }
 
+an::Login* an::Author::makeLogin(const std::string& input) {
+    return makeLogin(PString(input));
+}
+
 void an::Author::setMarketData(market_data_t& md, const std::string& input) {
     impl_->mdRes_.reset();
 
-    impl_->parse(impl_->mdRes_, input, impl_->marketDataFields_); 
+    impl_->parse(impl_->mdRes_, PString(input), impl_->marketDataFields_); 
     (void) validate(impl_->marketDataType_, impl_->mdRes_);
     toMd(md, impl_->mdRes_);
 }
 
 an::MarketData* an::Author::makeMarketData(const std::string& input) {
     impl_->mdRes_.reset();
-    impl_->parse(impl_->mdRes_, input, impl_->marketDataFields_); 
+    impl_->parse(impl_->mdRes_, PString(input), impl_->marketDataFields_); 
     return createMarketData(impl_->mdRes_);
 }
 
@@ -786,6 +867,9 @@ an::Message* an::Message::makeOrder(const std::string& input) {
     an::direction_t myDirection = an::BUY;
     an::price_t myPrice = 0.0;
     an::shares_t myShares = 0;
+    an::shares_t myDisplay = 0;
+    an::tif_t myTif = an::DAY;
+    an::price_t myStop = 0.0;
     bool used = false;
     while(myBegin != myEnd) {
         used = false;
@@ -850,6 +934,39 @@ an::Message* an::Message::makeOrder(const std::string& input) {
             myFlags.set(ord(Tag::Price));
 	        used = true;
         }
+        if (res.first == "display") {
+            char* stop;
+            long myLong = std::strtol(res.second.c_str(), &stop, 10);
+            if (*stop != '\0') {
+                throw OrderError("Invalid display could not convert to long");
+            }
+            if ((myLong > (long)an::MAX_OUTSTANDING_SHARES) || (myLong < 1)) {
+                throw OrderError("Invalid display - out of range");
+            }
+            myDisplay = myLong;
+            myFlags.set(ord(Tag::Display));
+	        used = true;
+        }
+        if (res.first == "tif") {
+            if (res.second == "DAY") {
+                myTif = an::DAY;
+            } else if (res.second == "IOC") {
+                myTif = an::IOC;
+            } else if (res.second == "FOK") {
+                myTif = an::FOK;
+            } else {
+                std::stringstream ss;
+                ss << "Invalid tif [" << res.second << "]";
+                throw OrderError(ss.str());
+            }
+            myFlags.set(ord(Tag::Tif));
+	        used = true;
+        }
+        if (res.first == "stop") {
+            myStop = std::stod(res.second);
+            myFlags.set(ord(Tag::Stop));
+	        used = true;
+        }
         if (!used) {
             std::stringstream ss;
             ss << "Unused token [" << res.first << ',' << res.second << "]";
@@ -868,18 +985,33 @@ an::Message* an::Message::makeOrder(const std::string& input) {
                   f.set(ord(Tag::Destination)); f.set(ord(Tag::Symbol));
     if (myType == "LIMIT") {
         f.set(ord(Tag::Direction)); f.set(ord(Tag::Shares)); f.set(ord(Tag::Price));
-        checkFlags(f, myFlags);
-        an::LimitOrder* o = new an::LimitOrder(myId, myOrigin, myDestination, mySymbol, myDirection, myShares, myPrice);
+        TagFlags f1(myFlags); f1.reset(ord(Tag::Display)); f1.reset(ord(Tag::Tif)); f1.reset(ord(Tag::Stop)); // Optional
+        checkFlags(f, f1);
+        an::LimitOrder* o = new an::LimitOrder(myId, myOrigin, myDestination, mySymbol, myDirection, myShares, myPrice, myDisplay);
+        o->setTimeInForce(myTif);
+        o->setStopPrice(myStop);
         myOrder = o;
     } else if (myType == "MARKET") {
         f.set(ord(Tag::Direction)); f.set(ord(Tag::Shares));
-        checkFlags(f, myFlags);
+        TagFlags f1(myFlags); f1.reset(ord(Tag::Tif)); f1.reset(ord(Tag::Stop)); // Optional
+        checkFlags(f, f1);
         an::MarketOrder* o = new an::MarketOrder(myId, myOrigin, myDestination, mySymbol, myDirection, myShares);
+        o->setTimeInForce(myTif);
+        o->setStopPrice(myStop);
         myOrder = o;
     } else if (myType == "CANCEL") {
         checkFlags(f, myFlags);
         an::CancelOrder* o = new an::CancelOrder(myId, myOrigin, myDestination, mySymbol);
         myOrder = o;
+    } else if (myType == "MASSCANCEL") {
+        TagFlags f1(myFlags); f1.reset(ord(Tag::Symbol)); f1.reset(ord(Tag::Direction)); // Optional
+        TagFlags f2(f); f2.reset(ord(Tag::Symbol));
+        checkFlags(f2, f1);
+        an::MassCancelOrder* o = new an::MassCancelOrder(myId, myOrigin, myDestination, mySymbol);
+        if (myFlags[ord(Tag::Direction)]) {
+            o->setDirection(myDirection);
+        }
+        myOrder = o;
     } else if (myType == "AMEND") {
         TagFlags f1(myFlags); f1.reset(ord(Tag::Price)); f1.reset(ord(Tag::Shares));
         checkFlags(f, f1);
@@ -922,11 +1054,12 @@ void an::Execution::pack(an::SideRecord& rec) const {
 }
 
 std::string an::Execution::to_string() const {
-    std::stringstream ss;
-    ss << Order::to_string() << DELIMITOR
-       << "direction" << SEPERATOR << an::to_string(direction_) << DELIMITOR
-       << "shares" << SEPERATOR << shares_;
-    return ss.str();
+    return formatString( [this](Formatter& f) { Execution::format(f); } );
+}
+void an::Execution::format(Formatter& f) const {
+    Order::format(f);
+    f << DELIMITOR << "direction" << SEPERATOR << an::to_string(direction_) << DELIMITOR
+      << "shares" << SEPERATOR << shares_;
 }
 
 an::Execution::~Execution() { }
@@ -939,14 +1072,28 @@ void an::LimitOrder::applyOrder(MatchingEngine& me) {
 void an::LimitOrder::pack(an::SideRecord& rec) const {
     Execution::pack(rec); rec.order_type = an::LIMIT;
     rec.price = price_;
+    rec.peak = display_; // Side::add moves shares over the peak to the reserve
 }
 
 
 std::string an::LimitOrder::to_string() const {
-    std::stringstream os;
-    os << "type" << SEPERATOR << "LIMIT" << DELIMITOR << Execution::to_string() << DELIMITOR
-       << "price" << SEPERATOR << floatDecimalPlaces(price_,MAX_PRICE_PRECISION) ;
-    return os.str();
+    return formatString( [this](Formatter& f) { format(f); } );
+}
+void an::LimitOrder::format(Formatter& f) const {
+    f << "type" << SEPERATOR << "LIMIT" << DELIMITOR;
+    Execution::format(f);
+    f << DELIMITOR << "price" << SEPERATOR;
+    f.fixed(price_,MAX_PRICE_PRECISION);
+    if (display_ != 0) {
+        f << DELIMITOR << "display" << SEPERATOR << display_;
+    }
+    if (tif_ != DAY) {
+        f << DELIMITOR << "tif" << SEPERATOR << an::to_string(tif_);
+    }
+    if (stop_ != 0.0) {
+        f << DELIMITOR << "stop" << SEPERATOR;
+        f.fixed(stop_,MAX_PRICE_PRECISION);
+    }
 }
 an::LimitOrder::~LimitOrder() { }
 
@@ -978,9 +1125,18 @@ void an::MarketOrder::pack(an::SideRecord& rec) const {
 }
 
 std::string an::MarketOrder::to_string() const {
-    std::stringstream ss;
-    ss << "type" << SEPERATOR << "MARKET" << DELIMITOR << Execution::to_string() ;
-    return ss.str();
+    return formatString( [this](Formatter& f) { format(f); } );
+}
+void an::MarketOrder::format(Formatter& f) const {
+    f << "type" << SEPERATOR << "MARKET" << DELIMITOR;
+    Execution::format(f);
+    if (tif_ != DAY) {
+        f << DELIMITOR << "tif" << SEPERATOR << an::to_string(tif_);
+    }
+    if (stop_ != 0.0) {
+        f << DELIMITOR << "stop" << SEPERATOR;
+        f.fixed(stop_,MAX_PRICE_PRECISION);
+    }
 }
 an::MarketOrder::~MarketOrder() { }
 
@@ -1004,36 +1160,62 @@ void an::CancelOrder::applyOrder(MatchingEngine& me) {
 }
 
 std::string an::CancelOrder::to_string() const {
-    std::stringstream ss;
-    ss << "type" << SEPERATOR << "CANCEL" << DELIMITOR << Order::to_string() ;
-    return ss.str();
+    return formatString( [this](Formatter& f) { format(f); } );
+}
+void an::CancelOrder::format(Formatter& f) const {
+    f << "type" << SEPERATOR << "CANCEL" << DELIMITOR;
+    Order::format(f);
 }
 
 an::CancelOrder::~CancelOrder() { }
 
 
+void an::MassCancelOrder::applyOrder(MatchingEngine& me) {
+    me.applyOrder(std::move(std::unique_ptr<MassCancelOrder>(this)));
+}
+
+std::string an::MassCancelOrder::to_string() const {
+    return formatString( [this](Formatter& f) { format(f); } );
+}
+void an::MassCancelOrder::format(Formatter& f) const {
+    f << "type" << SEPERATOR << "MASSCANCEL" << DELIMITOR
+      << "id" << SEPERATOR << order_id_ << DELIMITOR;
+    Message::format(f);
+    if (!symbol_.empty()) {
+        f << DELIMITOR << "symbol" << SEPERATOR << symbol_;
+    }
+    if (!all_sides_) {
+        f << DELIMITOR << "direction" << SEPERATOR << an::to_string(direction_);
+    }
+}
+
+an::MassCancelOrder::~MassCancelOrder() { }
+
+
 
 void an::AmendOrder::applyOrder(MatchingEngine& me) {
     me.applyOrder(std::move(std::unique_ptr<AmendOrder>(this)));
 }
 
 std::string an::AmendOrder::to_string() const {
-    std::ostringstream os;
-    os << "type" << SEPERATOR << "AMEND" << DELIMITOR << Order::to_string();
+    return formatString( [this](Formatter& f) { format(f); } );
+}
+void an::AmendOrder::format(Formatter& f) const {
+    f << "type" << SEPERATOR << "AMEND" << DELIMITOR;
+    Order::format(f);
     if (amend_.field != NONE) {
-        os << DELIMITOR << amend_.get_field_name() << SEPERATOR ;
+        f << DELIMITOR << amend_.get_field_name() << SEPERATOR ;
         switch (amend_.field) {
             case NONE:
-                os << "none"; break;
+                f << "none"; break;
             case PRICE:
-                os << floatDecimalPlaces(amend_.price,MAX_PRICE_PRECISION); break;
+                f.fixed(amend_.price,MAX_PRICE_PRECISION); break;
             case SHARES:
-                os << amend_.shares; break;
+                f << amend_.shares; break;
             default:
-                os << "unknown:field_t";
+                f << "unknown:field_t";
         }
     }
-    return os.str();
 }
 
 an::AmendOrder::~AmendOrder() { }
@@ -1041,20 +1223,20 @@ an::AmendOrder::~AmendOrder() { }
 
 an::Reply::~Reply() { }
 std::string an::Reply::to_string() const { return Message::to_string(); }
+void an::Reply::format(Formatter& f) const { Message::format(f); }
 
 std::string an::Response::to_string() const {
-    std::ostringstream os;
+    return formatString( [this](Formatter& f) { format(f); } );
+}
+void an::Response::format(Formatter& f) const {
     if (message_ != nullptr) {
-        os << message_->to_string() << DELIMITOR
-           << "response" << SEPERATOR << an::to_string(response_) << DELIMITOR
-           << "text" << SEPERATOR << text_;
+        message_->format(f);
     } else {
-        os << "type" << SEPERATOR << "REPLY" << DELIMITOR
-           << Message::to_string() << DELIMITOR
-           << "response" << SEPERATOR << an::to_string(response_) << DELIMITOR
-           << "text" << SEPERATOR << text_;
+        f << "type" << SEPERATOR << "REPLY" << DELIMITOR;
+        Message::format(f);
     }
-    return os.str();
+    f << DELIMITOR << "response" << SEPERATOR << an::to_string(response_) << DELIMITOR
+      << "text" << SEPERATOR << text_;
 }
 
 an::Response::~Response() { }
@@ -1062,41 +1244,48 @@ an::Response::~Response() { }
 
 
 std::string an::TradeReport::to_string() const {
-    std::ostringstream os;
-    os << "type" << SEPERATOR << "TRADE" << DELIMITOR
-       << Reply::to_string() << DELIMITOR
-       << "orig_order_id" << SEPERATOR << orig_order_id_ << DELIMITOR
-       << "symbol" << SEPERATOR << symbol_ << DELIMITOR
-       << "direction" << SEPERATOR << an::to_string(direction_) << DELIMITOR
-       << "shares" << SEPERATOR << shares_ << DELIMITOR
-       << "price" << SEPERATOR << floatDecimalPlaces(price_,MAX_PRICE_PRECISION) ;
-    return os.str();
+    return formatString( [this](Formatter& f) { format(f); } );
+}
+void an::TradeReport::format(Formatter& f) const {
+    f << "type" << SEPERATOR << "TRADE" << DELIMITOR;
+    Reply::format(f);
+    f << DELIMITOR << "orig_order_id" << SEPERATOR << orig_order_id_ << DELIMITOR
+      << "symbol" << SEPERATOR << symbol_ << DELIMITOR
+      << "direction" << SEPERATOR << an::to_string(direction_) << DELIMITOR
+      << "shares" << SEPERATOR << shares_ << DELIMITOR
+      << "price" << SEPERATOR;
+    f.fixed(price_,MAX_PRICE_PRECISION);
 }
 
 an::TradeReport::~TradeReport() { }
 
 std::string an::MarketData::to_string() const {
-    std::ostringstream os;
-    os << "type" << SEPERATOR << "MARKETDATA" << DELIMITOR
-       << "seq" << SEPERATOR << md_.seq << DELIMITOR
-       << Reply::to_string() << DELIMITOR
-       << "symbol" << SEPERATOR << md_.symbol << DELIMITOR ;
+    return formatString( [this](Formatter& f) { format(f); } );
+}
+void an::MarketData::format(Formatter& f) const {
+    f << "type" << SEPERATOR << "MARKETDATA" << DELIMITOR
+      << "seq" << SEPERATOR << md_.seq << DELIMITOR;
+    Reply::format(f);
+    f << DELIMITOR << "symbol" << SEPERATOR << md_.symbol << DELIMITOR ;
         if (md_.have_bid) {
-            os << "bid" << SEPERATOR << floatDecimalPlaces(md_.bid,MAX_PRICE_PRECISION) << DELIMITOR
-               << "bid_size" << SEPERATOR << md_.bid_size << DELIMITOR ;
+            f << "bid" << SEPERATOR;
+            f.fixed(md_.bid,MAX_PRICE_PRECISION) << DELIMITOR
+              << "bid_size" << SEPERATOR << md_.bid_size << DELIMITOR ;
         }
         if (md_.have_ask) {
-            os << "ask" << SEPERATOR << floatDecimalPlaces(md_.ask,MAX_PRICE_PRECISION) << DELIMITOR
-               << "ask_size" << SEPERATOR << md_.ask_size << DELIMITOR ;
+            f << "ask" << SEPERATOR;
+            f.fixed(md_.ask,MAX_PRICE_PRECISION) << DELIMITOR
+              << "ask_size" << SEPERATOR << md_.ask_size << DELIMITOR ;
         }
         if (md_.have_last_trade) {
-            os << "last_trade_price" << SEPERATOR << floatDecimalPlaces(md_.last_trade_price,MAX_PRICE_PRECISION) << DELIMITOR
-               << "last_trade_shares" << SEPERATOR << md_.last_trade_shares << DELIMITOR
-               << "trade_time" << SEPERATOR << md_.trade_time << DELIMITOR ;
+            f << "last_trade_price" << SEPERATOR;
+            f.fixed(md_.last_trade_price,MAX_PRICE_PRECISION) << DELIMITOR
+              << "last_trade_shares" << SEPERATOR << md_.last_trade_shares << DELIMITOR
+              << "trade_time" << SEPERATOR << md_.trade_time << DELIMITOR ;
         }
-    os << "quote_time" << SEPERATOR << md_.quote_time << DELIMITOR
-       << "volume" << SEPERATOR << floatDecimalPlaces(md_.volume,VOLUME_OUTPUT_PRECISION) ;
-    return os.str();
+    f << "quote_time" << SEPERATOR << md_.quote_time << DELIMITOR
+      << "volume" << SEPERATOR;
+    f.fixed(md_.volume,VOLUME_OUTPUT_PRECISION);
 }
 
 an::MarketData::~MarketData() { }
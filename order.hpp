@@ -5,6 +5,7 @@
 #include <sstream>
 #include <exception>
 #include "types.hpp"
+#include "format.hpp"
 
 namespace an {
 
@@ -59,8 +60,11 @@ struct Author { // : private boost::noncopyable {
         Author();
         ~Author();
 
+        // PString overloads parse in place, input must stay valid for the call
+        Order* makeOrder(PString input);
         Order* makeOrder(const std::string& input);
         MarketData* makeMarketData(const std::string& input);
+        Login* makeLogin(PString input);
         Login* makeLogin(const std::string& input);
         void setMarketData(market_data_t& md, const std::string& input);
     protected:
@@ -78,6 +82,8 @@ class Message {
         Message(location_t origin, location_t dest = ME);
 
         virtual std::string to_string() const = 0;
+        // Writes to_string() into f, no allocation
+        virtual void format(Formatter& f) const = 0;
         virtual ~Message() = 0;
 
         // Factory and string parser
@@ -97,26 +103,42 @@ class Login : public Message {
     public:
         Login(location_t origin, location_t dest = ME) : Message(origin, dest) { }
         virtual std::string to_string() const;
+        virtual void format(Formatter& f) const;
 
         virtual ~Login();
 };
 
 
+// Pre-trade risk still accounted to an order, see PreTradeRisk
+struct risk_account_t {
+    static constexpr std::uint32_t NO_SLOT = std::numeric_limits<std::uint32_t>::max();
+    risk_account_t() : slot(NO_SLOT), price(0.0), leaves(0) { }
+    risk_account_t(std::uint32_t s, price_t p, shares_t l) : slot(s), price(p), leaves(l) { }
+    std::uint32_t   slot;   // Client, NO_SLOT if not accounted
+    price_t         price;  // Valued at
+    shares_t        leaves;
+};
+
 class Order : public Message {
     public:
         Order(order_id_t id, location_t origin, location_t dest, symbol_t sym)
-             : Message(origin, dest), order_id_(id), symbol_(sym) //, origin_(origin), destination_(dest)
+             : Message(origin, dest), order_id_(id), symbol_(sym), risk_slot_(risk_account_t::NO_SLOT) //, origin_(origin), destination_(dest)
              { }
 
         virtual std::string to_string() const = 0;
+        virtual void format(Formatter& f) const = 0;
         virtual ~Order() = 0;
         virtual void applyOrder(MatchingEngine& me) = 0;
 
         order_id_t orderId() const { return order_id_; }
         const symbol_t& symbol() const { return symbol_; }
+        // Pre-trade risk client of the origin, stamped by its session (NO_SLOT if not)
+        std::uint32_t riskSlot() const { return risk_slot_; }
+        void setRiskSlot(std::uint32_t slot) { risk_slot_ = slot; }
     protected:
         order_id_t order_id_;
         symbol_t symbol_;
+        std::uint32_t risk_slot_;
 
 };
 
@@ -124,32 +146,49 @@ class Order : public Message {
 class Execution : public Order {
     public:
         Execution(order_id_t id, location_t o, location_t dest, symbol_t sym, direction_t d, shares_t s)
-            : Order(id, o, dest, sym), direction_(d), shares_(s) { }
+            : Order(id, o, dest, sym), direction_(d), shares_(s), tif_(DAY), stop_(0.0), risk_() { }
         virtual std::string to_string() const = 0;
+        virtual void format(Formatter& f) const = 0;
         virtual ~Execution() = 0;
 
         virtual void applyOrder(MatchingEngine& me) = 0;
         virtual void pack(SideRecord& rec) const = 0;
 
         virtual bool amend(amend_t) = 0;
+
+        tif_t timeInForce() const { return tif_; }
+        void setTimeInForce(tif_t tif) { tif_ = tif; }
+        // Non zero is a stop (MARKET) or stop limit (LIMIT), held off the book
+        // until a trade at or through the stop price
+        price_t stopPrice() const { return stop_; }
+        void setStopPrice(price_t stop) { stop_ = stop; }
+        risk_account_t& riskAccount() { return risk_; }
     protected:
         direction_t direction_;
         shares_t shares_;
+        tif_t tif_;
+        price_t stop_;
+        risk_account_t risk_;
 };
 
 class LimitOrder : public Execution {
     public:
-        LimitOrder(order_id_t id, location_t o, location_t dest, symbol_t sym, direction_t d, shares_t s, price_t p)
-            : Execution(id, o, dest, sym, d, s), price_(p) {}
+        // display non zero is an iceberg, display shares are shown at a time
+        LimitOrder(order_id_t id, location_t o, location_t dest, symbol_t sym, direction_t d, shares_t s, price_t p,
+                   shares_t display = 0)
+            : Execution(id, o, dest, sym, d, s), price_(p), display_(display) {}
 
         virtual std::string to_string() const;
+        virtual void format(Formatter& f) const;
         virtual ~LimitOrder() ;
         virtual void applyOrder(MatchingEngine& me) ;
 
         virtual void pack(SideRecord& rec) const ;
         virtual bool amend(amend_t);
+        shares_t display() const { return display_; }
     protected:
         price_t price_;
+        shares_t display_;
 };
 
 
@@ -159,6 +198,7 @@ class MarketOrder : public Execution {
             : Execution(id,o,dest,sym,d,s) {}
 
         virtual std::string to_string() const;
+        virtual void format(Formatter& f) const;
         virtual ~MarketOrder() ;
         virtual void applyOrder(MatchingEngine& me) ;
 
@@ -172,11 +212,32 @@ class CancelOrder : public Order {
         CancelOrder(order_id_t id, location_t o, location_t dest, symbol_t sym) : Order(id, o, dest, sym) {}
 
         virtual std::string to_string() const;
+        virtual void format(Formatter& f) const;
         virtual ~CancelOrder() ;
         virtual void applyOrder(MatchingEngine& me) ;
     protected:
 };
 
+// Cancels every live order of the origin, an empty symbol is all symbols
+// and without a direction both sides
+class MassCancelOrder : public Order {
+    public:
+        MassCancelOrder(order_id_t id, location_t o, location_t dest, symbol_t sym = "")
+            : Order(id, o, dest, sym), all_sides_(true), direction_(BUY) {}
+
+        virtual std::string to_string() const;
+        virtual void format(Formatter& f) const;
+        virtual ~MassCancelOrder() ;
+        virtual void applyOrder(MatchingEngine& me) ;
+
+        bool allSides() const { return all_sides_; }
+        direction_t direction() const { return direction_; }
+        void setDirection(direction_t d) { all_sides_ = false; direction_ = d; }
+    protected:
+        bool all_sides_;
+        direction_t direction_;
+};
+
 class AmendOrder : public Order {
     public:
         explicit AmendOrder(order_id_t id, location_t o, location_t dest, symbol_t sym)
@@ -191,6 +252,7 @@ class AmendOrder : public Order {
         }
 
         virtual std::string to_string() const;
+        virtual void format(Formatter& f) const;
         virtual ~AmendOrder() ;
         virtual void applyOrder(MatchingEngine& me) ;
 
@@ -207,7 +269,11 @@ class Reply : public Message {
             : Message(origin, dest) { } 
 
         virtual std::string to_string() const = 0;
+        virtual void format(Formatter& f) const = 0;
         virtual ~Reply() = 0;
+
+        // Who should receive the reply (client name or ALL)
+        virtual const location_t& recipient() const { return destination_; }
 };
 
 // Decorator to responde to messages
@@ -234,7 +300,12 @@ class Response : public Reply {
 
 
         virtual std::string to_string() const;
+        virtual void format(Formatter& f) const;
         virtual ~Response();
+
+        virtual const location_t& recipient() const {
+            return (message_ != nullptr) ? message_->origin() : destination_;
+        }
     protected:
         Message* message_;
         response_t response_;
@@ -249,6 +320,7 @@ class TradeReport : public Reply {
         }
 
         virtual std::string to_string() const;
+        virtual void format(Formatter& f) const;
         virtual ~TradeReport();
     protected:
         order_id_t orig_order_id_;
@@ -261,11 +333,13 @@ class TradeReport : public Reply {
 class MarketData : public Reply {
     public:
         explicit MarketData(location_t origin, const market_data_t& md )
-            : Reply(origin, "<all>"), md_(md) {
+            : Reply(origin, ALL), md_(md) {
         }
 
         virtual std::string to_string() const;
+        virtual void format(Formatter& f) const;
         void setMD(const market_data_t& md) { md_ = md; }
+        const market_data_t& md() const { return md_; }
         virtual ~MarketData();
     protected:
         market_data_t md_;
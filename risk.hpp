@@ -0,0 +1,213 @@
+#ifndef AN_RISK_HPP
+#define AN_RISK_HPP
+
+#include "types.hpp"
+#include "order.hpp"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace an {
+
+// Per client pre-trade limits, zero is no limit
+struct risk_limits_t {
+    risk_limits_t() : max_order_shares(0), max_notional(0.0), collar(0.0), max_exposure(0.0) { }
+    shares_t        max_order_shares;
+    volume_t        max_notional;   // Shares by limit (or reference) price of one order
+    double          collar;         // Fraction either side of the reference price a limit may be
+    volume_t        max_exposure;   // Gross, open orders plus executed notional
+};
+
+struct client_risk_t {
+    client_risk_t() : limits(), open(0.0), executed(0.0), rejects(0) { }
+    volume_t exposure() const { return open + executed; }
+
+    risk_limits_t   limits;
+    volume_t        open;       // Notional of accepted orders not yet filled or cancelled
+    volume_t        executed;   // Buys plus sells
+    counter_t       rejects;
+};
+
+// Pre-trade checks in front of the books, on the engine thread as they need
+// the live price and fills. A session resolves its client's slot once, when
+// it is named (slotFor), and stamps it on each order so a check indexes the
+// slot directly. Orders carry what is still accounted (Execution::riskAccount)
+// so fills and cancels are O(1). Off until limits are set.
+class PreTradeRisk {
+    public:
+        PreTradeRisk() : enabled_(false), default_(), clients_(), mutex_(), slots_() { }
+
+        bool enabled() const { return enabled_; }
+        // Applies to clients without their own limits, including existing ones
+        void setDefaultLimits(const risk_limits_t& limits) {
+            enabled_ = true;
+            default_ = limits;
+            for (auto& client : clients_) {
+                if (!client.own_limits) {
+                    client.risk.limits = limits;
+                }
+            }
+        }
+        void setLimits(const location_t& origin, const risk_limits_t& limits) {
+            enabled_ = true;
+            client_slot_t& client = clients_[grow(slotFor(origin))];
+            client.risk.limits = limits;
+            client.own_limits = true;
+        }
+        // Null if unknown
+        const client_risk_t* find(const location_t& origin) const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = slots_.find(origin);
+            return ((found != slots_.end()) && (found->second < clients_.size())) ?
+                &clients_[found->second].risk : nullptr;
+        }
+        // Any thread, the slot of origin, given one on first use. Only this pays
+        // for the node and the key copy.
+        std::uint32_t slotFor(const location_t& origin) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return slots_.emplace(origin, static_cast<std::uint32_t>(slots_.size())).first->second;
+        }
+
+        // Null if accepted, and the order's notional is then open, otherwise the
+        // reject text. Market orders are valued at the reference price, stops are
+        // not collared as they are away from the market by design. Without a
+        // reference price (no quote, trade or close) nothing is collared.
+        const char* check(Execution& exe, order_t type, shares_t shares, price_t price, price_t reference) {
+            if (!enabled_) {
+                return nullptr;
+            }
+            const std::uint32_t s = slot(exe);
+            client_risk_t& client = clients_[s].risk;
+            const risk_limits_t& limits = client.limits;
+            const bool priced = (type == LIMIT);
+            if (!priced) {
+                price = reference;
+            }
+            const volume_t notional = shares * price;
+            const char* breach = nullptr;
+            if ((limits.max_order_shares != 0) && (shares > limits.max_order_shares)) {
+                breach = "risk order size";
+            } else if ((limits.max_notional != 0.0) && (notional > limits.max_notional)) {
+                breach = "risk order notional";
+            } else if (priced && (exe.stopPrice() == 0.0) && outsideCollar(limits, price, reference)) {
+                breach = "risk price collar";
+            } else if ((limits.max_exposure != 0.0) && (client.exposure() + notional > limits.max_exposure)) {
+                breach = "risk gross exposure";
+            }
+            if (breach != nullptr) {
+                ++client.rejects;
+                return breach;
+            }
+            exe.riskAccount() = risk_account_t{s, price, shares};
+            client.open += notional;
+            return nullptr;
+        }
+        // Null if accepted, and the order is then accounted at its amended shares
+        // or price, otherwise the reject text. Orders accepted before any limits
+        // were set are not accounted and only get the size and collar checks.
+        // An amend the book turns down is put back with restore.
+        const char* checkAmend(Execution& exe, const amend_t& amend, price_t reference) {
+            if (!enabled_) {
+                return nullptr;
+            }
+            risk_account_t& account = exe.riskAccount();
+            const bool accounted = (account.slot != risk_account_t::NO_SLOT);
+            client_risk_t& client = clients_[accounted ? account.slot : slot(exe)].risk;
+            const risk_limits_t& limits = client.limits;
+            const shares_t leaves = (amend.field == SHARES) ? amend.shares : account.leaves;
+            const price_t price = (amend.field == PRICE) ? amend.price : account.price;
+            const volume_t notional = leaves * price;
+            const volume_t delta = notional - account.leaves * account.price;
+            const char* breach = nullptr;
+            if ((amend.field == SHARES) && (limits.max_order_shares != 0) && (amend.shares > limits.max_order_shares)) {
+                breach = "risk order size";
+            } else if ((amend.field == PRICE) && outsideCollar(limits, amend.price, reference)) {
+                breach = "risk price collar";
+            } else if (accounted && (limits.max_notional != 0.0) && (notional > limits.max_notional)) {
+                breach = "risk order notional";
+            } else if (accounted && (limits.max_exposure != 0.0) && (delta > 0.0) &&
+                       (client.exposure() + delta > limits.max_exposure)) {
+                breach = "risk gross exposure";
+            }
+            if (breach != nullptr) {
+                ++client.rejects;
+                return breach;
+            }
+            if (accounted) {
+                account.leaves = leaves;
+                account.price = price;
+                client.open += delta;
+            }
+            return nullptr;
+        }
+        // Undo an accepted checkAmend, previous is the account before it
+        void restore(Execution& exe, const risk_account_t& previous) {
+            risk_account_t& account = exe.riskAccount();
+            if (account.slot == risk_account_t::NO_SLOT) {
+                return;
+            }
+            clients_[account.slot].risk.open += previous.leaves * previous.price - account.leaves * account.price;
+            account = previous;
+        }
+        // Shares traded at price move from open to executed
+        void fill(Execution& exe, shares_t shares, price_t price) {
+            risk_account_t& account = exe.riskAccount();
+            if (account.slot == risk_account_t::NO_SLOT) {
+                return;
+            }
+            client_risk_t& client = clients_[account.slot].risk;
+            const shares_t accounted = std::min(shares, account.leaves);
+            account.leaves -= accounted;
+            client.open -= accounted * account.price;
+            client.executed += shares * price;
+        }
+        // Cancelled or rejected, whatever is still open is released
+        void release(Execution& exe) {
+            risk_account_t& account = exe.riskAccount();
+            if (account.slot == risk_account_t::NO_SLOT) {
+                return;
+            }
+            clients_[account.slot].risk.open -= account.leaves * account.price;
+            account = risk_account_t();
+        }
+    private:
+        struct client_slot_t {
+            client_slot_t() : risk(), own_limits(false) { }
+            client_risk_t   risk;
+            bool            own_limits;
+        };
+
+        // The order's stamped slot, looked up only if its session did not stamp it
+        std::uint32_t slot(Execution& exe) {
+            std::uint32_t s = exe.riskSlot();
+            if (s == risk_account_t::NO_SLOT) {
+                s = slotFor(exe.origin());
+                exe.setRiskSlot(s);
+            }
+            return grow(s);
+        }
+        // Slots are handed out on any thread, clients_ catches up here on the engine thread
+        std::uint32_t grow(std::uint32_t s) {
+            while (clients_.size() <= s) {
+                clients_.emplace_back();
+                clients_.back().risk.limits = default_;
+            }
+            return s;
+        }
+        static bool outsideCollar(const risk_limits_t& limits, price_t price, price_t reference) {
+            return (limits.collar != 0.0) && (reference > 0.0) &&
+                   (std::abs(price - reference) > limits.collar * reference);
+        }
+
+        bool                        enabled_;
+        risk_limits_t               default_;
+        std::vector<client_slot_t>  clients_; // Flat, indexed by slot
+        mutable std::mutex          mutex_;   // Guards slots_, sessions resolve on their io threads
+        std::unordered_map<location_t, std::uint32_t> slots_;
+};
+
+} // an - namespace
+
+#endif
@@ -2,6 +2,11 @@
 #include "fast-cpp-csv-parser/csv.h"
 #include "security_master.hpp"
 #include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <thread>
 
 
 std::string  an::security_record_t::to_string() const {
@@ -43,25 +48,196 @@ std::string an::TickTable::to_string() const {
     return os.str() ;
 }
 
-void an::SecurityDatabase::loadData(const std::string& filename) {
-    io::CSVReader<10> in(filename); // 10 fields
-    in.read_header(io::ignore_no_column,
+namespace {
+    enum secdb_column_t { COL_ID, COL_EXCHANGE, COL_SYMBOL, COL_CLOSING_PRICE, COL_OUTSTANDING_SHARES,
+                          COL_BORN, COL_HAS_DIED, COL_DIED, COL_TRADEABLE, COL_TICK_LADDER_ID, COL_MAX };
+    const char* const SECDB_COLUMNS[COL_MAX] = {
         "id", "exchange", "symbol", "closing_price", "outstanding_shares",
-        "born", "has_died", "died", "tradeable", "tick_ladder_id");
-    std::string born; char has_died; std::string died; char tradeable;
-    an::security_record_t sr;
-    while(in.read_row(sr.id, sr.exchange, sr.symbol, sr.closing_price, sr.outstanding_shares,
-                      born, has_died, died, tradeable, sr.ladder_id) ) {
-       sr.born = an::dateToTimeT(born);
-       sr.has_died = has_died == 'Y';
-       if (sr.has_died) {
-           sr.died = an::dateToTimeT(died);
-       } else {
-           sr.died = an::MY_MAX_DATE;
-       }
-       sr.tradeable = tradeable == 'Y';
-       securities_.push_back(sr);
-       // std::cout << sr.to_string() << std::endl;
+        "born", "has_died", "died", "tradeable", "tick_ladder_id" };
+    const std::size_t MAX_SECDB_FIELDS = 32;
+
+    struct field_t {
+        const char* str;
+        std::size_t len;
+        std::string to_string() const { return std::string(str, len); }
+        an::PString pstring() const { return an::PString(str, static_cast<std::int32_t>(len)); }
+    };
+
+    inline bool isBlank(char c) {
+        return (c == ' ') || (c == '\t') || (c == '\r');
+    }
+
+    // Split a line on ',' trimming blanks, returns number of fields
+    std::size_t splitLine(const char* first, const char* last, field_t* fields) {
+        std::size_t n = 0;
+        for (;;) {
+            const char* comma = static_cast<const char*>(std::memchr(first, ',', last - first));
+            const char* stop = (comma != nullptr) ? comma : last;
+            const char* b = first;
+            const char* e = stop;
+            while ((b < e) && isBlank(*b)) ++b;
+            while ((e > b) && isBlank(*(e-1))) --e;
+            if (n < MAX_SECDB_FIELDS) {
+                fields[n] = field_t{b, static_cast<std::size_t>(e - b)};
+            }
+            ++n;
+            if (comma == nullptr) {
+                break;
+            }
+            first = comma + 1;
+        }
+        return n;
+    }
+
+    bool parsePrice(const field_t& f, an::price_t& result) {
+        char buf[64];
+        if ((f.len == 0) || (f.len >= sizeof(buf))) {
+            return false;
+        }
+        std::memcpy(buf, f.str, f.len); // strtod needs a terminator
+        buf[f.len] = '\0';
+        char* end = nullptr;
+        result = std::strtod(buf, &end);
+        return end == buf + f.len;
+    }
+
+    void badRow(std::size_t line, const char* what) {
+        std::ostringstream os;
+        os << "security database line " << line << ": " << what;
+        throw an::SecurityError(os.str());
+    }
+
+    // Parse complete lines in [first,last), first_line is the file line number of first
+    void parseRows(const char* first, const char* last, std::size_t first_line, const std::size_t* column,
+                   std::vector<an::security_record_t>& out) {
+        field_t fields[MAX_SECDB_FIELDS];
+        std::size_t line = first_line;
+        an::security_record_t sr;
+        while (first < last) {
+            const char* nl = static_cast<const char*>(std::memchr(first, '\n', last - first));
+            const char* stop = (nl != nullptr) ? nl : last;
+            const char* b = first;
+            first = (nl != nullptr) ? nl + 1 : last;
+            while ((b < stop) && isBlank(*b)) ++b;
+            if (b == stop) {
+                ++line;
+                continue; // Blank line
+            }
+            std::size_t n = splitLine(b, stop, fields);
+            if (n > MAX_SECDB_FIELDS) {
+                badRow(line, "too many fields");
+            }
+            for (std::size_t c = 0; c < COL_MAX; ++c) {
+                if (column[c] >= n) {
+                    badRow(line, "missing field");
+                }
+            }
+            const field_t* f[COL_MAX];
+            for (std::size_t c = 0; c < COL_MAX; ++c) {
+                f[c] = &fields[column[c]];
+            }
+            if (!an::pstring2int(&sr.id, f[COL_ID]->pstring())) badRow(line, "bad id");
+            sr.exchange = f[COL_EXCHANGE]->to_string();
+            sr.symbol = f[COL_SYMBOL]->to_string();
+            if (!parsePrice(*f[COL_CLOSING_PRICE], sr.closing_price)) badRow(line, "bad closing_price");
+            if (!an::pstring2int(&sr.outstanding_shares, f[COL_OUTSTANDING_SHARES]->pstring())) badRow(line, "bad outstanding_shares");
+            if (!an::parseDate(f[COL_BORN]->str, f[COL_BORN]->len, sr.born)) badRow(line, "bad born date");
+            sr.has_died = (f[COL_HAS_DIED]->len != 0) && (f[COL_HAS_DIED]->str[0] == 'Y');
+            if (sr.has_died) {
+                if (!an::parseDate(f[COL_DIED]->str, f[COL_DIED]->len, sr.died)) badRow(line, "bad died date");
+            } else {
+                sr.died = an::MY_MAX_DATE;
+            }
+            sr.tradeable = (f[COL_TRADEABLE]->len != 0) && (f[COL_TRADEABLE]->str[0] == 'Y');
+            if (!an::pstring2int(&sr.ladder_id, f[COL_TICK_LADDER_ID]->pstring())) badRow(line, "bad tick_ladder_id");
+            out.push_back(sr);
+            ++line;
+        }
+    }
+}
+
+// Whole file is mapped, the header decides the column order. Rows are parsed in place,
+// split into newline aligned chunks across threads when threads > 1.
+void an::SecurityDatabase::loadData(const std::string& filename, unsigned threads) {
+    image_.reset();
+    MappedFile file(filename);
+    const char* first = file.begin();
+    const char* last = file.end();
+    if (first == last) {
+        throw SecurityError("Empty security database " + filename);
+    }
+
+    // Header
+    const char* nl = static_cast<const char*>(std::memchr(first, '\n', last - first));
+    const char* header_end = (nl != nullptr) ? nl : last;
+    field_t fields[MAX_SECDB_FIELDS];
+    std::size_t n = splitLine(first, header_end, fields);
+    std::size_t column[COL_MAX];
+    for (std::size_t c = 0; c < COL_MAX; ++c) {
+        column[c] = MAX_SECDB_FIELDS;
+        for (std::size_t i = 0; i < std::min(n, MAX_SECDB_FIELDS); ++i) {
+            if ((fields[i].len == std::strlen(SECDB_COLUMNS[c])) &&
+                (std::memcmp(fields[i].str, SECDB_COLUMNS[c], fields[i].len) == 0)) {
+                column[c] = i;
+                break;
+            }
+        }
+        if (column[c] == MAX_SECDB_FIELDS) {
+            throw SecurityError(std::string("Missing column ") + SECDB_COLUMNS[c] + " in " + filename);
+        }
+    }
+    first = (nl != nullptr) ? nl + 1 : last;
+
+    // Upper bound on rows
+    std::size_t rows = 0;
+    for (const char* p = first; p < last; ++rows) {
+        const char* next = static_cast<const char*>(std::memchr(p, '\n', last - p));
+        p = (next != nullptr) ? next + 1 : last;
+    }
+    securities_.reserve(securities_.size() + rows);
+
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(rows / 1024 + 1)));
+    if (threads == 1) {
+        parseRows(first, last, 2, column, securities_);
+    } else {
+        // Chunk boundaries moved forward to the next line start
+        std::vector<const char*> bounds(threads + 1, last);
+        bounds[0] = first;
+        const std::size_t chunk = (last - first) / threads;
+        for (unsigned t = 1; t < threads; ++t) {
+            const char* p = std::max(bounds[t-1], first + t * chunk);
+            const char* next = (p < last) ? static_cast<const char*>(std::memchr(p, '\n', last - p)) : nullptr;
+            bounds[t] = (next != nullptr) ? next + 1 : last;
+        }
+        // Line numbers for error messages
+        std::vector<std::size_t> first_line(threads, 2);
+        for (unsigned t = 1; t < threads; ++t) {
+            first_line[t] = first_line[t-1] + std::count(bounds[t-1], bounds[t], '\n');
+        }
+        std::vector<std::vector<security_record_t>> parts(threads);
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back( [&, t] {
+                try {
+                    parts[t].reserve(rows / threads + 1);
+                    parseRows(bounds[t], bounds[t+1], first_line[t], column, parts[t]);
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            } );
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+        for (auto& e : errors) {
+            if (e) {
+                std::rethrow_exception(e);
+            }
+        }
+        for (auto& part : parts) {
+            std::move(part.begin(), part.end(), std::back_inserter(securities_));
+        }
     }
     updateMaps();
 }
@@ -69,6 +245,8 @@ void an::SecurityDatabase::loadData(const std::string& filename) {
 void an::SecurityDatabase::updateMaps() {
     security_id_loc_.clear();
     symbol_loc_.clear();
+    security_id_loc_.reserve(securities_.size());
+    symbol_loc_.reserve(securities_.size());
     std::size_t i = 0;
     for (const auto& sec: securities_) {
         // Just index live securities on this exchange
@@ -84,7 +262,21 @@ void an::SecurityDatabase::updateMaps() {
 void an::TickLadder::addTickLadder(const ladder_id_t id, const TickTable& ladder) {
     //std::cout << "Tick ID = " << id << std::endl;
     //std::cout << ladder << std::endl;
-    ladders_.emplace(id, ladder);
+    if (id > MAX_LADDER_ID) {
+        throw SecurityError("Tick ladder id too large");
+    }
+    if (id >= by_id_.size()) {
+        by_id_.resize(id + 1, nullptr);
+    }
+    if (by_id_[id] != nullptr) {
+        return; // First definition wins
+    }
+    auto found = std::find(tables_.begin(), tables_.end(), ladder);
+    if (found == tables_.end()) {
+        tables_.push_back(ladder);
+        found = tables_.end() - 1;
+    }
+    by_id_[id] = &(*found);
 }
 
 
@@ -115,10 +307,228 @@ void an::TickLadder::loadData(const std::string& filename) {
 
 std::string an::TickLadder::to_string() const {
     std::ostringstream os;
-    for (const auto& tt : ladders_) {
-        os << "[" << tt.first << "]" << std::endl
-           << tt.second.to_string() << std::endl;
+    for (ladder_id_t id = 0; id < by_id_.size(); ++id) {
+        if (by_id_[id] != nullptr) {
+            os << "[" << id << "]" << std::endl
+               << by_id_[id]->to_string() << std::endl;
+        }
     }
     return os.str();
 }
 
+// ************** SECURITY MASTER IMAGE *********************
+
+const std::uint32_t an::SecurityImage::NO_TABLE;
+
+namespace {
+    std::uint64_t fnv1a(const char* first, const char* last) {
+        std::uint64_t h = 14695981039346656037ULL;
+        for (; first < last; ++first) {
+            h ^= static_cast<unsigned char>(*first);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // Append a section, 8 byte aligned, returns its offset
+    template <typename T>
+    std::uint64_t appendSection(std::string& image, const T* data, std::size_t count) {
+        image.resize((image.size() + 7) & ~std::size_t(7), '\0');
+        const std::uint64_t offset = image.size();
+        image.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+        return offset;
+    }
+
+    bool inside(std::uint64_t offset, std::uint64_t count, std::size_t size, std::uint64_t file_size) {
+        return (offset <= file_size) && (count <= (file_size - offset) / size);
+    }
+}
+
+an::SecurityImage::SecurityImage(const std::string& filename, bool verify)
+        : file_(filename), header_(reinterpret_cast<const secdb_image_header_t*>(file_.begin())) {
+    const std::uint64_t size = file_.size();
+    if ((size < sizeof(secdb_image_header_t)) ||
+        (std::memcmp(header_->magic, SECDB_IMAGE_MAGIC, sizeof(SECDB_IMAGE_MAGIC)) != 0)) {
+        throw SecurityError("Not a security master image " + filename);
+    }
+    if ((header_->version != SECDB_IMAGE_VERSION) || (header_->header_size != sizeof(secdb_image_header_t))) {
+        throw SecurityError("Unsupported security master image version " + std::to_string(header_->version) +
+                            " in " + filename);
+    }
+    if ( (header_->file_size != size) ||
+         !inside(header_->records_offset, header_->record_count, sizeof(secdb_image_record_t), size) ||
+         !inside(header_->strings_offset, header_->strings_size, 1, size) ||
+         !inside(header_->index_offset, header_->index_size, sizeof(std::uint32_t), size) ||
+         !inside(header_->ladders_offset, header_->ladder_count, sizeof(std::uint32_t), size) ||
+         !inside(header_->tables_offset, header_->table_count, sizeof(secdb_image_table_t), size) ||
+         !inside(header_->bands_offset, header_->band_count, sizeof(secdb_image_band_t), size) ||
+         (header_->index_size == 0) || ((header_->index_size & (header_->index_size - 1)) != 0) ) {
+        throw SecurityError("Truncated security master image " + filename);
+    }
+    if (verify && (fnv1a(file_.begin() + sizeof(secdb_image_header_t), file_.end()) != header_->checksum)) {
+        throw SecurityError("Checksum mismatch in security master image " + filename);
+    }
+}
+
+// Built in memory then renamed into place, readers never see a partial image
+void an::SecurityImage::write(const std::string& filename, const SecurityDatabase& secdb, const TickLadder& ladder) {
+    // Interned strings, offset 0 is the empty string
+    std::string strings(1, '\0');
+    std::unordered_map<std::string, std::uint32_t> interned;
+    auto intern = [&](const std::string& s) -> std::uint32_t {
+        auto found = interned.find(s);
+        if (found != interned.end()) {
+            return found->second;
+        }
+        const std::uint32_t offset = static_cast<std::uint32_t>(strings.size());
+        strings.append(s.c_str(), s.size() + 1);
+        interned.emplace(s, offset);
+        return offset;
+    };
+
+    const auto& securities = secdb.securities();
+    std::vector<secdb_image_record_t> records;
+    records.reserve(securities.size());
+    for (const auto& sec : securities) {
+        secdb_image_record_t rec;
+        std::memset(&rec, 0, sizeof(rec));
+        rec.id = sec.id;
+        rec.ladder_id = sec.ladder_id;
+        rec.exchange = intern(sec.exchange);
+        rec.symbol = intern(sec.symbol);
+        rec.closing_price = sec.closing_price;
+        rec.outstanding_shares = sec.outstanding_shares;
+        rec.born = sec.born;
+        rec.died = sec.died;
+        rec.has_died = sec.has_died;
+        rec.tradeable = sec.tradeable;
+        records.push_back(rec);
+    }
+
+    // Load factor at most one half
+    std::size_t slots = 8;
+    while (slots < 2 * records.size()) {
+        slots *= 2;
+    }
+    std::vector<std::uint32_t> index(slots, 0);
+    for (std::size_t i = 0; i < securities.size(); ++i) {
+        const auto& symbol = securities[i].symbol;
+        std::size_t slot = PString::hash_c_string(symbol.data(), symbol.size()) & (slots - 1);
+        while (index[slot] != 0) {
+            slot = (slot + 1) & (slots - 1);
+        }
+        index[slot] = static_cast<std::uint32_t>(i + 1);
+    }
+
+    // Each distinct table once, ladders refer to it by index
+    std::vector<std::uint32_t> ladders(ladder.idLimit(), NO_TABLE);
+    std::vector<secdb_image_table_t> tables;
+    std::vector<secdb_image_band_t> bands;
+    std::unordered_map<const TickTable*, std::uint32_t> table_loc;
+    for (ladder_id_t id = 0; id < ladders.size(); ++id) {
+        const TickTable* tt = ladder.find(id);
+        if (tt == nullptr) {
+            continue;
+        }
+        auto found = table_loc.find(tt);
+        if (found == table_loc.end()) {
+            tables.push_back(secdb_image_table_t{ static_cast<std::uint32_t>(bands.size()),
+                                                  static_cast<std::uint32_t>(tt->rows().size()) });
+            for (const auto& ttr : tt->rows()) {
+                bands.push_back(secdb_image_band_t{ ttr.lower, ttr.upper, ttr.tick_size, ttr.have_upper });
+            }
+            found = table_loc.emplace(tt, static_cast<std::uint32_t>(tables.size() - 1)).first;
+        }
+        ladders[id] = found->second;
+    }
+
+    secdb_image_header_t header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SECDB_IMAGE_MAGIC, sizeof(SECDB_IMAGE_MAGIC));
+    header.version = SECDB_IMAGE_VERSION;
+    header.header_size = sizeof(header);
+    std::string image(sizeof(header), '\0');
+    header.records_offset = appendSection(image, records.data(), records.size());
+    header.record_count = records.size();
+    header.strings_offset = appendSection(image, strings.data(), strings.size());
+    header.strings_size = strings.size();
+    header.index_offset = appendSection(image, index.data(), index.size());
+    header.index_size = index.size();
+    header.ladders_offset = appendSection(image, ladders.data(), ladders.size());
+    header.ladder_count = ladders.size();
+    header.tables_offset = appendSection(image, tables.data(), tables.size());
+    header.table_count = tables.size();
+    header.bands_offset = appendSection(image, bands.data(), bands.size());
+    header.band_count = bands.size();
+    header.file_size = image.size();
+    header.checksum = fnv1a(image.data() + sizeof(header), image.data() + image.size());
+    std::memcpy(&image[0], &header, sizeof(header));
+
+    const std::string tmp = filename + ".tmp";
+    {
+        std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+        os.write(image.data(), image.size());
+        if (!os) {
+            throw SecurityError("Cannot write " + tmp);
+        }
+    }
+    if (std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw SecurityError("Cannot rename " + tmp + " to " + filename);
+    }
+}
+
+void an::TickLadder::loadImage(const SecurityImage& image) {
+    const std::uint32_t* ladders = image.ladders();
+    for (std::size_t id = 0; id < image.header().ladder_count; ++id) {
+        if (ladders[id] == SecurityImage::NO_TABLE) {
+            continue;
+        }
+        if (ladders[id] >= image.header().table_count) {
+            throw SecurityError("Bad tick table in security master image");
+        }
+        const secdb_image_table_t& table = image.tables()[ladders[id]];
+        if (table.first_band + static_cast<std::uint64_t>(table.bands) > image.header().band_count) {
+            throw SecurityError("Bad tick band in security master image");
+        }
+        TickTable tt;
+        for (std::uint32_t b = table.first_band; b < table.first_band + table.bands; ++b) {
+            const secdb_image_band_t& band = image.bands()[b];
+            tt.add(band.have_upper ? tick_table_row_t(band.lower, band.upper, band.tick_size)
+                                   : tick_table_row_t(band.lower, band.tick_size));
+        }
+        addTickLadder(static_cast<ladder_id_t>(id), tt);
+    }
+}
+
+// Securities are copied out of the image but found through its index, no maps to build
+void an::SecurityDatabase::loadImage(const std::string& filename, bool verify) {
+    auto image = std::make_shared<const SecurityImage>(filename, verify);
+    const secdb_image_header_t& header = image->header();
+    const secdb_image_record_t* recs = image->records();
+    std::vector<security_record_t> securities;
+    securities.reserve(header.record_count);
+    for (std::size_t i = 0; i < header.record_count; ++i) {
+        const secdb_image_record_t& rec = recs[i];
+        if ((rec.exchange >= header.strings_size) || (rec.symbol >= header.strings_size)) {
+            throw SecurityError("Bad string in security master image " + filename);
+        }
+        security_record_t sr;
+        sr.id = rec.id;
+        sr.exchange = image->string(rec.exchange);
+        sr.symbol = image->string(rec.symbol);
+        sr.closing_price = rec.closing_price;
+        sr.outstanding_shares = rec.outstanding_shares;
+        sr.born = rec.born;
+        sr.has_died = rec.has_died != 0;
+        sr.died = rec.died;
+        sr.tradeable = rec.tradeable != 0;
+        sr.ladder_id = rec.ladder_id;
+        securities.push_back(sr);
+    }
+    tick_ladder_.loadImage(*image);
+    securities_.swap(securities);
+    security_id_loc_.clear();
+    symbol_loc_.clear();
+    image_ = image;
+}
@@ -2,7 +2,12 @@
 #define AN_SECURITY_MASTER_HPP
 
 #include "types.hpp"
+#include <algorithm>
 #include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace an {
 
@@ -12,6 +17,49 @@ class SecurityError : public runtime_error {
         SecurityError(const std::string& msg) : runtime_error(msg) {}
 };
 
+// Read only view of a whole file
+class MappedFile {
+    public:
+        explicit MappedFile(const std::string& filename) : data_(nullptr), size_(0) {
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw SecurityError("Cannot open " + filename);
+            }
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw SecurityError("Cannot stat " + filename);
+            }
+            size_ = static_cast<std::size_t>(st.st_size);
+            if (size_ != 0) {
+                void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    ::close(fd);
+                    throw SecurityError("Cannot map " + filename);
+                }
+                data_ = static_cast<const char*>(p);
+                (void) ::madvise(p, size_, MADV_SEQUENTIAL);
+            }
+            ::close(fd);
+        }
+        ~MappedFile() {
+            if (data_ != nullptr) {
+                ::munmap(const_cast<char*>(data_), size_);
+            }
+        }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* begin() const { return data_; }
+        const char* end() const { return data_ + size_; }
+        std::size_t size() const { return size_; }
+    private:
+        const char* data_;
+        std::size_t size_;
+};
+
+class SecurityImage;
+
 // ********************** TICK TABLE ***********************
 
 struct tick_table_row_t {
@@ -40,6 +88,10 @@ struct tick_table_row_t {
             throw SecurityError("Increment greater than lower-upper");
         }
     }
+    bool operator==(const tick_table_row_t& rhs) const {
+        return (lower == rhs.lower) && (upper == rhs.upper) && (have_upper == rhs.have_upper) &&
+               (tick_size == rhs.tick_size);
+    }
     price_t lower; // [
     price_t upper; // ) less than
     bool have_upper;
@@ -68,59 +120,114 @@ class TickTable {
                 }
             }
             rows_.push_back(tr);
+            compile();
         }
 
-        void reset() { rows_.clear(); }
+        void reset() { rows_.clear(); compile(); }
+
+        const std::vector<tick_table_row_t>& rows() const {
+            return rows_;
+        }
+        bool operator==(const TickTable& rhs) const {
+            return rows_ == rhs.rows_;
+        }
 
         bool validatePrice(price_t price) const {
             return validatePriceAndRound(price, false);
         }
 
-        bool validatePriceAndRound(price_t& price, bool round=true, price_t epsilon = an::PRICE_EPSILON ) const {
+        // Price must be a whole number of ticks in its band. The price is converted
+        // once to PRICE_EPSILON units, rounding to the nearest unit is the only
+        // tolerance, after that the band search and tick check are integer.
+        bool validatePriceAndRound(price_t& price, bool round=true) const {
             assert(price >= 0 && "validatePrice negative not allowed");
-            for (const auto& ttr : rows_) {
-                if ( ( ttr.have_upper && (price >= ttr.lower) && (price < ttr.upper)) ||
-                     (!ttr.have_upper && (price >= ttr.lower) ) ) {
-                    // Found row, now check ladder
-                    const price_t div = price / ttr.tick_size;
-                    //std::cout << "price=" << price << " inc=" << ttr.tick_size << " div=" << div << " floor=" << std::floor(div) 
-                    //          << " minus=" << std::min(div - std::floor(div),std::abs(div - std::ceil(div)))
-                    //          << " epilson=" << EPSILON 
-                    //          << " res=" << (std::min(div - std::floor(div),std::abs(div - std::ceil(div))) < EPSILON) << std::endl;
-                    bool res = std::min(div - std::floor(div),std::abs(div - std::ceil(div))) < epsilon;
-                    if (res && round) {
-                        price = roundToAny(price,ttr.tick_size);
-                    }
-                    return res;
-                //} else {
-                //    std::cout << "SKIPPED - " << ttr.to_string() << std::endl;
-                }
+            const price_t scaled = price * UNITS;
+            if (!(scaled < MAX_UNITS)) {
+                return false; // Too large (or NaN) for units
+            }
+            const std::int64_t units = std::llround(scaled);
+            const std::size_t b = band(units);
+            if ((b == npos) || (units >= upper_[b])) {
+                return false;
+            }
+            bool res = (units % tick_units_[b]) == 0;
+            if (res && round) {
+                price = static_cast<price_t>(units) / UNITS;
             }
-            return false;
+            return res;
         }
     private:
+        static const std::size_t npos = std::numeric_limits<std::size_t>::max();
+        static constexpr price_t UNITS = std::pow(10, an::MAX_PRICE_PRECISION);
+        static constexpr price_t MAX_UNITS = 9e18; // Below std::int64_t max
+
+        static std::int64_t toUnits(price_t price) {
+            return (price * UNITS < MAX_UNITS) ? std::llround(price * UNITS) : std::numeric_limits<std::int64_t>::max();
+        }
+        // Branchless binary search, last band whose lower <= units
+        std::size_t band(std::int64_t units) const {
+            std::size_t n = lower_.size();
+            if ((n == 0) || (units < lower_[0])) {
+                return npos;
+            }
+            const std::int64_t* base = lower_.data();
+            while (n > 1) {
+                const std::size_t half = n / 2;
+                base = (base[half] <= units) ? base + half : base;
+                n -= half;
+            }
+            return base - lower_.data();
+        }
+        // Flatten rows into integer arrays searched per order
+        void compile() {
+            lower_.clear(); upper_.clear(); tick_units_.clear();
+            for (const auto& ttr : rows_) {
+                lower_.push_back(toUnits(ttr.lower));
+                upper_.push_back(ttr.have_upper ? toUnits(ttr.upper) : std::numeric_limits<std::int64_t>::max());
+                tick_units_.push_back(std::max<std::int64_t>(1, toUnits(ttr.tick_size)));
+            }
+        }
+
         std::vector<tick_table_row_t> rows_;
+        std::vector<std::int64_t>     lower_;      // Band [lower, upper) in units
+        std::vector<std::int64_t>     upper_;
+        std::vector<std::int64_t>     tick_units_;
 };
 
 
 // https://www.euronext.com/fr/it-documentation/market-data
 // Euronext cash tick sizes PROD, https://www.euronext.com/sites/www.euronext.com/files/ftp/NXT_ticksize.txt
+// Identical ladders share one immutable TickTable, found by ladder id through a
+// dense array. Books keep pointers to the tables so the ladder is not copyable.
 class TickLadder {
     public:
-        TickLadder() {}
+        static const ladder_id_t MAX_LADDER_ID = 0xFFFF;
+
+        TickLadder() : tables_(), by_id_() {}
+        TickLadder(const TickLadder&) = delete;
+        TickLadder& operator=(const TickLadder&) = delete;
+
         void addTickLadder(const ladder_id_t id, const TickTable& ladder);
         void loadData(const std::string& filename);
-        TickTable* find(ladder_id_t ladder_id) {
-            TickTable* ttPtr = nullptr;
-            auto search = ladders_.find(ladder_id);
-            if (search != ladders_.end()) {
-                ttPtr = &(search->second);
-            }
-            return ttPtr;
+        void loadImage(const SecurityImage& image);
+        const TickTable* find(ladder_id_t ladder_id) const {
+            return (ladder_id < by_id_.size()) ? by_id_[ladder_id] : nullptr;
+        }
+        // Ladder ids are below this
+        std::size_t idLimit() const {
+            return by_id_.size();
+        }
+        std::size_t ladders() const {
+            return std::count_if(by_id_.begin(), by_id_.end(), [](const TickTable* tt) { return tt != nullptr; });
+        }
+        // Distinct tables
+        std::size_t tables() const {
+            return tables_.size();
         }
         std::string to_string() const;
     private:
-        std::map<ladder_id_t, TickTable> ladders_;
+        std::deque<TickTable>           tables_; // Stable addresses
+        std::vector<const TickTable*>   by_id_;  // Null if no ladder
 };
 
 // **************** SECURITY DATABSE ************************
@@ -140,24 +247,139 @@ struct security_record_t {
     std::string to_string() const;
 };
 
+// ************** SECURITY MASTER IMAGE *********************
+// Precompiled security database and tick ladders, mapped read only so processes
+// on a host share the page cache. Host byte order, sections 8 byte aligned:
+//   header | records | strings | symbol index | ladders | tables | bands
+// Strings are interned and null terminated, records refer to them by offset.
+// The symbol index is open addressing (PString::hash_c_string), a slot holds
+// record index + 1 or 0 when empty. Ladders map ladder id to table or NO_TABLE.
+
+const char SECDB_IMAGE_MAGIC[8] = { 'A', 'N', 'S', 'E', 'C', 'D', 'B', '\0' };
+const std::uint32_t SECDB_IMAGE_VERSION = 1;
+
+struct secdb_image_header_t {
+    char            magic[8];
+    std::uint32_t   version;
+    std::uint32_t   header_size;
+    std::uint64_t   checksum; // FNV-1a of everything after the header
+    std::uint64_t   file_size;
+    std::uint64_t   records_offset;
+    std::uint64_t   record_count;
+    std::uint64_t   strings_offset;
+    std::uint64_t   strings_size;
+    std::uint64_t   index_offset;
+    std::uint64_t   index_size; // Slots, power of two
+    std::uint64_t   ladders_offset;
+    std::uint64_t   ladder_count;
+    std::uint64_t   tables_offset;
+    std::uint64_t   table_count;
+    std::uint64_t   bands_offset;
+    std::uint64_t   band_count;
+};
+
+struct secdb_image_record_t {
+    std::uint32_t   id;
+    std::uint32_t   ladder_id;
+    std::uint32_t   exchange; // String offset
+    std::uint32_t   symbol;   // String offset
+    double          closing_price;
+    std::int64_t    outstanding_shares;
+    std::int64_t    born;
+    std::int64_t    died;
+    std::uint8_t    has_died;
+    std::uint8_t    tradeable;
+    std::uint8_t    pad[6];
+};
+
+struct secdb_image_table_t {
+    std::uint32_t   first_band;
+    std::uint32_t   bands;
+};
+
+struct secdb_image_band_t {
+    double          lower;
+    double          upper;
+    double          tick_size;
+    std::uint64_t   have_upper;
+};
+
+static_assert(sizeof(secdb_image_header_t) == 128, "secdb_image_header_t layout");
+static_assert(sizeof(secdb_image_record_t) == 56, "secdb_image_record_t layout");
+static_assert(sizeof(secdb_image_band_t) == 32, "secdb_image_band_t layout");
+
+class SecurityDatabase;
+
+class SecurityImage {
+    public:
+        static const std::size_t npos = std::numeric_limits<std::size_t>::max();
+        static const std::uint32_t NO_TABLE = std::numeric_limits<std::uint32_t>::max();
+
+        // Throws SecurityError if the file is not a valid image of this version
+        explicit SecurityImage(const std::string& filename, bool verify = true);
+        SecurityImage(const SecurityImage&) = delete;
+        SecurityImage& operator=(const SecurityImage&) = delete;
+
+        static void write(const std::string& filename, const SecurityDatabase& secdb, const TickLadder& ladder);
+
+        const secdb_image_header_t& header() const { return *header_; }
+        const secdb_image_record_t* records() const { return section<secdb_image_record_t>(header_->records_offset); }
+        const char* string(std::uint32_t offset) const { return section<char>(header_->strings_offset) + offset; }
+        const std::uint32_t* ladders() const { return section<std::uint32_t>(header_->ladders_offset); }
+        const secdb_image_table_t* tables() const { return section<secdb_image_table_t>(header_->tables_offset); }
+        const secdb_image_band_t* bands() const { return section<secdb_image_band_t>(header_->bands_offset); }
+
+        // Live record for symbol on exchange, npos if none
+        std::size_t find(const symbol_t& symbol, const location_t& exchange) const {
+            const std::uint32_t* index = section<std::uint32_t>(header_->index_offset);
+            const secdb_image_record_t* recs = records();
+            const std::size_t mask = header_->index_size - 1;
+            for (std::size_t slot = PString::hash_c_string(symbol.data(), symbol.size()) & mask; index[slot] != 0;
+                 slot = (slot + 1) & mask) {
+                const secdb_image_record_t& rec = recs[index[slot] - 1];
+                if (!rec.has_died && (symbol == string(rec.symbol)) && (exchange == string(rec.exchange))) {
+                    return index[slot] - 1;
+                }
+            }
+            return npos;
+        }
+    private:
+        template <typename T>
+        const T* section(std::uint64_t offset) const {
+            return reinterpret_cast<const T*>(file_.begin() + offset);
+        }
+
+        MappedFile                      file_;
+        const secdb_image_header_t*     header_;
+};
+
 class SecurityDatabase {
     public:
         static const std::size_t npos = std::numeric_limits<std::size_t>::max();
 
         SecurityDatabase(location_t exchange, TickLadder& tickLadder) 
-            : exchange_(exchange), tick_ladder_(tickLadder) {}
-        void loadData(const std::string& filename);
+            : exchange_(exchange), tick_ladder_(tickLadder), image_() {}
+        // Appends the rows of a CSV file, threads > 1 parses chunks in parallel
+        void loadData(const std::string& filename, unsigned threads = 1);
+        // Replace securities with a compiled image, its tick ladders are added to the TickLadder
+        void loadImage(const std::string& filename, bool verify = true);
+        void saveImage(const std::string& filename) const {
+            SecurityImage::write(filename, *this, tick_ladder_);
+        }
         const std::vector<security_record_t>& securities() const {
             return securities_;
         }
         std::size_t find(const symbol_t& symbol) const {
+            if (image_) {
+                return image_->find(symbol, exchange_);
+            }
             auto search = symbol_loc_.find(symbol);
             if (search != symbol_loc_.end()) {
                 return search->second;
             }
             return npos;
         }
-        TickTable* tickTable(std::size_t symbol_idx) {
+        const TickTable* tickTable(std::size_t symbol_idx) const {
             assert(symbol_idx < securities_.size() && "symbol_idx out of range");
             return tick_ladder_.find(securities_[symbol_idx].ladder_id);
         }
@@ -168,6 +390,25 @@ class SecurityDatabase {
         std::unordered_map<security_id_t, std::size_t> security_id_loc_;
         std::unordered_map<symbol_t, std::size_t> symbol_loc_;
         TickLadder& tick_ladder_;
+        std::shared_ptr<const SecurityImage> image_; // Symbol index when loaded from an image
+};
+
+// One version of the security master, the database and the tick ladders it refers
+// to. Built and loaded on any thread, then treated as immutable once handed to
+// MatchingEngine::reload().
+class SecurityMaster {
+    public:
+        explicit SecurityMaster(location_t exchange) : tick_ladder_(), secdb_(exchange, tick_ladder_) {}
+        SecurityMaster(const SecurityMaster&) = delete;
+        SecurityMaster& operator=(const SecurityMaster&) = delete;
+
+        TickLadder& tickLadder() { return tick_ladder_; }
+        const TickLadder& tickLadder() const { return tick_ladder_; }
+        SecurityDatabase& secdb() { return secdb_; }
+        const SecurityDatabase& secdb() const { return secdb_; }
+    private:
+        TickLadder       tick_ladder_;
+        SecurityDatabase secdb_;
 };
 
 
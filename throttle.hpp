@@ -0,0 +1,76 @@
+#ifndef AN_THROTTLE_HPP
+#define AN_THROTTLE_HPP
+
+#include "types.hpp"
+#include <algorithm>
+#include <chrono>
+
+namespace an {
+
+// What happens to an order over the rate
+enum throttle_policy_t { THROTTLE_REJECT, THROTTLE_QUEUE, THROTTLE_DISCONNECT };
+
+// Inbound order rate limits, a rate of zero is no limit
+struct throttle_t {
+    throttle_t() : session_rate(0), session_burst(0), origin_rate(0), origin_burst(0),
+                   policy(THROTTLE_REJECT), max_queued(1000) { }
+    std::uint32_t       session_rate;  // Orders per second per connection
+    std::uint32_t       session_burst; // Orders allowed back to back
+    std::uint32_t       origin_rate;   // Orders per second per client name, across reconnects
+    std::uint32_t       origin_burst;
+    throttle_policy_t   policy;
+    std::size_t         max_queued;    // THROTTLE_QUEUE, held orders per connection before rejecting
+};
+
+struct throttle_stats_t {
+    throttle_stats_t() : passed(0), rejected(0), queued(0), disconnects(0) { }
+    counter_t       passed;      // Orders within the rate
+    counter_t       rejected;
+    counter_t       queued;      // Held until the bucket refilled
+    counter_t       disconnects;
+};
+
+// Integer token bucket. Credit is kept in token nanoseconds, each nanosecond
+// adds rate and a token costs a second's worth, so a refill is a multiply and
+// a min. The caller reads the clock once and refills once per batch of frames.
+class TokenBucket {
+    public:
+        typedef std::chrono::steady_clock::time_point time_point_t;
+
+        TokenBucket(std::uint32_t rate = 0, std::uint32_t burst = 0)
+            : rate_(rate), capacity_(std::max<std::int64_t>(burst, 1) * TOKEN),
+              full_after_(rate != 0 ? capacity_ / rate : 0), credit_(capacity_), last_() { }
+
+        bool enabled() const { return rate_ != 0; }
+        void refill(time_point_t now) {
+            const std::int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count();
+            last_ = now;
+            if (elapsed <= 0) {
+                return;
+            }
+            // Clamped first so a long idle period can't overflow
+            credit_ = (elapsed >= full_after_) ? capacity_ : std::min(capacity_, credit_ + elapsed * rate_);
+        }
+        bool ready() const { return !enabled() || (credit_ >= TOKEN); }
+        void take() {
+            if (enabled()) {
+                credit_ -= TOKEN;
+            }
+        }
+        // Until the next token, from the last refill
+        std::chrono::nanoseconds wait() const {
+            return std::chrono::nanoseconds(ready() ? 0 : (TOKEN - credit_ + rate_ - 1) / rate_);
+        }
+    private:
+        static constexpr std::int64_t TOKEN = 1000000000; // Nanoseconds in a second
+
+        std::int64_t    rate_;
+        std::int64_t    capacity_;
+        std::int64_t    full_after_; // Nanoseconds to refill from empty
+        std::int64_t    credit_;
+        time_point_t    last_;
+};
+
+} // an - namespace
+
+#endif
@@ -1,22 +1,30 @@
 #include "transport.hpp"
-#include <iostream>
+#include "logger.hpp"
+#include <cstring>
+#include <algorithm>
 
 template<typename ConnectionHandler>
-void an::asio_generic_server<ConnectionHandler>::ClientBroadcast::join(shared_handler_t participant, transport_msg_t client_name) {
+bool an::asio_generic_server<ConnectionHandler>::ClientBroadcast::join(shared_handler_t participant, transport_msg_t client_name) {
+    std::lock_guard<std::mutex> lock(mutex_);
     participants_.insert(participant);
     if (client_name != "") {
-        conn_name_.emplace(client_name, participant);
+        auto found = conn_name_.emplace(client_name, participant);
+        if (!found.second && (found.first->second != participant)) {
+            return false;
+        }
     }
     for (const transport_msg_t& msg: recent_msgs_) {
-        std::cout << "ClientBroadcast::Join " << msg << " " << participants_.size() << std::endl;
+        AN_DEBUG("ClientBroadcast::Join {} {}", msg, participants_.size());
         participant->send(msg);
     }
+    return true;
 }
 
 template<typename ConnectionHandler>
 void an::asio_generic_server<ConnectionHandler>::ClientBroadcast::leave(shared_handler_t participant) {
+    std::lock_guard<std::mutex> lock(mutex_);
     participants_.erase(participant);
-    for (auto it = conn_name_.begin; it != conn_name_.end(); ) {
+    for (auto it = conn_name_.begin(); it != conn_name_.end(); ) {
         if (it->second == participant) {
             it = conn_name_.erase(it);
         } else {
@@ -26,8 +34,21 @@ void an::asio_generic_server<ConnectionHandler>::ClientBroadcast::leave(shared_h
 }
 
 
+template<typename ConnectionHandler>
+std::shared_ptr<an::TokenBucket>
+an::asio_generic_server<ConnectionHandler>::ClientBroadcast::originBucket(const location_t& client_name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<TokenBucket>& bucket = origin_bucket_[client_name];
+    if (!bucket) {
+        bucket = std::make_shared<TokenBucket>(throttle_.origin_rate, throttle_.origin_burst);
+    }
+    return bucket;
+}
+
+
 template<typename ConnectionHandler>
 void an::asio_generic_server<ConnectionHandler>::ClientBroadcast::deliver(const transport_msg_t& msg, const transport_msg_t& client_name) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (client_name == "") {
         recent_msgs_.push_back(msg);
         while (recent_msgs_.size() > max_recent_msgs_) {
@@ -35,13 +56,12 @@ void an::asio_generic_server<ConnectionHandler>::ClientBroadcast::deliver(const
         }
         for (auto participant: participants_) {
             participant->send(msg);
-            std::cout << "ClientBroadcast::deliver " << msg << participants_.size() <<  std::endl;
+            AN_DEBUG("ClientBroadcast::deliver {} {}", msg, participants_.size());
         }
     } else {
         auto it = conn_name_.find(client_name);
         if (it != conn_name_.end()) {
-            std::cout << "ClientBroadcast::deliver to=" << it->first << " " << msg
-                      << participants_.size() <<  std::endl;
+            AN_DEBUG("ClientBroadcast::deliver to={} {} {}", it->first, msg, participants_.size());
             it->second->send(msg);
         }
     }
@@ -49,10 +69,8 @@ void an::asio_generic_server<ConnectionHandler>::ClientBroadcast::deliver(const
 
 
 void an::client_handler::read_packet() {
-    boost::asio::async_read_until(
-        socket_,    // From
-        in_packet_, // Destination (stream buffer)
-        '\n',       // Terminator
+    socket_.async_read_some(
+        boost::asio::buffer(in_packet_.writePtr(), in_packet_.writeSpace()), // Destination (frame buffer)
         // Completion handler, me is a shared pointer
         [me=shared_from_this()]( boost::system::error_code const& ec, std::size_t bytes_xfer) {
             me->read_packet_done(ec, bytes_xfer);
@@ -63,43 +81,229 @@ void an::client_handler::read_packet() {
 
 void an::client_handler::read_packet_done( boost::system::error_code const& error, std::size_t bytes_transferred ) {
     if (error) {
-        // On error fall out (don't re-queue read).
-        std::cout << "ERROR client_handler::read_packet_done" << std::endl;
+        // On error fall out (don't re-queue read)
+        end_session(error.message());
         return; // bail
     }
 
-    std::istream stream(&in_packet_); // stream to string
-    std::string packet_string;
-    std::getline(stream >> std::ws, packet_string); // Read whole line including spaces
-    //stream >> packet_string;
+    in_packet_.commit(bytes_transferred);
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now(); // Once per batch
+    session_bucket_.refill(now);
+    if (origin_bucket_) {
+        origin_bucket_->refill(now);
+    }
+    std::size_t frames = in_packet_.parse( [this](PString frame) { handle_frame(frame); } );
+    boost::system::error_code ec; // Peer may already have gone, the next read reports it
+    AN_DEBUG("port={} bytes={} frames={}", socket_.remote_endpoint(ec).port(), bytes_transferred, frames);
+    if (in_packet_.overflow()) {
+        AN_ERROR("client_handler::read_packet_done frame too long (>{})", MAX_FRAME_SIZE);
+        in_packet_.reset(); // Drop the oversized frame, up to its terminator
+    }
+    end_batch();
+    if (hang_up_) {
+        end_session("order rate over limit");
+    } else if (!held_.empty()) {
+        wait_for_tokens(); // No more reads until the held orders are through
+    } else {
+        read_packet(); // Queue another read
+    }
+}
+
+
+// The session is gone, its cancels are queued before the name is free for a
+// reconnect to reuse
+void an::client_handler::end_session(const std::string& why) {
+    AN_ERROR("client_handler {} name={}", why, name_);
+    broadcast_.disconnected(name_);
+    broadcast_.leave(shared_from_this());
+    boost::system::error_code ec;
+    socket_.close(ec);
+}
+
+
+// True if the throttle took the order (rejected, held or hanging up)
+bool an::client_handler::over_rate(PString frame) {
+    if (hang_up_) {
+        return true; // The rest of the batch goes with the session
+    }
+    if (held_.empty() && within_rate()) {
+        ++counts_.passed;
+        return false;
+    }
+    const throttle_t& throttle = broadcast_.throttle();
+    if ((throttle.policy == THROTTLE_QUEUE) && (held_.size() < throttle.max_queued)) {
+        held_.push_back(frame.to_string());
+        ++counts_.queued;
+    } else if (throttle.policy == THROTTLE_DISCONNECT) {
+        hang_up_ = true;
+        ++counts_.disconnects;
+    } else {
+        ++counts_.rejected;
+        reply(an::REJECT, "throttled");
+    }
+    return true;
+}
+
+
+// Both buckets or neither
+bool an::client_handler::within_rate() {
+    TokenBucket* origin = origin_bucket_.get();
+    if (!session_bucket_.ready() || ((origin != nullptr) && !origin->ready())) {
+        return false;
+    }
+    session_bucket_.take();
+    if (origin != nullptr) {
+        origin->take();
+    }
+    return true;
+}
+
+
+void an::client_handler::wait_for_tokens() {
+    std::chrono::nanoseconds wait = session_bucket_.wait();
+    if (origin_bucket_) {
+        wait = std::max(wait, origin_bucket_->wait());
+    }
+    held_timer_.expires_after(wait);
+    held_timer_.async_wait(
+        [me=shared_from_this()](boost::system::error_code const& ec) {
+            if (!ec) {
+                me->release_held();
+            }
+        }
+    );
+}
+
+
+void an::client_handler::release_held() {
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    session_bucket_.refill(now);
+    if (origin_bucket_) {
+        origin_bucket_->refill(now);
+    }
+    while (!held_.empty() && within_rate()) {
+        std::string frame(std::move(held_.front()));
+        held_.pop_front();
+        ++counts_.passed;
+        handle_order(PString(frame.data(), static_cast<std::int32_t>(frame.size())));
+    }
+    end_batch();
+    if (held_.empty()) {
+        read_packet();
+    } else {
+        wait_for_tokens();
+    }
+}
+
 
-    std::cout << "port=" << socket_.remote_endpoint() << " bytes=" << bytes_transferred << " GOT: "<< packet_string << std::endl; //TODO
-    // do something with it
-    if (packet_string == "quit") {
+void an::client_handler::end_batch() {
+    if (counts_.passed + counts_.rejected + counts_.queued + counts_.disconnects != 0) {
+        broadcast_.throttled(counts_);
+        counts_ = throttle_stats_t();
+    }
+}
+
+
+void an::client_handler::named(const location_t& name) {
+    name_ = name;
+    risk_slot_ = broadcast_.riskSlot(name);
+    if (broadcast_.throttle().origin_rate != 0) {
+        origin_bucket_ = broadcast_.originBucket(name);
+        origin_bucket_->refill(std::chrono::steady_clock::now());
+    }
+}
+
+
+void an::client_handler::handle_frame(PString frame) {
+    static const PString QUIT("quit");
+    static const PString CLIENT("client.");
+    static const PString SEND("send.");
+    static const PString LOGIN("type=LOGIN:");
+    static const PString TYPE("type=");
+    auto startsWith = [&frame](const PString& prefix) {
+        return (frame.length_ >= prefix.length_) && (std::memcmp(frame.str_, prefix.str_, prefix.length_) == 0);
+    };
+    auto rest = [&frame](const PString& prefix) {
+        return PString(frame.str_ + prefix.length_, frame.length_ - prefix.length_);
+    };
+
+    if (frame == QUIT) {
         send("QUIT"); send("\n"); //TODO - remove echo
-        std::cout << "QUIT!" << std::endl; //TODO
-    } else if (packet_string.find("client") == 0) { // client.Client1
-        packet_string.erase(0,6); // .Client1
-        if (!packet_string.empty() && packet_string[0] == '.') { // .Client1
-            packet_string.erase(0,1); // Client1
-            broadcast_.join(shared_from_this(),packet_string);
+        AN_INFO("client_handler QUIT name={}", name_); //TODO
+    } else if (startsWith(CLIENT)) { // client.Client1
+        PString name = rest(CLIENT); // Client1
+        if ((name.length_ != 0) && name_.empty() && broadcast_.join(shared_from_this(),name.to_string())) {
+            named(name.to_string());
+        }
+    } else if (startsWith(SEND)) { // send.Client1
+        PString name = rest(SEND); // Client1
+        if (name.length_ != 0) {
+            broadcast_.deliver("testing\n",name.to_string());
         }
-    } else if (packet_string.find("send") == 0) { // send.Client1
-        packet_string.erase(0,4); // .Client1
-        if (!packet_string.empty() && packet_string[0] == '.') { // .Client1
-            packet_string.erase(0,1); // Client1
-            broadcast_.deliver("testing\n",packet_string);
+    } else if (startsWith(LOGIN)) { // type=LOGIN:origin=Client1:destination=ME
+        handle_login(frame);
+    } else if (startsWith(TYPE)) { // type=LIMIT:id=...
+        if (!over_rate(frame)) {
+            handle_order(frame);
         }
     } else {
-        send(packet_string); send("\n"); //TODO - remove echo
+        send(frame.to_string()); send("\n"); //TODO - remove echo
     }
-    read_packet(); // Queue another read
+}
+
+
+void an::client_handler::handle_login(PString frame) {
+    try {
+        std::unique_ptr<Login> login(author_.makeLogin(frame));
+        if (!name_.empty()) {
+            reply(an::REJECT, "already logged in");
+        } else if (!broadcast_.join(shared_from_this(), login->origin())) {
+            reply(an::REJECT, "name in use");
+        } else {
+            named(login->origin());
+            reply(an::ACK, "login success");
+        }
+    } catch (const OrderError& e) {
+        reply(an::REJECT, e.what());
+    }
+}
+
+
+void an::client_handler::handle_order(PString frame) {
+    try {
+        std::unique_ptr<Order> order(author_.makeOrder(frame));
+        if (!broadcast_.haveReceiver()) {
+            send(order->to_string()); send("\n"); //TODO - remove echo
+            return;
+        }
+        // First order names an anonymous session, so replies can be routed back
+        if (name_.empty() && broadcast_.join(shared_from_this(), order->origin())) {
+            named(order->origin());
+        }
+        if (order->origin() != name_) {
+            reply(an::REJECT, "origin mismatch");
+            return;
+        }
+        order->setRiskSlot(risk_slot_);
+        broadcast_.receive(std::move(order));
+    } catch (const OrderError& e) {
+        reply(an::REJECT, e.what());
+    }
+}
+
+
+// Reply directly from the transport, the order never reaches the engine
+void an::client_handler::reply(response_t r, const text_t& text) {
+    text_t clean(text);
+    std::replace_if(clean.begin(), clean.end(), [](char c) { return c==':' || c=='=' || c=='\n'; }, ' ');
+    Response rep(ME, name_, r, clean);
+    send(rep.to_string() + "\n");
 }
 
 
 void an::client_handler::start_packet_send() {
     send_packet_queue_.front() += "\0";
-    std::cout << "client_handler::start_packet_send " << send_packet_queue_.front() << std::endl;
+    AN_DEBUG("client_handler::start_packet_send {}", send_packet_queue_.front());
     boost::asio::async_write( socket_,
         boost::asio::buffer(send_packet_queue_.front()), // Pass location in deque
             write_strand_.wrap(
@@ -118,8 +322,7 @@ void an::client_handler::packet_send_done(boost::system::error_code const& error
             start_packet_send();
         }
     } else {
-        std::cout << "ERROR client_handler::packet_send_done "
-                  << boost::system::system_error(error).what() << std::endl;
+        AN_ERROR("client_handler::packet_send_done {}", boost::system::system_error(error).what());
     }
 }
 
@@ -2,8 +2,15 @@
 #define AN_TRANSPORT_HPP
 
 #include "types.hpp"
+#include "order.hpp"
+#include "framing.hpp"
+#include "throttle.hpp"
 #include <boost/system/error_code.hpp>
 #include <boost/asio.hpp>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 // See for changes to interface in 1.66
 // http://www.boost.org/doc/libs/1_66_0/doc/html/boost_asio/net_ts.html
@@ -21,18 +28,75 @@ class asio_generic_server {
     public:
         // *** BROADCAST to all Clients ***
         typedef std::deque<transport_msg_t> client_message_queue;
+        // Orders parsed by a connection are handed on (e.g. queued to the engine thread)
+        typedef std::function<void(std::unique_ptr<Order>)> receiver_t;
+        // A named session was lost, called from its io thread before the name is released
+        typedef std::function<void(const location_t& client_name)> disconnect_t;
+        // Pre-trade risk slot of a client, resolved once when a session is named
+        typedef std::function<std::uint32_t(const location_t& client_name)> risk_slot_t;
         class ClientBroadcast {
             public:
-                ClientBroadcast(std::size_t max_recent_msgs = 100) : max_recent_msgs_(max_recent_msgs) {
+                ClientBroadcast(std::size_t max_recent_msgs = 100)
+                    : passed_(0), rejected_(0), queued_(0), throttle_disconnects_(0), max_recent_msgs_(max_recent_msgs) {
                 }
                 ~ClientBroadcast() { }
 
-                void join(shared_handler_t participant, transport_msg_t client_name = "");
+                // Returns false if client_name is already taken by another connection
+                bool join(shared_handler_t participant, transport_msg_t client_name = "");
 
                 void leave(shared_handler_t participant);
 
+                // Called from the io threads and the engine thread
                 void deliver(const transport_msg_t& msg, const transport_msg_t& client_name = "");
+
+                void receiver(receiver_t r) { receiver_ = r; }
+                bool haveReceiver() const { return static_cast<bool>(receiver_); }
+                void receive(std::unique_ptr<Order> o) { receiver_(std::move(o)); }
+
+                void riskSlots(risk_slot_t r) { risk_slot_ = r; }
+                std::uint32_t riskSlot(const location_t& client_name) const {
+                    return risk_slot_ ? risk_slot_(client_name) : risk_account_t::NO_SLOT;
+                }
+
+                void onDisconnect(disconnect_t d) { disconnect_ = d; }
+                void disconnected(const location_t& client_name) {
+                    if (disconnect_ && !client_name.empty()) {
+                        disconnect_(client_name);
+                    }
+                }
+
+                // Set before connections are accepted
+                void throttle(const throttle_t& t) { throttle_ = t; }
+                const throttle_t& throttle() const { return throttle_; }
+                // A client name keeps its bucket across reconnects. Names are unique
+                // so only the one session holding it uses the bucket.
+                std::shared_ptr<TokenBucket> originBucket(const location_t& client_name);
+                // Sessions add their counts once per batch
+                void throttled(const throttle_stats_t& counts) {
+                    passed_.fetch_add(counts.passed, std::memory_order_relaxed);
+                    rejected_.fetch_add(counts.rejected, std::memory_order_relaxed);
+                    queued_.fetch_add(counts.queued, std::memory_order_relaxed);
+                    throttle_disconnects_.fetch_add(counts.disconnects, std::memory_order_relaxed);
+                }
+                throttle_stats_t throttleStats() const {
+                    throttle_stats_t stats;
+                    stats.passed = passed_.load(std::memory_order_relaxed);
+                    stats.rejected = rejected_.load(std::memory_order_relaxed);
+                    stats.queued = queued_.load(std::memory_order_relaxed);
+                    stats.disconnects = throttle_disconnects_.load(std::memory_order_relaxed);
+                    return stats;
+                }
             private:
+                std::mutex mutex_; // Guards participants_, conn_name_, recent_msgs_ and origin_bucket_
+                receiver_t receiver_;
+                risk_slot_t risk_slot_;
+                disconnect_t disconnect_;
+                throttle_t throttle_;
+                std::unordered_map<location_t, std::shared_ptr<TokenBucket>> origin_bucket_;
+                std::atomic<counter_t> passed_;
+                std::atomic<counter_t> rejected_;
+                std::atomic<counter_t> queued_;
+                std::atomic<counter_t> throttle_disconnects_;
                 std::set<shared_handler_t> participants_;
                 std::unordered_map<transport_msg_t, shared_handler_t> conn_name_;
                 std::size_t max_recent_msgs_;
@@ -45,9 +109,16 @@ class asio_generic_server {
 
         void start_server(std::uint16_t port);
         void join_all(); // Join
+        void stop() { io_context_.stop(); }
         void send(const transport_msg_t& msg, const transport_msg_t& to = "") {
             broadcast_.deliver(msg, to);
         }
+        // Set before start_server
+        void receiver(receiver_t r) { broadcast_.receiver(r); }
+        void onDisconnect(disconnect_t d) { broadcast_.onDisconnect(d); }
+        void riskSlots(risk_slot_t r) { broadcast_.riskSlots(r); }
+        void throttle(const throttle_t& t) { broadcast_.throttle(t); }
+        throttle_stats_t throttleStats() const { return broadcast_.throttleStats(); }
     private:
         // New connection comes in this is called.
         void handle_new_connection(shared_handler_t handler, const boost::system::error_code& error);
@@ -118,6 +189,8 @@ void asio_generic_server<ConnectionHandler>::handle_new_connection(
 
 
 
+const std::size_t MAX_FRAME_SIZE = 4096; // Longest inbound line, including terminator
+
 // CRTP allows us to inject behaviour to get shared pointer to itself at any time
 // this allows it to control its own lifetime.
 // Communicates with the client
@@ -126,7 +199,10 @@ class client_handler : public std::enable_shared_from_this<client_handler> {
     public:
         client_handler(boost::asio::io_context& context,
                      asio_generic_server<client_handler>::ClientBroadcast& broadcast)
-            : context_(context), socket_(context_), write_strand_(context_), broadcast_(broadcast) {
+            : context_(context), socket_(context_), write_strand_(context_), broadcast_(broadcast), name_(),
+              session_bucket_(broadcast.throttle().session_rate, broadcast.throttle().session_burst),
+              origin_bucket_(), risk_slot_(risk_account_t::NO_SLOT), held_(), held_timer_(context_), counts_(),
+              hang_up_(false) {
         }
 
         boost::asio::ip::tcp::socket& socket() {
@@ -152,7 +228,19 @@ class client_handler : public std::enable_shared_from_this<client_handler> {
     private:
         void read_packet();
         void read_packet_done(const boost::system::error_code& error, std::size_t bytes_transferred) ;
-
+        void handle_frame(PString frame);
+        void handle_order(PString frame);
+        void handle_login(PString frame);
+        void reply(response_t r, const text_t& text);
+        void named(const location_t& name);
+
+        // Inbound rate limit, orders over it are rejected, held or the session dropped
+        bool over_rate(PString frame);
+        bool within_rate();
+        void wait_for_tokens();
+        void release_held();
+        void end_batch();
+        void end_session(const std::string& why);
         void start_packet_send();
         void packet_send_done(const boost::system::error_code& error);
 
@@ -169,9 +257,18 @@ class client_handler : public std::enable_shared_from_this<client_handler> {
         boost::asio::io_context&        context_;
         boost::asio::ip::tcp::socket    socket_; // Socket the client communicates on
         boost::asio::io_context::strand write_strand_; // Prevents multiple writes to port
-        boost::asio::streambuf          in_packet_; // Data coming in
+        LineFramer<MAX_FRAME_SIZE>      in_packet_; // Data coming in, split into lines in place
+        Author                          author_; // Parses inbound orders
         std::deque<std::string>         send_packet_queue_; // Data going out
         asio_generic_server<client_handler>::ClientBroadcast&   broadcast_;
+        location_t                      name_; // Session (client) name, orders must originate from it
+        TokenBucket                     session_bucket_;
+        std::shared_ptr<TokenBucket>    origin_bucket_; // Once named, if limited
+        std::uint32_t                   risk_slot_; // Once named, stamped on each order
+        std::deque<std::string>         held_; // THROTTLE_QUEUE, reading stops until these are released
+        boost::asio::steady_timer       held_timer_;
+        throttle_stats_t                counts_; // This batch, added to the broadcast totals after it
+        bool                            hang_up_; // THROTTLE_DISCONNECT, drop after this batch
 };
 
 } // an - namespace
@@ -37,6 +37,7 @@ typedef std::chrono::steady_clock::time_point since_t;
 
 enum direction_t { BUY, SELL };
 enum order_t { LIMIT, MARKET, CANCEL, AMEND };
+enum tif_t { DAY, IOC, FOK }; // Time in force, rest on the book or immediate (all or nothing)
 enum response_t { ACK, COMPLETE, REJECT, CANCELLED, UNKNOWN, ERROR };
 typedef std::string text_t;
 typedef double volume_t;
@@ -46,6 +47,7 @@ typedef std::string timestamp_t;
 
 typedef std::string symbol_t;
 const location_t ME = "ME"; // Matching Engine
+const location_t ALL = "<all>"; // Broadcast to every client
 
 // Security data
 typedef std::uint32_t security_id_t;
@@ -81,6 +83,22 @@ struct market_data_t {
     volume_t        volume;
 };
 
+// Depth of book, aggregated by price
+struct price_level_t {
+    price_t         price;
+    shares_t        shares; // Total visible shares
+    counter_t       orders;
+};
+
+// CLEAR drops every level of the symbol, both sides
+enum level_action_t { LEVEL_ADD, LEVEL_MODIFY, LEVEL_DELETE, LEVEL_CLEAR };
+
+struct level_delta_t {
+    level_action_t  action;
+    direction_t     direction;
+    price_level_t   level; // After the change, shares and orders zero on delete
+};
+
 // Old school Pascal ord (ordinal) function, converts from an enum to its underlying type (e.g. size_t or int)
 template <typename E>
 constexpr auto ord(E enumerator) noexcept {
@@ -105,6 +123,17 @@ inline const char* to_string_book(direction_t d) {
      }
 }
 
+inline const char* to_string(tif_t t) {
+     switch (t) {
+        case DAY: return "DAY";
+        case IOC: return "IOC";
+        case FOK: return "FOK";
+        default:
+           assert(false);
+     }
+     return "?";
+}
+
 inline const char* to_string(response_t r) {
      switch (r) {
         case ACK:       return "ACK";
@@ -128,7 +157,37 @@ inline std::time_t stringToTimeT(const std::string& dateStr, const char* const d
     return result.time_since_epoch().count() ;
 }
 
+// Fixed format YYYY-MM-DD without streams or locales, false if malformed or not a real date
+inline bool parseDate(const char* s, std::size_t len, date_t& result) {
+    if ((len != 10) || (s[4] != '-') || (s[7] != '-')) {
+        return false;
+    }
+    int v[3] = { 0, 0, 0 };
+    const int start[3] = { 0, 5, 8 };
+    const int width[3] = { 4, 2, 2 };
+    for (int f = 0; f < 3; ++f) {
+        for (int i = start[f]; i < start[f] + width[f]; ++i) {
+            unsigned digit = static_cast<unsigned>(s[i] - '0');
+            if (digit > 9) {
+                return false;
+            }
+            v[f] = v[f] * 10 + static_cast<int>(digit);
+        }
+    }
+    const date::year_month_day ymd{ date::year{v[0]}, date::month{static_cast<unsigned>(v[1])},
+                                    date::day{static_cast<unsigned>(v[2])} };
+    if (!ymd.ok()) {
+        return false;
+    }
+    result = static_cast<date_t>(date::sys_days(ymd).time_since_epoch().count()) * 86400;
+    return true;
+}
+
 inline std::time_t dateToTimeT(const std::string& dateStr) {
+    date_t result;
+    if (parseDate(dateStr.data(), dateStr.size(), result)) {
+        return result;
+    }
     return stringToTimeT(dateStr,"%Y-%m-%d"); // 1999-12-31
 }
 
@@ -176,6 +235,11 @@ inline double truncate(double d) {
 }
 
 
+// Thousandths as compare3decimalplaces sees them
+inline std::int64_t truncate3decimalplaces(double d) {
+    return static_cast<std::int64_t>(truncate(1000.0 * d));
+}
+
 inline int compare3decimalplaces(double lhs, double rhs) {
     constexpr double pow10 = std::pow(10,3); // 3 decimal places
     const double res_lhs = truncate(pow10 * lhs);
@@ -7,6 +7,8 @@
 #include "security_master.hpp"
 #include "matching_engine.hpp"
 #include "courier.hpp"
+#include <fstream>
+#include <cstdio>
 
 
 BOOST_AUTO_TEST_SUITE(bookkeeping)
@@ -120,8 +122,8 @@ BOOST_AUTO_TEST_SUITE(bookkeeping)
         BOOST_CHECK(bk.stats().buy.volume ==    100.0*10+101.0*5*2);
         BOOST_CHECK(buySide.top().id      ==    2);
 
-        an::SideRecord sr4 { // Same price earlier time
-            .id = 4, .seq=4, .time = epoch.steadyClockStartTime, .order_type=an::LIMIT,
+        an::SideRecord sr4 { // Same price earlier time, sequence is assigned with the time
+            .id = 4, .seq=0, .time = epoch.steadyClockStartTime, .order_type=an::LIMIT,
             .direction=an::BUY, .price=101.0, .shares=5, .visible=true, .on_book=false };
         buySide.add(sr4);
         BOOST_CHECK(bk.stats().buy.trades ==    4);
@@ -190,8 +192,8 @@ BOOST_AUTO_TEST_SUITE(bookkeeping)
         BOOST_CHECK(bk.stats().sell.volume ==    100.0*10+99.0*5*2);
         BOOST_CHECK(sellSide.top().id      ==    2);
 
-        an::SideRecord sr4 { // Same price earlier time
-            .id = 4, .seq=4, .time = epoch.steadyClockStartTime, .order_type=an::LIMIT,
+        an::SideRecord sr4 { // Same price earlier time, sequence is assigned with the time
+            .id = 4, .seq=0, .time = epoch.steadyClockStartTime, .order_type=an::LIMIT,
             .direction=an::SELL, .price=99.0, .shares=5, .visible=true, .on_book=false };
         sellSide.add(sr4);
         BOOST_CHECK(bk.stats().sell.trades ==    4);
@@ -216,6 +218,192 @@ BOOST_AUTO_TEST_SUITE(bookkeeping)
         BOOST_CHECK(bk.stats().sell.volume ==    100.0*10+99.0*5*3);
         BOOST_CHECK(sellSide.top().id      ==    2);
     }
+    BOOST_AUTO_TEST_CASE(side_renumber_01) { // Sequence ranks run out
+        an::Bookkeeper bk(1520812800, 100.0, epoch);
+        an::Side buySide(bk, an::BUY, epoch);
+        const an::sequence_t late = an::Side::MAX_RANK + 10;
+
+        an::SideRecord sr1 {
+            .id = 1, .seq=1, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::BUY, .price=99.0, .shares=10, .visible=true, .on_book=false };
+        buySide.add(sr1);
+        an::SideRecord sr2 {
+            .id = 2, .seq=2, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::BUY, .price=99.5, .shares=10, .visible=true, .on_book=false };
+        buySide.add(sr2);
+        an::SideRecord sr3 {
+            .id = 3, .seq=3, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::BUY, .price=99.5, .shares=10, .visible=true, .on_book=false };
+        buySide.add(sr3);
+        BOOST_CHECK(buySide.top().id       ==    2);
+
+        an::SideRecord sr4 { // Renumbers, same price as 2 and 3 but later
+            .id = 4, .seq=late, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::BUY, .price=99.5, .shares=10, .visible=true, .on_book=false };
+        buySide.add(sr4);
+        BOOST_CHECK(buySide.top().id       ==    2);
+        buySide.removeTop();
+        BOOST_CHECK(buySide.top().id       ==    3);
+
+        // Amend re-adds with the old seq, keeps its place ahead of 4
+        an::SideRecord* pr3 = buySide.findRecord(3);
+        an::SideRecord newRec(*pr3);
+        buySide.remove(*pr3);
+        BOOST_CHECK(buySide.top().id       ==    4);
+        buySide.add(newRec);
+        BOOST_CHECK(buySide.top().id       ==    3);
+        buySide.removeTop();
+        BOOST_CHECK(buySide.top().id       ==    4);
+        buySide.removeTop();
+        BOOST_CHECK(buySide.top().id       ==    1);
+        BOOST_CHECK(bk.stats().buy.trades  ==    1);
+    }
+    BOOST_AUTO_TEST_CASE(side_best_01) {
+        an::Bookkeeper bk(1520812800, 100.0, epoch);
+        an::Side buySide(bk, an::BUY, epoch);
+        BOOST_CHECK(!buySide.crossedBy(0.0)); // Empty
+
+        an::SideRecord sr1 {
+            .id = 1, .seq=1, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::BUY, .price=99.0, .shares=10, .visible=true, .on_book=false };
+        buySide.add(sr1);
+        BOOST_CHECK(buySide.best().price   ==    99.0);
+        BOOST_CHECK(buySide.best().shares  ==    10);
+        BOOST_CHECK(buySide.crossedBy(99.0));
+        BOOST_CHECK(buySide.crossedBy(98.5));
+        BOOST_CHECK(!buySide.crossedBy(99.01));
+
+        an::SideRecord sr2 { // Below best
+            .id = 2, .seq=2, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::BUY, .price=98.0, .shares=5, .visible=true, .on_book=false };
+        buySide.add(sr2);
+        an::SideRecord sr3 { // Joins best
+            .id = 3, .seq=3, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::BUY, .price=99.0, .shares=7, .visible=true, .on_book=false };
+        buySide.add(sr3);
+        BOOST_CHECK(buySide.best().price   ==    99.0);
+        BOOST_CHECK(buySide.best().shares  ==    17);
+
+        buySide.amendSharesTop(-4);
+        BOOST_CHECK(buySide.best().shares  ==    13);
+        buySide.remove(*buySide.findRecord(2));
+        BOOST_CHECK(buySide.best().shares  ==    13);
+        buySide.removeTop();
+        BOOST_CHECK(buySide.best().shares  ==    7);
+        buySide.removeTop();
+        BOOST_CHECK(!buySide.crossedBy(0.0));
+
+        an::Side sellSide(bk, an::SELL, epoch);
+        an::SideRecord sr4 {
+            .id = 4, .seq=4, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::SELL, .price=101.0, .shares=10, .visible=true, .on_book=false };
+        sellSide.add(sr4);
+        BOOST_CHECK(sellSide.crossedBy(101.0));
+        BOOST_CHECK(!sellSide.crossedBy(100.99));
+        BOOST_CHECK(sellSide.crossedBy(an::MAX_SHARE_PRICE)); // Market BUY
+    }
+    BOOST_AUTO_TEST_CASE(side_available_01) {
+        an::Bookkeeper bk(1520812800, 100.0, epoch);
+        an::Side sellSide(bk, an::SELL, epoch);
+        BOOST_CHECK(sellSide.available(200.0, 100) == 0); // Empty
+
+        const an::price_t prices[] = { 101.0, 100.0, 102.0, 100.5, 103.0, 100.0 };
+        an::order_id_t id = 0;
+        for (an::price_t price: prices) {
+            ++id;
+            an::SideRecord sr {
+                .id = id, .seq=id, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+                .direction=an::SELL, .price=price, .shares=10, .visible=true, .on_book=false };
+            sellSide.add(sr);
+        }
+        an::SideRecord sr7 { // Iceberg, 10 shown and 30 in reserve
+            .id = 7, .seq=7, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::SELL, .price=100.5, .shares=40, .visible=true, .on_book=false,
+            .slot=0, .reserve=0, .peak=10 };
+        sellSide.add(sr7);
+        sellSide.remove(*sellSide.findRecord(3)); // 102.0
+
+        BOOST_CHECK(sellSide.available( 99.0, 1000) == 0);
+        BOOST_CHECK(sellSide.available(100.0, 1000) == 20);
+        BOOST_CHECK(sellSide.available(100.5, 1000) == 70);
+        BOOST_CHECK(sellSide.available(102.5, 1000) == 80);
+        BOOST_CHECK(sellSide.available(an::MAX_SHARE_PRICE, 1000) == 90);
+        BOOST_CHECK(sellSide.available(an::MAX_SHARE_PRICE, 15) >= 15); // Stops early
+        BOOST_CHECK(sellSide.top().id      ==    2); // Unchanged
+        BOOST_CHECK(bk.stats().sell.trades ==    6);
+    }
+    BOOST_AUTO_TEST_CASE(side_levels_01) {
+        an::Bookkeeper bk(1520812800, 100.0, epoch);
+        an::Side sellSide(bk, an::SELL, epoch);
+        std::vector<an::price_level_t> levels;
+        std::vector<an::level_delta_t> deltas;
+
+        an::SideRecord sr1 {
+            .id = 1, .seq=1, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::SELL, .price=101.0, .shares=10, .visible=true, .on_book=false };
+        an::SideRecord sr2 {
+            .id = 2, .seq=2, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::SELL, .price=100.5, .shares=5, .visible=true, .on_book=false };
+        an::SideRecord sr3 {
+            .id = 3, .seq=3, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::SELL, .price=101.0, .shares=7, .visible=true, .on_book=false };
+        sellSide.add(sr1);
+        sellSide.add(sr2);
+        sellSide.add(sr3);
+        BOOST_CHECK(sellSide.levels().size() == 2);
+        sellSide.levels().snapshot(levels, 10);
+        BOOST_REQUIRE(levels.size()          == 2);
+        BOOST_CHECK(levels[0].price          == 100.5); // Best (lowest) ask first
+        BOOST_CHECK(levels[0].shares         == 5);
+        BOOST_CHECK(levels[0].orders         == 1);
+        BOOST_CHECK(levels[1].price          == 101.0);
+        BOOST_CHECK(levels[1].shares         == 17);
+        BOOST_CHECK(levels[1].orders         == 2);
+        sellSide.levels().snapshot(levels, 1);
+        BOOST_CHECK(levels.size()            == 1);
+
+        BOOST_CHECK(sellSide.levels().changed());
+        sellSide.levels().deltas(deltas);
+        BOOST_REQUIRE(deltas.size()          == 2); // Conflated to one per level
+        for (const auto& d : deltas) {
+            BOOST_CHECK(d.action             == an::LEVEL_ADD);
+            BOOST_CHECK(d.direction          == an::SELL);
+        }
+        BOOST_CHECK(!sellSide.levels().changed());
+
+        an::SideRecord* pr = sellSide.findRecord(3);
+        an::shares_t old = pr->shares;
+        pr->shares = 3;
+        sellSide.amendShares(*pr, old);
+        pr = sellSide.findRecord(2);
+        sellSide.remove(*pr);
+        deltas.clear();
+        sellSide.levels().deltas(deltas);
+        BOOST_REQUIRE(deltas.size()          == 2);
+        for (const auto& d : deltas) {
+            if (d.level.price == 101.0) {
+                BOOST_CHECK(d.action         == an::LEVEL_MODIFY);
+                BOOST_CHECK(d.level.shares   == 13);
+                BOOST_CHECK(d.level.orders   == 2);
+            } else {
+                BOOST_CHECK(d.action         == an::LEVEL_DELETE);
+                BOOST_CHECK(d.level.price    == 100.5);
+            }
+        }
+        BOOST_CHECK(sellSide.top().id        == 1);
+
+        // Added and removed in one cycle, nothing to send
+        an::SideRecord sr4 {
+            .id = 4, .seq=4, .time = std::chrono::steady_clock::now(), .order_type=an::LIMIT,
+            .direction=an::SELL, .price=99.0, .shares=1, .visible=true, .on_book=false };
+        sellSide.add(sr4);
+        sellSide.removeTop();
+        deltas.clear();
+        sellSide.levels().deltas(deltas);
+        BOOST_CHECK(deltas.empty());
+        BOOST_CHECK(sellSide.levels().find(99.0) == nullptr);
+        BOOST_CHECK(sellSide.levels().find(101.0)->shares == 13);
+    }
     BOOST_AUTO_TEST_CASE(buy_side_amend_01) {
         an::Bookkeeper bk(1520812800, 100.0, epoch);
         an::Side buySide(bk, an::BUY, epoch);
@@ -725,6 +913,348 @@ BOOST_AUTO_TEST_SUITE(book)
         book.close();
         BOOST_CHECK(bk.stats().cancels       == 0);
     }
+
+    BOOST_AUTO_TEST_CASE(book_ioc_fok_01) {
+        an::sequence_t seq = 0;
+        an::TickTable tt;
+        an::SideRecord rec;
+        tt.add(an::tick_table_row_t(  0,  0.001));
+        tt.add(an::tick_table_row_t( 10,  0.005));
+        tt.add(an::tick_table_row_t( 50,  0.01));
+        tt.add(an::tick_table_row_t(100,  0.05));
+        const an::price_t prev_close = 171.05;
+
+        an::Book book(nullptr, "APPL", epoch, tt, true, prev_close);
+        const an::Bookkeeper& bk = book.bookkeeper();
+        book.open();
+
+        auto lim01a = std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::SELL,10,172.00);
+        lim01a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim01a));
+        auto lim02a = std::make_unique<an::LimitOrder >(  2,"Client1", an::ME,"APPL",an::SELL,10,172.05);
+        lim02a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim02a));
+        BOOST_CHECK(bk.stats().sell.trades   == 2);
+
+        // Only 10 at 172.00, killed without trading
+        auto fok03a = std::make_unique<an::LimitOrder >(  3,"Client2", an::ME,"APPL",an::BUY,15,172.00);
+        fok03a->setTimeInForce(an::FOK);
+        fok03a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(fok03a));
+        BOOST_CHECK(bk.stats().trades        == 0);
+        BOOST_CHECK(bk.stats().cancels       == 1);
+        BOOST_CHECK(bk.stats().sell.trades   == 2);
+
+        // Fills over two levels
+        auto fok04a = std::make_unique<an::LimitOrder >(  4,"Client2", an::ME,"APPL",an::BUY,15,172.05);
+        fok04a->setTimeInForce(an::FOK);
+        fok04a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(fok04a));
+        BOOST_CHECK(bk.stats().shares_traded == 15 * 2);
+        BOOST_CHECK(bk.stats().cancels       == 1);
+        BOOST_CHECK(bk.stats().sell.trades   == 1);
+
+        // Takes what there is, the rest is cancelled not rested
+        auto ioc05a = std::make_unique<an::LimitOrder >(  5,"Client2", an::ME,"APPL",an::BUY,10,172.05);
+        ioc05a->setTimeInForce(an::IOC);
+        ioc05a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(ioc05a));
+        BOOST_CHECK(bk.stats().shares_traded == 20 * 2);
+        BOOST_CHECK(bk.stats().cancels       == 2);
+        BOOST_CHECK(bk.stats().sell.trades   == 0);
+        BOOST_CHECK(bk.stats().buy.trades    == 0);
+
+        book.close();
+    }
+
+    BOOST_AUTO_TEST_CASE(book_stop_01) {
+        an::sequence_t seq = 0;
+        an::TickTable tt;
+        an::SideRecord rec;
+        tt.add(an::tick_table_row_t(  0,  0.001));
+        tt.add(an::tick_table_row_t( 10,  0.005));
+        tt.add(an::tick_table_row_t( 50,  0.01));
+        tt.add(an::tick_table_row_t(100,  0.05));
+        const an::price_t prev_close = 171.05;
+
+        an::Book book(nullptr, "APPL", epoch, tt, true, prev_close);
+        const an::Bookkeeper& bk = book.bookkeeper();
+        book.open();
+
+        struct { an::direction_t direction; an::shares_t shares; an::price_t price; } orders[] = {
+            { an::SELL, 10, 172.00 }, { an::SELL, 10, 172.50 }, { an::SELL, 10, 173.00 }, { an::BUY, 10, 171.00 } };
+        an::order_id_t id = 0;
+        for (const auto& o : orders) {
+            auto lim = std::make_unique<an::LimitOrder >( ++id,"Client1", an::ME,"APPL",o.direction,o.shares,o.price);
+            lim->pack(rec);
+            rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+            book.executeOrder(rec, std::move(lim));
+        }
+
+        // Held off the book
+        auto stp10a = std::make_unique<an::MarketOrder >( 10,"Client3", an::ME,"APPL",an::BUY,10);
+        stp10a->setStopPrice(172.50);
+        stp10a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(stp10a));
+        auto stp11a = std::make_unique<an::LimitOrder >( 11,"Client3", an::ME,"APPL",an::BUY,5,172.50);
+        stp11a->setStopPrice(172.00);
+        stp11a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(stp11a));
+        auto stp12a = std::make_unique<an::MarketOrder >( 12,"Client3", an::ME,"APPL",an::SELL,5);
+        stp12a->setStopPrice(170.00);
+        stp12a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(stp12a));
+        auto stp13a = std::make_unique<an::MarketOrder >( 13,"Client3", an::ME,"APPL",an::SELL,5);
+        stp13a->setStopPrice(170.003); // Not a tick
+        stp13a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(stp13a));
+        BOOST_CHECK(bk.stats().trades        == 0);
+        BOOST_CHECK(bk.stats().rejects       == 1);
+        BOOST_CHECK(bk.stats().buy.trades    == 1);
+        BOOST_CHECK(bk.stats().sell.trades   == 3);
+
+        // 172.00 elects 11, its fill at 172.50 elects 10
+        auto lim14a = std::make_unique<an::LimitOrder >( 14,"Client2", an::ME,"APPL",an::BUY,10,172.00);
+        lim14a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim14a));
+        BOOST_CHECK(bk.stats().shares_traded == 25 * 2);
+        BOOST_CHECK(bk.stats().last_trade_price == 173.00);
+        BOOST_CHECK(bk.stats().sell.trades   == 1);
+        BOOST_CHECK(bk.stats().sell.shares   == 5);
+
+        // Pending stops can be cancelled
+        auto can12a = std::make_unique<an::CancelOrder >( 12,"Client1", an::ME,"APPL");
+        book.cancelActiveOrder(12, std::move(can12a));
+        BOOST_CHECK(bk.stats().rejects       == 2); // Origin
+        auto can12b = std::make_unique<an::CancelOrder >( 12,"Client3", an::ME,"APPL");
+        book.cancelActiveOrder(12, std::move(can12b));
+        BOOST_CHECK(bk.stats().cancels       == 1);
+
+        // Already through the last trade, elected at once
+        auto stp15a = std::make_unique<an::MarketOrder >( 15,"Client3", an::ME,"APPL",an::SELL,5);
+        stp15a->setStopPrice(175.00);
+        stp15a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(stp15a));
+        BOOST_CHECK(bk.stats().shares_traded == 30 * 2);
+        BOOST_CHECK(bk.stats().last_trade_price == 171.00);
+        BOOST_CHECK(bk.stats().buy.shares    == 5);
+
+        // Cancelled at close
+        auto stp16a = std::make_unique<an::MarketOrder >( 16,"Client3", an::ME,"APPL",an::BUY,5);
+        stp16a->setStopPrice(180.00);
+        stp16a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(stp16a));
+        book.close();
+        BOOST_CHECK(bk.stats().cancels       == 1 + 3);
+    }
+
+    BOOST_AUTO_TEST_CASE(book_auction_01) {
+        an::sequence_t seq = 0;
+        an::TickTable tt;
+        an::SideRecord rec;
+        tt.add(an::tick_table_row_t(  0,  0.001));
+        tt.add(an::tick_table_row_t( 10,  0.005));
+        tt.add(an::tick_table_row_t( 50,  0.01));
+        tt.add(an::tick_table_row_t(100,  0.05));
+        const an::price_t prev_close = 171.05;
+
+        an::Book book(nullptr, "APPL", epoch, tt, true, prev_close);
+        const an::Bookkeeper& bk = book.bookkeeper();
+        book.open();
+        book.startAuction();
+        BOOST_CHECK(!book.equilibrium().crossed);
+
+        struct { an::direction_t direction; an::shares_t shares; an::price_t price; } orders[] = {
+            { an::BUY,  10, 172.00 }, { an::BUY,  20, 171.50 }, { an::BUY,  10, 171.00 },
+            { an::SELL, 15, 171.00 }, { an::SELL, 10, 171.50 }, { an::SELL, 10, 172.50 } };
+        an::order_id_t id = 0;
+        for (const auto& o : orders) {
+            auto lim = std::make_unique<an::LimitOrder >( ++id,"Client1", an::ME,"APPL",o.direction,o.shares,o.price);
+            lim->pack(rec);
+            rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+            book.executeOrder(rec, std::move(lim));
+        }
+        BOOST_CHECK(bk.stats().trades        == 0); // Crossed but not matched
+        BOOST_CHECK(bk.stats().buy.trades    == 3);
+        BOOST_CHECK(bk.stats().sell.trades   == 3);
+
+        auto mkt07a = std::make_unique<an::MarketOrder >(  7,"Client2", an::ME,"APPL",an::SELL, 5);
+        mkt07a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(mkt07a));
+        BOOST_CHECK(bk.stats().rejects       == 1);
+
+        // 171.00 trades 15, 171.50 trades 25, 172.00 trades 10
+        an::auction_t auction = book.equilibrium();
+        BOOST_CHECK(auction.crossed);
+        BOOST_CHECK(auction.price            == 171.50);
+        BOOST_CHECK(auction.volume           == 25);
+        BOOST_CHECK(auction.imbalance        == 5);
+
+        BOOST_CHECK(book.uncross(auction)    == 25);
+        BOOST_CHECK(!book.inAuction());
+        BOOST_CHECK(bk.stats().shares_traded == 25 * 2);
+        BOOST_CHECK(bk.stats().volume        == 171.50 * 25 * 2);
+        BOOST_CHECK(bk.stats().last_trade_price == 171.50);
+        BOOST_CHECK(bk.stats().buy.trades    == 2);
+        BOOST_CHECK(bk.stats().buy.shares    == 15);
+        BOOST_CHECK(bk.stats().sell.trades   == 1);
+
+        // Continuous again
+        auto lim08a = std::make_unique<an::LimitOrder >(  8,"Client2", an::ME,"APPL",an::SELL,5,171.50);
+        lim08a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim08a));
+        BOOST_CHECK(bk.stats().shares_traded == 30 * 2);
+        BOOST_CHECK(bk.stats().buy.trades    == 1);
+
+        book.close();
+    }
+
+    BOOST_AUTO_TEST_CASE(book_auction_02) { // Same volume and imbalance, nearest previous close
+        an::sequence_t seq = 0;
+        an::TickTable tt;
+        an::SideRecord rec;
+        tt.add(an::tick_table_row_t(  0,  0.01));
+        an::Book book(nullptr, "APPL", epoch, tt, true, 171.05);
+        book.open();
+        book.startAuction();
+
+        auto lim01a = std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::BUY,10,172.00);
+        lim01a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim01a));
+        auto lim02a = std::make_unique<an::LimitOrder >(  2,"Client2", an::ME,"APPL",an::SELL,10,171.00);
+        lim02a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim02a));
+
+        an::auction_t auction = book.equilibrium();
+        BOOST_CHECK(auction.crossed);
+        BOOST_CHECK(auction.price            == 171.00);
+        BOOST_CHECK(auction.volume           == 10);
+        BOOST_CHECK(auction.imbalance        == 0);
+        BOOST_CHECK(book.uncross()           == 10);
+        BOOST_CHECK(book.bookkeeper().stats().buy.trades  == 0);
+        BOOST_CHECK(book.bookkeeper().stats().sell.trades == 0);
+        book.close();
+    }
+
+    BOOST_AUTO_TEST_CASE(book_auction_03) { // Amend through the touch in the call phase
+        an::sequence_t seq = 0;
+        an::TickTable tt;
+        an::SideRecord rec;
+        tt.add(an::tick_table_row_t(  0,  0.01));
+        an::Book book(nullptr, "APPL", epoch, tt, true, 171.05);
+        const an::Bookkeeper& bk = book.bookkeeper();
+        book.open();
+        book.startAuction();
+
+        auto lim01a = std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::BUY,10,170.00);
+        lim01a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim01a));
+        auto lim02a = std::make_unique<an::LimitOrder >(  2,"Client2", an::ME,"APPL",an::SELL,10,171.00);
+        lim02a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim02a));
+        BOOST_CHECK(!book.equilibrium().crossed);
+
+        auto amd01b = std::make_unique<an::AmendOrder>(  1,"Client1", an::ME,"APPL", 172.0);
+        book.amendActiveOrder(1, std::move(amd01b));
+        BOOST_CHECK(bk.stats().amends        == 1);
+        BOOST_CHECK(bk.stats().trades        == 0); // Crossed but not matched
+        BOOST_CHECK(bk.stats().buy.trades    == 1);
+        BOOST_CHECK(bk.stats().sell.trades   == 1);
+
+        an::auction_t auction = book.equilibrium();
+        BOOST_CHECK(auction.crossed);
+        BOOST_CHECK(auction.volume           == 10);
+        BOOST_CHECK(book.uncross(auction)    == 10);
+        BOOST_CHECK(bk.stats().shares_traded == 10 * 2);
+        BOOST_CHECK(bk.stats().buy.trades    == 0);
+        BOOST_CHECK(bk.stats().sell.trades   == 0);
+        book.close();
+    }
+
+    BOOST_AUTO_TEST_CASE(book_iceberg_01) {
+        an::sequence_t seq = 0;
+        an::TickTable tt;
+        an::SideRecord rec;
+        tt.add(an::tick_table_row_t(  0,  0.001));
+        tt.add(an::tick_table_row_t( 10,  0.005));
+        tt.add(an::tick_table_row_t( 50,  0.01));
+        tt.add(an::tick_table_row_t(100,  0.05));
+        const an::price_t prev_close = 171.05;
+
+        an::Book book(nullptr, "APPL", epoch, tt, true, prev_close);
+        const an::Bookkeeper& bk = book.bookkeeper();
+        std::vector<an::price_level_t> bids, asks;
+        book.open();
+
+        auto lim01a = std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::SELL,100,172.00,10);
+        lim01a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim01a));
+        BOOST_CHECK(bk.stats().sell.trades   == 1);
+        BOOST_CHECK(bk.stats().sell.shares   == 10); // Only the peak is shown
+        book.depth(bids, asks, 1);
+        BOOST_CHECK(asks.at(0).shares        == 10);
+
+        auto lim02a = std::make_unique<an::LimitOrder >(  2,"Client2", an::ME,"APPL",an::SELL,5,172.00);
+        lim02a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim02a));
+        book.depth(bids, asks, 1);
+        BOOST_CHECK(asks.at(0).shares        == 15);
+
+        // Takes the peak, the refreshed peak goes behind order 2
+        auto lim03a = std::make_unique<an::LimitOrder >(  3,"Client3", an::ME,"APPL",an::BUY,10,172.00);
+        lim03a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim03a));
+        BOOST_CHECK(bk.stats().volume        == 172.0 * 10 * 2);
+        BOOST_CHECK(bk.stats().sell.trades   == 2);
+        BOOST_CHECK(bk.stats().sell.shares   == 15);
+
+        auto lim05a = std::make_unique<an::LimitOrder >(  5,"Client3", an::ME,"APPL",an::BUY,5,172.00);
+        lim05a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim05a));
+        BOOST_CHECK(bk.stats().volume        == 172.0 * 15 * 2);
+        BOOST_CHECK(bk.stats().sell.trades   == 1); // Order 2 filled first
+        BOOST_CHECK(bk.stats().sell.shares   == 10);
+        BOOST_CHECK(bk.stats().buy.trades    == 0);
+        book.depth(bids, asks, 1);
+        BOOST_CHECK(asks.at(0).shares        == 10);
+
+        // Trades through the reserve, rest of the buy stays on the book
+        auto lim04a = std::make_unique<an::LimitOrder >(  4,"Client3", an::ME,"APPL",an::BUY,95,172.00);
+        lim04a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim04a));
+        BOOST_CHECK(bk.stats().volume        == 172.0 * 105 * 2);
+        BOOST_CHECK(bk.stats().sell.trades   == 0);
+        BOOST_CHECK(bk.stats().buy.trades    == 1);
+        BOOST_CHECK(bk.stats().buy.shares    == 5);
+        book.depth(bids, asks, 1);
+        BOOST_CHECK(asks.empty());
+        BOOST_CHECK(bids.at(0).shares        == 5);
+
+        book.close();
+    }
     BOOST_AUTO_TEST_CASE(book_limit_limit_amend_01) {
         an::sequence_t seq = 0;
         an::order_id_t id = 0;
@@ -856,7 +1386,7 @@ BOOST_AUTO_TEST_SUITE(book)
         BOOST_CHECK(bk.stats().rejects       == 0);
         BOOST_CHECK(bk.stats().buy.trades    == 1);
         BOOST_CHECK(bk.stats().buy.shares    == 10);
-        BOOST_CHECK(bk.stats().buy.value     == 172.0*10);
+        BOOST_CHECK(bk.stats().buy.value     == 170.0*10); // 170 left on the book
         BOOST_CHECK(bk.stats().buy.volume    == 172.0*10 + 171.0*10 + 170.0*10);
         BOOST_CHECK(bk.stats().sell.trades   == 2);
         BOOST_CHECK(bk.stats().sell.shares   == 40);
@@ -944,6 +1474,78 @@ BOOST_AUTO_TEST_SUITE(book)
         book.executeOrder(rec, std::move(lim02c));
         BOOST_CHECK(bk.stats().rejects      == 5);
 
+        auto lim08a = std::make_unique<an::LimitOrder >(  8,"Client1", an::ME,"APPL",an::SELL,10,200000.00);
+        lim08a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim08a));
+        BOOST_CHECK(bk.stats().rejects      == 6); // Price beyond Side::MAX_PRICE
+
+        book.close();
+    }
+
+    BOOST_AUTO_TEST_CASE(book_market_data_01) {
+        an::sequence_t seq = 0;
+        an::SideRecord rec;
+        an::market_data_t md;
+        an::TickTable tt;
+        tt.add(an::tick_table_row_t(  0,  0.001));
+        tt.add(an::tick_table_row_t( 10,  0.005));
+        tt.add(an::tick_table_row_t( 50,  0.01));
+        tt.add(an::tick_table_row_t(100,  0.05));
+
+        an::Book book(nullptr, "APPL", epoch, tt, true, 171.07);
+        book.open();
+        BOOST_CHECK(!book.dirty());
+
+        auto lim01a = std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::SELL,10,172.00);
+        lim01a->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim01a));
+        BOOST_CHECK(book.dirty());
+        BOOST_REQUIRE(book.publish(md));
+        BOOST_CHECK(!book.dirty());
+        BOOST_CHECK(md.symbol == "APPL");
+        BOOST_CHECK(!md.have_bid);
+        BOOST_CHECK(md.have_ask && md.ask == 172.0 && md.ask_size == 10);
+        BOOST_CHECK(!md.have_last_trade);
+        BOOST_CHECK(!book.publish(md)); // Nothing changed
+
+        // Burst of amends conflated into one update
+        for (an::shares_t i = 1; i <= 1000; ++i) {
+            auto amd = std::make_unique<an::AmendOrder>(  1,"Client1", an::ME,"APPL", an::shares_t(10+i));
+            book.amendActiveOrder(1, std::move(amd));
+        }
+        BOOST_CHECK(book.dirty());
+        BOOST_REQUIRE(book.publish(md));
+        BOOST_CHECK(md.ask_size == 1010);
+
+        // Top changes and is restored before publishing, nothing to send
+        auto amd01b = std::make_unique<an::AmendOrder>(  1,"Client1", an::ME,"APPL", an::shares_t(5));
+        book.amendActiveOrder(1, std::move(amd01b));
+        auto amd01c = std::make_unique<an::AmendOrder>(  1,"Client1", an::ME,"APPL", an::shares_t(1010));
+        book.amendActiveOrder(1, std::move(amd01c));
+        BOOST_CHECK(book.dirty());
+        BOOST_CHECK(!book.publish(md));
+
+        auto lim01b = std::make_unique<an::LimitOrder >(  2,"Client2", an::ME,"APPL",an::BUY,10,172.00);
+        lim01b->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim01b));
+        auto lim01c = std::make_unique<an::LimitOrder >(  3,"Client2", an::ME,"APPL",an::BUY,10,171.00);
+        lim01c->pack(rec);
+        rec.time = std::chrono::steady_clock::now(); rec.seq = ++seq; rec.visible = true;
+        book.executeOrder(rec, std::move(lim01c));
+        BOOST_REQUIRE(book.publish(md));
+        BOOST_CHECK(md.have_bid && md.bid == 171.0 && md.bid_size == 10);
+        BOOST_CHECK(md.have_ask && md.ask == 172.0 && md.ask_size == 1000);
+        BOOST_CHECK(md.have_last_trade && md.last_trade_price == 172.0 && md.last_trade_shares == 10);
+        BOOST_CHECK(md.volume == 1720.0);
+
+        auto can01a = std::make_unique<an::CancelOrder>(  3,"Client2", an::ME,"APPL");
+        book.cancelActiveOrder(3, std::move(can01a));
+        BOOST_REQUIRE(book.publish(md));
+        BOOST_CHECK(!md.have_bid);
+
         book.close();
     }
 BOOST_AUTO_TEST_SUITE_END()
@@ -1035,6 +1637,40 @@ BOOST_AUTO_TEST_SUITE(courier)
         BOOST_CHECK(stats.rejects            == 4); // All above rejected
 
     }
+    BOOST_AUTO_TEST_CASE(deliver_01) {
+        an::Courier courier;
+        std::vector<std::pair<an::location_t, an::transport_msg_t>> sent;
+        courier.deliverTo( [&sent](const an::location_t& to, const an::transport_msg_t& msg) {
+            sent.emplace_back(to, msg);
+        } );
+
+        auto lim01a = std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::SELL, 5,172.0);
+        an::Response rep01a(lim01a.get(), an::ACK, "OK");
+        courier.send(rep01a);
+        an::TradeReport trr01a(lim01a.get(), an::BUY, 5, 172.0);
+        courier.send(trr01a);
+        an::Response rep01b(an::ME, "Client2", an::ERROR, "Bad");
+        courier.send(rep01b);
+        an::market_data_t quote{
+            .seq=1, .origin=an::ME, .symbol="APPL",
+            .have_bid=false, .bid=0.0, .bid_size=0,
+            .have_ask=false, .ask=0.0, .ask_size=0,
+            .have_last_trade=false, .last_trade_price=0.0, .last_trade_shares=0,
+            .trade_time="", .quote_time="", .volume=0.0 };
+        an::MarketData mtd01a(an::ME, quote);
+        courier.send(mtd01a);
+
+        BOOST_REQUIRE(sent.size()            == 4);
+        BOOST_CHECK(sent[0].first            == "Client1");
+        BOOST_CHECK(sent[0].second           == rep01a.to_string());
+        BOOST_CHECK(sent[1].first            == "Client1");
+        BOOST_CHECK(sent[1].second           == trr01a.to_string());
+        BOOST_CHECK(sent[2].first            == "Client2");
+        BOOST_CHECK(sent[3].first            == an::ALL);
+        BOOST_CHECK(courier.stats().response_msgs     == 2);
+        BOOST_CHECK(courier.stats().trade_report_msgs == 1);
+        BOOST_CHECK(courier.stats().market_data_msgs  == 1);
+    }
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE(matching_engine)
@@ -1091,6 +1727,246 @@ BOOST_AUTO_TEST_SUITE(matching_engine)
 
         me.close();
     }
+    BOOST_AUTO_TEST_CASE(auction_01) {
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+
+        me.startAuction();
+        me.applyOrder(std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::SELL,5,171.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  2,"Client2", an::ME,"APPL",an::BUY,5,172.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  3,"Client1", an::ME,"IBM",an::SELL,5,154.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  4,"Client2", an::ME,"IBM",an::BUY,5,153.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  5,"Client1", an::ME,"MSFT",an::SELL,5,91.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  6,"Client2", an::ME,"MSFT",an::BUY,10,92.0));
+        an::engine_stats_t stats = me.stats();
+        BOOST_CHECK(stats.trades             == 0);
+        BOOST_CHECK(stats.active_trades      == 6);
+
+        BOOST_CHECK(me.uncross(4)            == 2); // IBM does not cross
+        stats = me.stats();
+        BOOST_CHECK(stats.shares_traded      == 10 * 2);
+        BOOST_CHECK(stats.active_trades      == 3);
+        BOOST_CHECK(stats.buy.shares         == 5 + 5);
+
+        me.applyOrder(std::make_unique<an::LimitOrder >(  7,"Client1", an::ME,"IBM",an::SELL,5,153.0));
+        stats = me.stats();
+        BOOST_CHECK(stats.shares_traded      == 15 * 2); // Continuous
+        me.close();
+    }
+    BOOST_AUTO_TEST_CASE(mass_cancel_01) {
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        std::vector<std::pair<an::location_t, an::transport_msg_t>> sent;
+        courier.deliverTo( [&sent](const an::location_t& to, const an::transport_msg_t& msg) {
+            sent.emplace_back(to, msg);
+        } );
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+
+        me.applyOrder(std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::BUY,5,170.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  2,"Client1", an::ME,"APPL",an::SELL,5,172.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  3,"Client1", an::ME,"IBM",an::BUY,5,150.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  4,"Client2", an::ME,"APPL",an::BUY,5,170.0));
+        auto stp05a = std::make_unique<an::MarketOrder >(  5,"Client1", an::ME,"IBM",an::BUY,5);
+        stp05a->setStopPrice(160.0);
+        me.applyOrder(std::move(stp05a));
+        BOOST_CHECK(me.stats().active_trades == 4);
+        BOOST_CHECK(sent.empty());
+
+        // One symbol and side
+        BOOST_CHECK(me.massCancel(an::mass_cancel_t{"Client1", "APPL", false, an::SELL}) == 1);
+        BOOST_CHECK(me.stats().active_trades == 3);
+        BOOST_CHECK(sent.size()              == 1);
+
+        // Everything of the sender, resting and stops, one delivery then the reply
+        me.applyOrder(std::make_unique<an::MassCancelOrder >(  6,"Client1", an::ME));
+        BOOST_REQUIRE(sent.size()            == 3);
+        BOOST_CHECK(sent[1].first            == "Client1");
+        BOOST_CHECK(std::count(sent[1].second.begin(), sent[1].second.end(), '\n') == 2);
+        BOOST_CHECK(sent[2].second.find("mass cancel 3 orders") != std::string::npos);
+        an::engine_stats_t stats = me.stats();
+        BOOST_CHECK(stats.active_trades      == 1);
+        BOOST_CHECK(stats.cancels            == 4);
+        BOOST_CHECK(me.massCancel(an::mass_cancel_t{"Client1", "", true, an::BUY}) == 0);
+
+        me.applyOrder(std::make_unique<an::MassCancelOrder >(  7,"Client1", an::ME,"XXX"));
+        BOOST_CHECK(me.stats().rejects       == 1);
+
+        // Every origin
+        BOOST_CHECK(me.massCancel(an::mass_cancel_t{"", "", false, an::BUY}) == 1);
+        BOOST_CHECK(me.stats().active_trades == 0);
+        BOOST_CHECK(courier.stats().response_msgs == 1 + 3 + 1 + 1 + 1);
+        me.close();
+    }
+    BOOST_AUTO_TEST_CASE(risk_01) {
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        std::vector<std::pair<an::location_t, an::transport_msg_t>> sent;
+        courier.deliverTo( [&sent](const an::location_t& to, const an::transport_msg_t& msg) {
+            sent.emplace_back(to, msg);
+        } );
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+        an::risk_limits_t limits;
+        limits.max_order_shares = 100;
+        limits.max_notional = 10000.0;
+        limits.collar = 0.05;
+        limits.max_exposure = 20000.0;
+        me.setDefaultRiskLimits(limits);
+        an::risk_limits_t big;
+        big.max_order_shares = 1000;
+        me.setRiskLimits("Client2", big);
+
+        me.applyOrder(std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::BUY,101,170.0));
+        BOOST_REQUIRE(sent.size()            == 1);
+        BOOST_CHECK(sent[0].second.find("risk order size") != std::string::npos);
+        me.applyOrder(std::make_unique<an::LimitOrder >(  2,"Client1", an::ME,"APPL",an::BUY,50,170.0));
+        BOOST_REQUIRE(me.risk("Client1") != nullptr);
+        BOOST_CHECK_CLOSE(me.risk("Client1")->open, 8500.0, 1e-9);
+        // Collared on the previous close, only one side quoted
+        me.applyOrder(std::make_unique<an::LimitOrder >(  3,"Client1", an::ME,"APPL",an::BUY,10,150.0));
+        BOOST_CHECK(sent.back().second.find("risk price collar") != std::string::npos);
+        me.applyOrder(std::make_unique<an::LimitOrder >(  4,"Client1", an::ME,"APPL",an::SELL,70,171.0));
+        BOOST_CHECK(sent.back().second.find("risk order notional") != std::string::npos);
+        me.applyOrder(std::make_unique<an::LimitOrder >(  5,"Client1", an::ME,"APPL",an::SELL,50,171.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  6,"Client1", an::ME,"APPL",an::SELL,30,172.0));
+        BOOST_CHECK(sent.back().second.find("risk gross exposure") != std::string::npos);
+        BOOST_CHECK(me.stats().active_trades == 2);
+        BOOST_CHECK_CLOSE(me.risk("Client1")->exposure(), 17050.0, 1e-9);
+
+        // Fill moves open to executed on both sides
+        me.applyOrder(std::make_unique<an::LimitOrder >(  7,"Client2", an::ME,"APPL",an::BUY,20,171.0));
+        BOOST_CHECK_CLOSE(me.risk("Client1")->open, 8500.0 + 30 * 171.0, 1e-9);
+        BOOST_CHECK_CLOSE(me.risk("Client1")->executed, 20 * 171.0, 1e-9);
+        BOOST_CHECK_SMALL(me.risk("Client2")->open, 1e-9);
+        BOOST_CHECK_CLOSE(me.risk("Client2")->executed, 20 * 171.0, 1e-9);
+
+        // Cancel releases, amends are size and collar checked
+        me.applyOrder(std::make_unique<an::CancelOrder>(  2,"Client1", an::ME,"APPL"));
+        BOOST_CHECK_CLOSE(me.risk("Client1")->open, 30 * 171.0, 1e-9);
+        me.applyOrder(std::make_unique<an::AmendOrder>(  5,"Client1", an::ME,"APPL", an::shares_t(200)));
+        BOOST_CHECK(sent.back().second.find("risk order size") != std::string::npos);
+        me.applyOrder(std::make_unique<an::AmendOrder>(  5,"Client1", an::ME,"APPL", 190.0));
+        BOOST_CHECK(sent.back().second.find("risk price collar") != std::string::npos);
+        BOOST_CHECK(me.risk("Client1")->rejects == 6);
+        BOOST_CHECK(me.stats().rejects       == 6);
+        BOOST_CHECK(me.risk("Client3")       == nullptr);
+        me.close();
+        BOOST_CHECK_SMALL(me.risk("Client1")->open, 1e-9);
+    }
+    BOOST_AUTO_TEST_CASE(risk_02) { // Amends are accounted
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        std::vector<std::pair<an::location_t, an::transport_msg_t>> sent;
+        courier.deliverTo( [&sent](const an::location_t& to, const an::transport_msg_t& msg) {
+            sent.emplace_back(to, msg);
+        } );
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+        an::risk_limits_t limits;
+        limits.max_notional = 10000.0;
+        limits.collar = 0.05;
+        limits.max_exposure = 15500.0;
+        me.setDefaultRiskLimits(limits);
+
+        me.applyOrder(std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::BUY,50,170.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  2,"Client1", an::ME,"APPL",an::SELL,30,179.0));
+        BOOST_REQUIRE(me.risk("Client1") != nullptr);
+        BOOST_CHECK_CLOSE(me.risk("Client1")->open, 50 * 170.0 + 30 * 179.0, 1e-9);
+
+        // Shares up
+        me.applyOrder(std::make_unique<an::AmendOrder>(  2,"Client1", an::ME,"APPL", an::shares_t(40)));
+        BOOST_CHECK(sent.back().second.find("risk gross exposure") != std::string::npos);
+        BOOST_CHECK_CLOSE(me.risk("Client1")->open, 50 * 170.0 + 30 * 179.0, 1e-9);
+        me.applyOrder(std::make_unique<an::AmendOrder>(  1,"Client1", an::ME,"APPL", an::shares_t(57)));
+        BOOST_CHECK(sent.back().second.find("AMEND") != std::string::npos);
+        BOOST_CHECK_CLOSE(me.risk("Client1")->open, 57 * 170.0 + 30 * 179.0, 1e-9);
+
+        // Price up
+        me.applyOrder(std::make_unique<an::AmendOrder>(  1,"Client1", an::ME,"APPL", 175.0));
+        BOOST_CHECK(sent.back().second.find("AMEND") != std::string::npos);
+        BOOST_CHECK_CLOSE(me.risk("Client1")->open, 57 * 175.0 + 30 * 179.0, 1e-9);
+        me.applyOrder(std::make_unique<an::AmendOrder>(  1,"Client1", an::ME,"APPL", 176.0));
+        BOOST_CHECK(sent.back().second.find("risk order notional") != std::string::npos);
+        BOOST_CHECK_CLOSE(me.risk("Client1")->open, 57 * 175.0 + 30 * 179.0, 1e-9);
+
+        // Turned down by the book, put back
+        me.applyOrder(std::make_unique<an::AmendOrder>(  1,"Client1", an::ME,"APPL", 174.0001));
+        BOOST_CHECK(sent.back().second.find("Invalid tick price") != std::string::npos);
+        BOOST_CHECK_CLOSE(me.risk("Client1")->open, 57 * 175.0 + 30 * 179.0, 1e-9);
+        BOOST_CHECK(me.risk("Client1")->rejects == 2);
+        me.close();
+        BOOST_CHECK_SMALL(me.risk("Client1")->open, 1e-9);
+    }
+    BOOST_AUTO_TEST_CASE(risk_03) { // No reference price, no collar
+        an::PreTradeRisk risk;
+        an::risk_limits_t limits;
+        limits.collar = 0.05;
+        risk.setDefaultLimits(limits);
+        an::LimitOrder lim01a(  1,"Client1", an::ME,"NEWCO",an::BUY,10,10.0);
+        BOOST_CHECK(risk.check(lim01a, an::LIMIT, 10, 10.0, 0.0) == nullptr);
+        an::AmendOrder amd01b(  1,"Client1", an::ME,"NEWCO", 11.0);
+        BOOST_CHECK(risk.checkAmend(lim01a, amd01b.amend(), 0.0) == nullptr);
+        BOOST_CHECK_CLOSE(risk.find("Client1")->open, 10 * 11.0, 1e-9);
+        BOOST_CHECK(risk.check(lim01a, an::LIMIT, 10, 12.0, 10.0) != nullptr);
+    }
+    BOOST_AUTO_TEST_CASE(risk_04) { // Slot resolved once, stamped on the orders
+        an::PreTradeRisk risk;
+        an::risk_limits_t limits;
+        limits.max_order_shares = 100;
+        risk.setDefaultLimits(limits);
+        const std::uint32_t slot = risk.slotFor("Client1");
+        BOOST_CHECK(risk.slotFor("Client1")  == slot);
+        BOOST_CHECK(risk.slotFor("Client2")  != slot);
+        BOOST_CHECK(risk.find("Client1")     == nullptr); // No orders yet
+        an::LimitOrder lim01a(  1,"Client1", an::ME,"APPL",an::BUY,10,170.0);
+        lim01a.setRiskSlot(slot);
+        BOOST_CHECK(risk.check(lim01a, an::LIMIT, 10, 170.0, 171.07) == nullptr);
+        BOOST_CHECK(lim01a.riskAccount().slot == slot);
+        BOOST_REQUIRE(risk.find("Client1")   != nullptr);
+        BOOST_CHECK_CLOSE(risk.find("Client1")->open, 10 * 170.0, 1e-9);
+        BOOST_CHECK(risk.find("Client2")     == nullptr);
+        // Not stamped, looked up and then stamped
+        an::LimitOrder lim02a(  2,"Client1", an::ME,"APPL",an::BUY,200,169.0);
+        BOOST_CHECK(risk.check(lim02a, an::LIMIT, 200, 169.0, 171.07) != nullptr);
+        BOOST_CHECK(lim02a.riskSlot()        == slot);
+        BOOST_CHECK(risk.find("Client1")->rejects == 1);
+    }
+    BOOST_AUTO_TEST_CASE(engine_time_01) {
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        std::vector<an::market_data_t> published;
+        courier.publishTo( [&published](const an::market_data_t& md) { published.push_back(md); } );
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+
+        // Every event of the cycle has the time it started
+        const an::since_t start = me.epoch().steadyClockStartTime + std::chrono::hours(1);
+        me.tick(start);
+        BOOST_CHECK(me.now() == start);
+        me.applyOrder(std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::SELL,5,172.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  2,"Client2", an::ME,"APPL",an::BUY,5,172.0));
+        BOOST_CHECK(me.publish()             == 1);
+        BOOST_REQUIRE(published.size()       == 1);
+        BOOST_CHECK(published[0].trade_time  == an::sinceToString(start, me.epoch()));
+        BOOST_CHECK(published[0].quote_time  == published[0].trade_time);
+
+        // Outside a cycle the clock is read
+        BOOST_CHECK(me.now()                 <  start - std::chrono::minutes(59));
+        me.close();
+    }
     BOOST_AUTO_TEST_CASE(trades_02) {
         an::TickLadder tickdb;
         tickdb.loadData("NXT_ticksize.txt");
@@ -1289,5 +2165,185 @@ BOOST_AUTO_TEST_SUITE(matching_engine)
         BOOST_CHECK(stats.open_books         == 0); // All closed
         BOOST_CHECK(stats.cancels            == 1);
     }
+    BOOST_AUTO_TEST_CASE(stop_seq_01) { // Iceberg refresh then a stop election
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        std::vector<std::pair<an::location_t, an::transport_msg_t>> sent;
+        courier.deliverTo( [&sent](const an::location_t& to, const an::transport_msg_t& msg) {
+            sent.emplace_back(to, msg);
+        } );
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+
+        auto stp01a = std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::SELL,10,173.0);
+        stp01a->setStopPrice(172.0);
+        me.applyOrder(std::move(stp01a));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  2,"Client2", an::ME,"APPL",an::SELL,10,173.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  3,"Client3", an::ME,"APPL",an::BUY,20,172.0,10));
+        // Takes the peak, the iceberg refreshes and the trade elects the stop
+        me.applyOrder(std::make_unique<an::LimitOrder >(  4,"Client4", an::ME,"APPL",an::SELL,10,172.0));
+        BOOST_CHECK(me.stats().active_trades == 3);
+        me.applyOrder(std::make_unique<an::LimitOrder >(  5,"Client4", an::ME,"APPL",an::SELL,10,172.0));
+        BOOST_CHECK(me.stats().active_trades == 2);
+
+        // The stop rests behind the order that arrived while it waited
+        sent.clear();
+        me.applyOrder(std::make_unique<an::LimitOrder >(  6,"Client5", an::ME,"APPL",an::BUY,10,173.0));
+        BOOST_CHECK(me.stats().active_trades == 1);
+        BOOST_CHECK(std::none_of(sent.begin(), sent.end(),
+            [](const std::pair<an::location_t, an::transport_msg_t>& m) { return m.first == "Client1"; }));
+        BOOST_CHECK(std::any_of(sent.begin(), sent.end(),
+            [](const std::pair<an::location_t, an::transport_msg_t>& m) { return m.first == "Client2"; }));
+        me.close();
+    }
+    BOOST_AUTO_TEST_CASE(reload_01) {
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+
+        auto lim01a = std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::SELL,5,172.0);
+        me.applyOrder(std::move(lim01a));
+        auto lim02a = std::make_unique<an::LimitOrder >(  2,"Client1", an::ME,"IBM",an::BUY,5,153.9612);
+        me.applyOrder(std::move(lim02a)); // Not on a 0.01 tick
+        auto stats = me.stats();
+        BOOST_CHECK(stats.active_trades      == 1);
+        BOOST_CHECK(stats.rejects            == 1);
+
+        // APPL delisted, NEWCO listed, IBM moves to a 0.000001 ladder
+        const std::string filename = "/tmp/unittest_reload.csv";
+        {
+            std::ofstream os(filename);
+            os << "id,exchange,symbol,closing_price,outstanding_shares,born,has_died,died,tradeable,tick_ladder_id\n"
+               << "1000,ME,APPL,171.07,5134312000,1980-12-12,Y,2018-06-01,Y,1\n"
+               << "666,ME,ENE,0.062,750000000,1985-07-01,Y,2002-01-16,N,1\n"
+               << "99,ME,IBM,153.96,925791000,1924-02-14,N,0000-00-00,Y,96\n"
+               << "450,ME,MSFT,91.49,7714590000,1986-03-13,N,0000-00-00,Y,1\n"
+               << "100,FTSE,VOD.L,216.0,26675600000,1988-10-25,N,0000-00-00,Y,1\n"
+               << "66,ME,GE,14.49,8672085000,1978-01-13,N,0000-00-00,Y,1\n"
+               << "1001,ME,NEWCO,10.0,1000000,2018-06-01,N,0000-00-00,Y,1\n";
+        }
+        auto next = std::make_shared<an::SecurityMaster>(an::ME);
+        next->tickLadder().loadData("NXT_ticksize.txt");
+        next->secdb().loadData(filename);
+        std::remove(filename.c_str());
+        me.reload(next);
+        BOOST_CHECK(me.stats().active_trades == 1); // Applied on the next cycle
+        me.publish();
+        BOOST_CHECK(!me.applyReload()); // Nothing pending
+
+        stats = me.stats();
+        BOOST_CHECK(stats.symbols            == 7);
+        BOOST_CHECK(stats.open_books         == 4); // IBM, MSFT, GE and NEWCO
+        BOOST_CHECK(stats.cancels            == 1); // APPL order
+
+        auto lim03a = std::make_unique<an::LimitOrder >(  3,"Client1", an::ME,"APPL",an::SELL,5,172.0);
+        me.applyOrder(std::move(lim03a));
+        auto lim04a = std::make_unique<an::LimitOrder >(  4,"Client1", an::ME,"IBM",an::BUY,5,153.9612);
+        me.applyOrder(std::move(lim04a));
+        auto lim05a = std::make_unique<an::LimitOrder >(  5,"Client1", an::ME,"NEWCO",an::BUY,5,10.0);
+        me.applyOrder(std::move(lim05a));
+        stats = me.stats();
+        BOOST_CHECK(stats.rejects            == 2); // APPL not found
+        BOOST_CHECK(stats.buy.trades         == 2); // IBM and NEWCO
+
+        me.close();
+    }
+    BOOST_AUTO_TEST_CASE(reload_02) { // Invalid ladder then valid again
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+        auto reload = [&me](const char* ladder) {
+            const std::string filename = "/tmp/unittest_reload.csv";
+            {
+                std::ofstream os(filename);
+                os << "id,exchange,symbol,closing_price,outstanding_shares,born,has_died,died,tradeable,tick_ladder_id\n"
+                   << "450,ME,MSFT,91.49,7714590000,1986-03-13,N,0000-00-00,Y," << ladder << "\n";
+            }
+            auto next = std::make_shared<an::SecurityMaster>(an::ME);
+            next->tickLadder().loadData("NXT_ticksize.txt");
+            next->secdb().loadData(filename);
+            std::remove(filename.c_str());
+            me.reload(next);
+            me.publish();
+        };
+
+        me.applyOrder(std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"MSFT",an::BUY,5,91.0));
+        BOOST_CHECK(me.stats().active_trades == 1);
+        reload("999");
+        auto stats = me.stats();
+        BOOST_CHECK(stats.open_books         == 0);
+        BOOST_CHECK(stats.cancels            == 1);
+        me.applyOrder(std::make_unique<an::LimitOrder >(  2,"Client1", an::ME,"MSFT",an::BUY,5,91.0));
+        BOOST_CHECK(me.stats().rejects       == 1); // Book not open
+
+        reload("1");
+        stats = me.stats();
+        BOOST_CHECK(stats.open_books         == 1);
+        me.applyOrder(std::make_unique<an::LimitOrder >(  3,"Client1", an::ME,"MSFT",an::BUY,5,91.0));
+        stats = me.stats();
+        BOOST_CHECK(stats.rejects            == 1);
+        BOOST_CHECK(stats.buy.trades         == 1 + 1); // Old book keeps its day
+        me.close();
+    }
+    BOOST_AUTO_TEST_CASE(reload_03) { // Two reloads queued before one cycle
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+        auto reload = [&me](const char* rows) {
+            const std::string filename = "/tmp/unittest_reload.csv";
+            {
+                std::ofstream os(filename);
+                os << "id,exchange,symbol,closing_price,outstanding_shares,born,has_died,died,tradeable,tick_ladder_id\n"
+                   << rows;
+            }
+            auto next = std::make_shared<an::SecurityMaster>(an::ME);
+            next->tickLadder().loadData("NXT_ticksize.txt");
+            next->secdb().loadData(filename);
+            std::remove(filename.c_str());
+            me.reload(next); // Released here, the engine holds copies of its tables
+        };
+
+        me.applyOrder(std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"MSFT",an::BUY,5,91.0));
+        reload("450,ME,MSFT,91.49,7714590000,1986-03-13,N,0000-00-00,Y,1\n"
+               "1001,ME,NEWCO,10.0,1000000,2018-06-01,N,0000-00-00,Y,1\n"
+               "1002,ME,NEWCO2,20.0,1000000,2018-06-01,N,0000-00-00,Y,1\n"
+               "1003,ME,NEWCO3,30.0,1000000,2018-06-01,N,0000-00-00,Y,1\n");
+        // Before any of their books exist NEWCO's ladder changes, NEWCO2 carries
+        // on and NEWCO3 is delisted, the books are found by symbol
+        reload("450,ME,MSFT,91.49,7714590000,1986-03-13,N,0000-00-00,Y,1\n"
+               "1001,ME,NEWCO,10.0,1000000,2018-06-01,N,0000-00-00,Y,96\n"
+               "1002,ME,NEWCO2,20.0,1000000,2018-06-01,N,0000-00-00,Y,1\n");
+        me.publish();
+        auto stats = me.stats();
+        BOOST_CHECK(stats.symbols            == 6 + 3);
+        BOOST_CHECK(stats.open_books         == 3);
+        BOOST_CHECK(stats.active_trades      == 1); // MSFT unchanged, its order stays
+
+        me.applyOrder(std::make_unique<an::LimitOrder >(  2,"Client1", an::ME,"NEWCO",an::BUY,5,10.000001));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  3,"Client1", an::ME,"NEWCO2",an::BUY,5,20.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  4,"Client1", an::ME,"IBM",an::BUY,5,150.0));
+        stats = me.stats();
+        BOOST_CHECK(stats.active_trades      == 3);
+        BOOST_CHECK(stats.rejects            == 1); // IBM delisted
+
+        // The books the engine listed are known to the next reload
+        reload("450,ME,MSFT,91.49,7714590000,1986-03-13,N,0000-00-00,Y,1\n");
+        me.publish();
+        stats = me.stats();
+        BOOST_CHECK(stats.open_books         == 1);
+        BOOST_CHECK(stats.cancels            == 2);
+        me.close();
+    }
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -10,6 +10,8 @@ BOOST_AUTO_TEST_SUITE(all_orders)
         BOOST_CHECK_EQUAL(lo1.to_string(),"type=LIMIT:id=11:origin=Client2:destination=ME:symbol=IBM:direction=SELL:shares=10:price=5.12");
         an::LimitOrder lo2(1234,"ClientA",an::ME,"APPL",an::BUY,99,15.12);
         BOOST_CHECK_EQUAL(lo2.to_string(),"type=LIMIT:id=1234:origin=ClientA:destination=ME:symbol=APPL:direction=BUY:shares=99:price=15.12");
+        an::LimitOrder lo3(12,"Client2",an::ME,"IBM",an::SELL,100,5.12,10); // Iceberg
+        BOOST_CHECK_EQUAL(lo3.to_string(),"type=LIMIT:id=12:origin=Client2:destination=ME:symbol=IBM:direction=SELL:shares=100:price=5.12:display=10");
     }
     BOOST_AUTO_TEST_CASE(market_order01) {
         an::MarketOrder lo1(11,"Client2",an::ME,"IBM",an::SELL,10);
@@ -37,6 +39,48 @@ BOOST_AUTO_TEST_SUITE(make_orders)
         std::unique_ptr<an::Order> o1(a.makeOrder("origin=Client1:destination=ME:symbol=MSFT:direction=BUY:price=92.0:shares=50:type=LIMIT:id=123"));
         BOOST_CHECK_EQUAL(o1->to_string(),"type=LIMIT:id=123:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50:price=92.0");
     }
+    BOOST_AUTO_TEST_CASE(iceberg_order01) {
+        std::unique_ptr<an::Order> o1(a.makeOrder("type=LIMIT:id=124:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:price=92.0:shares=500:display=50"));
+        BOOST_CHECK_EQUAL(o1->to_string(),"type=LIMIT:id=124:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=500:price=92.0:display=50");
+        std::unique_ptr<an::Order> o2(a.makeOrder("type=LIMIT:id=125:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:price=92.0:shares=500"));
+        BOOST_CHECK_EQUAL(o2->to_string(),"type=LIMIT:id=125:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=500:price=92.0");
+        std::unique_ptr<an::Message> o3(an::Message::makeOrder("type=LIMIT:id=126:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:price=92.0:shares=500:display=50"));
+        BOOST_CHECK_EQUAL(o3->to_string(),"type=LIMIT:id=126:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=500:price=92.0:display=50");
+    }
+    BOOST_AUTO_TEST_CASE(tif_order01) {
+        std::unique_ptr<an::Order> o1(a.makeOrder("type=LIMIT:id=127:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:price=92.0:shares=50:tif=IOC"));
+        BOOST_CHECK_EQUAL(o1->to_string(),"type=LIMIT:id=127:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50:price=92.0:tif=IOC");
+        std::unique_ptr<an::Order> o2(a.makeOrder("type=MARKET:id=128:origin=Client1:destination=ME:symbol=MSFT:direction=SELL:shares=50:tif=FOK"));
+        BOOST_CHECK_EQUAL(o2->to_string(),"type=MARKET:id=128:origin=Client1:destination=ME:symbol=MSFT:direction=SELL:shares=50:tif=FOK");
+        std::unique_ptr<an::Order> o3(a.makeOrder("type=LIMIT:id=129:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:price=92.0:shares=50:tif=DAY"));
+        BOOST_CHECK_EQUAL(o3->to_string(),"type=LIMIT:id=129:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50:price=92.0");
+        std::unique_ptr<an::Message> o4(an::Message::makeOrder("type=LIMIT:id=130:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:price=92.0:shares=50:tif=FOK"));
+        BOOST_CHECK_EQUAL(o4->to_string(),"type=LIMIT:id=130:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50:price=92.0:tif=FOK");
+    }
+    BOOST_AUTO_TEST_CASE(mass_cancel01) {
+        std::unique_ptr<an::Order> o1(a.makeOrder("type=MASSCANCEL:id=135:origin=Client1:destination=ME"));
+        BOOST_CHECK_EQUAL(o1->to_string(),"type=MASSCANCEL:id=135:origin=Client1:destination=ME");
+        std::unique_ptr<an::Order> o2(a.makeOrder("type=MASSCANCEL:id=136:origin=Client1:destination=ME:symbol=MSFT:direction=SELL"));
+        BOOST_CHECK_EQUAL(o2->to_string(),"type=MASSCANCEL:id=136:origin=Client1:destination=ME:symbol=MSFT:direction=SELL");
+        std::unique_ptr<an::Order> o3(a.makeOrder("type=MASSCANCEL:id=137:origin=Client1:destination=ME:direction=BUY"));
+        BOOST_CHECK_EQUAL(o3->to_string(),"type=MASSCANCEL:id=137:origin=Client1:destination=ME:direction=BUY");
+        BOOST_CHECK(o3->symbol().empty());
+        std::unique_ptr<an::Message> o4(an::Message::makeOrder("type=MASSCANCEL:id=138:origin=Client1:destination=ME:symbol=MSFT"));
+        BOOST_CHECK_EQUAL(o4->to_string(),"type=MASSCANCEL:id=138:origin=Client1:destination=ME:symbol=MSFT");
+        BOOST_CHECK_EXCEPTION( (void)a.makeOrder("type=MASSCANCEL:id=139:origin=Client1:destination=ME:shares=10"),
+                               an::OrderError, [](const an::OrderError&) { return true; } );
+    }
+    BOOST_AUTO_TEST_CASE(stop_order01) {
+        std::unique_ptr<an::Order> o1(a.makeOrder("type=MARKET:id=131:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50:stop=93.5"));
+        BOOST_CHECK_EQUAL(o1->to_string(),"type=MARKET:id=131:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50:stop=93.5");
+        BOOST_CHECK(dynamic_cast<an::Execution*>(o1.get())->stopPrice() == 93.5);
+        std::unique_ptr<an::Order> o2(a.makeOrder("type=LIMIT:id=132:origin=Client1:destination=ME:symbol=MSFT:direction=SELL:price=90.0:shares=50:stop=90.5:tif=IOC"));
+        BOOST_CHECK_EQUAL(o2->to_string(),"type=LIMIT:id=132:origin=Client1:destination=ME:symbol=MSFT:direction=SELL:shares=50:price=90.0:tif=IOC:stop=90.5");
+        std::unique_ptr<an::Order> o3(a.makeOrder("type=LIMIT:id=133:origin=Client1:destination=ME:symbol=MSFT:direction=SELL:price=90.0:shares=50"));
+        BOOST_CHECK(dynamic_cast<an::Execution*>(o3.get())->stopPrice() == 0.0);
+        std::unique_ptr<an::Message> o4(an::Message::makeOrder("type=LIMIT:id=134:origin=Client1:destination=ME:symbol=MSFT:direction=SELL:price=90.0:shares=50:stop=90.5"));
+        BOOST_CHECK_EQUAL(o4->to_string(),"type=LIMIT:id=134:origin=Client1:destination=ME:symbol=MSFT:direction=SELL:shares=50:price=90.0:stop=90.5");
+    }
     BOOST_AUTO_TEST_CASE(market_order01) {
         std::unique_ptr<an::Order> o2(a.makeOrder("type=MARKET:id=123:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50"));
         BOOST_CHECK_EQUAL(o2->to_string(),"type=MARKET:id=123:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50");
@@ -51,6 +95,16 @@ BOOST_AUTO_TEST_SUITE(make_orders)
         std::unique_ptr<an::Order> o2(a.makeOrder("type=AMEND:id=123:origin=Client1:destination=ME:symbol=APPL:shares=99"));
         BOOST_CHECK_EQUAL(o2->to_string(),"type=AMEND:id=123:origin=Client1:destination=ME:symbol=APPL:shares=99");
     }
+    BOOST_AUTO_TEST_CASE(pstring_order01) {
+        // Frames are parsed in place, no terminator or ownership
+        const char buf[] = "type=LIMIT:id=7:origin=Client1:destination=ME:symbol=IBM:direction=SELL:shares=5:price=1.5\n"
+                           "type=CANCEL:id=7:origin=Client1:destination=ME:symbol=IBM\n";
+        const char* second = std::strchr(buf, '\n') + 1;
+        std::unique_ptr<an::Order> o1(a.makeOrder(an::PString(buf, second - buf - 1)));
+        BOOST_CHECK_EQUAL(o1->to_string(),"type=LIMIT:id=7:origin=Client1:destination=ME:symbol=IBM:direction=SELL:shares=5:price=1.5");
+        std::unique_ptr<an::Order> o2(a.makeOrder(an::PString(second, std::strlen(second) - 1)));
+        BOOST_CHECK_EQUAL(o2->to_string(),"type=CANCEL:id=7:origin=Client1:destination=ME:symbol=IBM");
+    }
 BOOST_AUTO_TEST_SUITE_END()
 
 
@@ -234,6 +288,14 @@ BOOST_AUTO_TEST_SUITE(make_orders_bad)
         BOOST_CHECK_EXCEPTION( (void)a.makeOrder("type=MARKET:id=123:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50:price=92.0"),  // price not needed
         an::OrderError, CheckMessage("Invalid flags -Price") );
     }
+    BOOST_AUTO_TEST_CASE(limit_bad_tif_01) {
+        BOOST_CHECK_EXCEPTION( (void)a.makeOrder("type=LIMIT:id=123:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50:price=92.0:tif=GTC"),
+        an::OrderError, CheckMessage("Reader [tif] did not process [tif,GTC]") );
+    }
+    BOOST_AUTO_TEST_CASE(market_extra_display_01) {
+        BOOST_CHECK_EXCEPTION( (void)a.makeOrder("type=MARKET:id=123:origin=Client1:destination=ME:symbol=MSFT:direction=BUY:shares=50:display=5"),  // Only limit orders
+        an::OrderError, CheckMessage("Invalid flags -Display") );
+    }
     BOOST_AUTO_TEST_CASE(amend_missing_id_01) {
         BOOST_CHECK_EXCEPTION( (void)a.makeOrder("type=AMEND:origin=Client1:destination=ME:symbol=APPL:shares=50"),
         an::OrderError, CheckMessage("Invalid flags +Id/Seq") );
@@ -3,6 +3,9 @@
 
 #include <boost/test/unit_test.hpp>
 #include "security_master.hpp"
+#include <fstream>
+#include <cstdio>
+#include <iterator>
 
 BOOST_AUTO_TEST_SUITE(tick_table_row_ok)
     BOOST_AUTO_TEST_CASE(tick_table_row_ctor_01) {
@@ -92,7 +95,8 @@ BOOST_AUTO_TEST_SUITE(tick_table)
         BOOST_CHECK( tt.validatePrice(0.9));
         BOOST_CHECK( tt.validatePrice(1.0));
         BOOST_CHECK( tt.validatePrice(2.0));
-        BOOST_CHECK( tt.validatePrice(8.9999999));  // Ok treated as 9.0
+        BOOST_CHECK(!tt.validatePrice(8.9999999));  // Fails, a whole PRICE_EPSILON unit off 9.0
+        BOOST_CHECK( tt.validatePrice(8.99999999)); // Ok treated as 9.0
         BOOST_CHECK( tt.validatePrice(9.0));
         BOOST_CHECK( tt.validatePrice(1.00000001)); // OK treated as 1.0
         BOOST_CHECK(!tt.validatePrice(1.0000001));  // Fails (as expected) not 1.0
@@ -145,6 +149,36 @@ BOOST_AUTO_TEST_SUITE(tick_table)
         BOOST_CHECK(!tt.validatePrice(100000.01)); //Fails,tick 0.05
         BOOST_CHECK( tt.validatePrice(100000.05)); //Ok
     }
+    BOOST_AUTO_TEST_CASE(tick_table_bands_01) {
+        an::TickTable tt;
+        tt.add(an::tick_table_row_t(    1,   1));
+        tt.add(an::tick_table_row_t(  500,   5));
+        tt.add(an::tick_table_row_t( 2500,  10));
+        tt.add(an::tick_table_row_t( 5000,  25));
+        tt.add(an::tick_table_row_t(25000,  50));
+        tt.add(an::tick_table_row_t(50000, 100));
+
+        BOOST_CHECK(!tt.validatePrice(0.0)); // Below first band
+        BOOST_CHECK( tt.validatePrice(1.0));
+        BOOST_CHECK( tt.validatePrice(499.0));
+        BOOST_CHECK( tt.validatePrice(500.0)); // Band edges
+        BOOST_CHECK(!tt.validatePrice(501.0));
+        BOOST_CHECK( tt.validatePrice(2495.0));
+        BOOST_CHECK( tt.validatePrice(2500.0));
+        BOOST_CHECK(!tt.validatePrice(2505.0));
+        BOOST_CHECK( tt.validatePrice(5025.0));
+        BOOST_CHECK(!tt.validatePrice(25025.0));
+        BOOST_CHECK( tt.validatePrice(49950.0));
+        BOOST_CHECK(!tt.validatePrice(50050.0));
+        BOOST_CHECK( tt.validatePrice(1e9));
+
+        an::price_t p = 5024.9999999999;
+        BOOST_CHECK( tt.validatePriceAndRound(p));
+        BOOST_CHECK(p == 5025.0);
+
+        tt.reset();
+        BOOST_CHECK(!tt.validatePrice(1.0)); // Empty
+    }
     BOOST_AUTO_TEST_CASE(tick_table_rounding_ok_01) {
         an::price_t p = 0.0;
         an::TickTable tt;
@@ -212,7 +246,7 @@ BOOST_AUTO_TEST_SUITE(tick_table)
             an::SecurityError, CheckMessage("Overlapping ranges in tick table") );
     }
     BOOST_AUTO_TEST_CASE(tick_ladder_load_01) {
-        an::TickTable* tt = nullptr;
+        const an::TickTable* tt = nullptr;
         an::TickLadder tickdb;
         tickdb.loadData("NXT_ticksize.txt");
 
@@ -240,6 +274,14 @@ BOOST_AUTO_TEST_SUITE(tick_table)
 
         BOOST_CHECK(tickdb.find(97) == nullptr);
         BOOST_CHECK(tickdb.find(20) == nullptr);
+
+        // Identical ladders share a table
+        BOOST_CHECK(tickdb.find(1) == tickdb.find(2));
+        BOOST_CHECK(tickdb.find(1) == tickdb.find(4));
+        BOOST_CHECK(tickdb.find(7) == tickdb.find(10));
+        BOOST_CHECK(tickdb.find(1) != tickdb.find(10));
+        BOOST_CHECK(tickdb.tables() < tickdb.ladders());
+        BOOST_CHECK_THROW(tickdb.addTickLadder(an::TickLadder::MAX_LADDER_ID + 1, *tickdb.find(1)), an::SecurityError);
     }
 
     BOOST_AUTO_TEST_CASE(secdb_load_01) {
@@ -292,4 +334,146 @@ BOOST_AUTO_TEST_SUITE(tick_table)
         BOOST_CHECK(secdb.tickTable(1)                   == nullptr); // Didn't load tickdb
         BOOST_CHECK(secdb.tickTable(5)                   == nullptr); // Didn't load tickdb
     }
+    BOOST_AUTO_TEST_CASE(secdb_load_parallel_01) {
+        // Columns in a different order plus one the loader ignores
+        const std::string filename = "/tmp/unittest_secdb_parallel.csv";
+        {
+            std::ofstream os(filename);
+            os << "symbol,id,exchange,comment,closing_price,outstanding_shares,born,has_died,died,tradeable,tick_ladder_id\r\n";
+            for (int i = 0; i < 5000; ++i) {
+                os << "SYM" << i << ',' << i + 1 << ",ME,none," << 1.5 + i << ',' << 1000 * i << ",2000-02-29,"
+                   << ((i % 10 == 0) ? "Y,2018-01-31" : "N,0000-00-00") << ",Y," << (i % 3) + 1 << "\r\n";
+                if (i % 1000 == 0) {
+                    os << "\n"; // Blank lines skipped
+                }
+            }
+        }
+        an::TickLadder tickdb;
+        an::SecurityDatabase single(an::ME, tickdb);
+        single.loadData(filename);
+        an::SecurityDatabase parallel(an::ME, tickdb);
+        parallel.loadData(filename, 4);
+        BOOST_REQUIRE(single.securities().size()         == 5000);
+        BOOST_REQUIRE(parallel.securities().size()       == 5000);
+        for (std::size_t i = 0; i < 5000; ++i) {
+            BOOST_CHECK(single.securities()[i].to_string() == parallel.securities()[i].to_string());
+        }
+        const an::security_record_t& sr = parallel.securities()[10];
+        BOOST_CHECK(sr.id                                == 11);
+        BOOST_CHECK(sr.symbol                            == "SYM10");
+        BOOST_CHECK(sr.exchange                          == "ME");
+        BOOST_CHECK(sr.closing_price                     == 11.5);
+        BOOST_CHECK(sr.outstanding_shares                == 10000);
+        BOOST_CHECK(an::dateToString(sr.born)            == "2000-02-29");
+        BOOST_CHECK(sr.has_died);
+        BOOST_CHECK(an::dateToString(sr.died)            == "2018-01-31");
+        BOOST_CHECK(sr.ladder_id                         == 2);
+        BOOST_CHECK(parallel.find("SYM10")               == an::SecurityDatabase::npos); // Died
+        BOOST_CHECK(parallel.find("SYM4999")             == 4999);
+        std::remove(filename.c_str());
+    }
+    BOOST_AUTO_TEST_CASE(secdb_load_bad_02) {
+        const std::string filename = "/tmp/unittest_secdb_bad.csv";
+        an::TickLadder tickdb;
+        {
+            std::ofstream os(filename);
+            os << "id,exchange,symbol,closing_price,outstanding_shares,born,has_died,died,tradeable\n";
+        }
+        an::SecurityDatabase secdb1(an::ME, tickdb);
+        BOOST_CHECK_EXCEPTION(secdb1.loadData(filename), an::SecurityError,
+            CheckMessage("Missing column tick_ladder_id in " + filename));
+        {
+            std::ofstream os(filename);
+            os << "id,exchange,symbol,closing_price,outstanding_shares,born,has_died,died,tradeable,tick_ladder_id\n"
+               << "1000,ME,APPL,171.07,5134312000,1980-12-12,N,0000-00-00,Y,1\n"
+               << "1001,ME,BAD,1.0,10,1980-02-30,N,0000-00-00,Y,1\n";
+        }
+        an::SecurityDatabase secdb2(an::ME, tickdb);
+        BOOST_CHECK_EXCEPTION(secdb2.loadData(filename), an::SecurityError,
+            CheckMessage("security database line 3: bad born date"));
+        BOOST_CHECK_THROW(secdb2.loadData("/tmp/does_not_exist.csv"), an::SecurityError);
+        std::remove(filename.c_str());
+    }
+    BOOST_AUTO_TEST_CASE(secdb_image_01) {
+        const std::string filename = "/tmp/unittest_secdb.img";
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase csv(an::ME, tickdb);
+        csv.loadData("security_database.csv");
+        csv.saveImage(filename);
+
+        an::TickLadder imageTickdb;
+        an::SecurityDatabase secdb(an::ME, imageTickdb);
+        secdb.loadImage(filename);
+        BOOST_REQUIRE(secdb.securities().size()          == csv.securities().size());
+        for (std::size_t i = 0; i < csv.securities().size(); ++i) {
+            BOOST_CHECK_EQUAL(secdb.securities()[i].to_string(), csv.securities()[i].to_string());
+            BOOST_CHECK_EQUAL(secdb.securities()[i].exchange, csv.securities()[i].exchange);
+        }
+        BOOST_CHECK(secdb.find("APPL")                   == 0);
+        BOOST_CHECK(secdb.find("IBM")                    == 2);
+        BOOST_CHECK(secdb.find("GE")                     == 5);
+        BOOST_CHECK(secdb.find("ENE")                    == an::SecurityDatabase::npos); // Died
+        BOOST_CHECK(secdb.find("VOD.L")                  == an::SecurityDatabase::npos); // Other exchange
+        BOOST_CHECK(secdb.find("UNKNOWN")                == an::SecurityDatabase::npos);
+
+        // Same ladders and the same sharing of tables
+        BOOST_CHECK(imageTickdb.ladders()                == tickdb.ladders());
+        BOOST_CHECK(imageTickdb.tables()                 == tickdb.tables());
+        for (an::ladder_id_t id = 0; id < tickdb.idLimit(); ++id) {
+            BOOST_REQUIRE((imageTickdb.find(id) == nullptr) == (tickdb.find(id) == nullptr));
+            if (tickdb.find(id) != nullptr) {
+                BOOST_CHECK(*imageTickdb.find(id) == *tickdb.find(id));
+            }
+        }
+        BOOST_CHECK(imageTickdb.find(1)                  == imageTickdb.find(2));
+        BOOST_CHECK(secdb.tickTable(secdb.find("APPL"))  != nullptr);
+
+        // Loading CSV afterwards goes back to the maps
+        secdb.loadData("security_database.csv");
+        BOOST_CHECK(secdb.securities().size()            == 12);
+        BOOST_CHECK(secdb.find("GE")                     == 5);
+        std::remove(filename.c_str());
+    }
+    BOOST_AUTO_TEST_CASE(secdb_image_bad_01) {
+        const std::string filename = "/tmp/unittest_secdb_bad.img";
+        an::TickLadder tickdb;
+        an::SecurityDatabase csv(an::ME, tickdb);
+        csv.loadData("security_database.csv");
+        csv.saveImage(filename);
+
+        std::string image;
+        {
+            std::ifstream is(filename, std::ios::binary);
+            image.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+        }
+        auto rewrite = [&filename](const std::string& data) {
+            std::ofstream os(filename, std::ios::binary | std::ios::trunc);
+            os.write(data.data(), data.size());
+        };
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        std::string corrupt = image;
+        corrupt[corrupt.size() / 2] ^= 0x20;
+        rewrite(corrupt);
+        BOOST_CHECK_EXCEPTION(secdb.loadImage(filename), an::SecurityError,
+            CheckMessage("Checksum mismatch in security master image " + filename));
+
+        corrupt = image;
+        corrupt[0] = 'X';
+        rewrite(corrupt);
+        BOOST_CHECK_EXCEPTION(secdb.loadImage(filename), an::SecurityError,
+            CheckMessage("Not a security master image " + filename));
+
+        corrupt = image;
+        corrupt[8] = 2; // Version
+        rewrite(corrupt);
+        BOOST_CHECK_EXCEPTION(secdb.loadImage(filename), an::SecurityError,
+            CheckMessage("Unsupported security master image version 2 in " + filename));
+
+        rewrite(image.substr(0, image.size() - 8));
+        BOOST_CHECK_EXCEPTION(secdb.loadImage(filename), an::SecurityError,
+            CheckMessage("Truncated security master image " + filename));
+        BOOST_CHECK(secdb.securities().empty());
+        std::remove(filename.c_str());
+    }
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,432 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Test Transport
+
+#include <boost/test/unit_test.hpp>
+#include "framing.hpp"
+#include "gateway.hpp"
+#include "market_data.hpp"
+#include "security_master.hpp"
+#include "matching_engine.hpp"
+
+typedef an::LineFramer<32> Framer;
+
+void write(Framer& f, const std::string& s) {
+    BOOST_REQUIRE(s.size() <= f.writeSpace());
+    std::memcpy(f.writePtr(), s.data(), s.size());
+    f.commit(s.size());
+}
+
+BOOST_AUTO_TEST_SUITE(line_framer)
+    BOOST_AUTO_TEST_CASE(frames_01) {
+        Framer f;
+        std::vector<std::string> got;
+        auto collect = [&got](an::PString p) { got.push_back(p.to_string()); };
+
+        write(f, "one\ntwo\nthree\n");
+        BOOST_CHECK(f.parse(collect) == 3);
+        BOOST_CHECK(got.size() == 3);
+        BOOST_CHECK(got[0] == "one");
+        BOOST_CHECK(got[1] == "two");
+        BOOST_CHECK(got[2] == "three");
+        BOOST_CHECK(f.pending() == 0);
+        BOOST_CHECK(f.writeSpace() == 32);
+        BOOST_CHECK(f.frames() == 3);
+    }
+    BOOST_AUTO_TEST_CASE(partial_01) {
+        Framer f;
+        std::vector<std::string> got;
+        auto collect = [&got](an::PString p) { got.push_back(p.to_string()); };
+
+        write(f, "type=LIM");
+        BOOST_CHECK(f.parse(collect) == 0);
+        BOOST_CHECK(f.pending() == 8);
+        write(f, "IT\nid=");
+        BOOST_CHECK(f.parse(collect) == 1);
+        BOOST_CHECK(got.back() == "type=LIMIT");
+        BOOST_CHECK(f.pending() == 3); // id= moved to front
+        BOOST_CHECK(f.writeSpace() == 32 - 3);
+        write(f, "1\n");
+        BOOST_CHECK(f.parse(collect) == 1);
+        BOOST_CHECK(got.back() == "id=1");
+    }
+    BOOST_AUTO_TEST_CASE(trim_01) {
+        Framer f;
+        std::vector<std::string> got;
+        auto collect = [&got](an::PString p) { got.push_back(p.to_string()); };
+
+        write(f, "\r\n\n  quit\r\n \n");
+        BOOST_CHECK(f.parse(collect) == 1); // Blank lines skipped
+        BOOST_CHECK(got.back() == "quit");
+    }
+    BOOST_AUTO_TEST_CASE(overflow_01) {
+        Framer f;
+        std::size_t count = 0;
+        auto collect = [&count](an::PString) { ++count; };
+
+        write(f, std::string(32, 'x'));
+        BOOST_CHECK(f.parse(collect) == 0);
+        BOOST_CHECK(f.overflow());
+        f.reset();
+        BOOST_CHECK(!f.overflow());
+        BOOST_CHECK(f.overflows() == 1);
+        BOOST_CHECK(f.discarding());
+        write(f, "xx\nok\n"); // Rest of the long line dropped
+        BOOST_CHECK(f.parse(collect) == 1);
+        BOOST_CHECK(!f.discarding());
+    }
+    BOOST_AUTO_TEST_CASE(overflow_02) { // Nothing of an oversized line is dispatched
+        typedef an::LineFramer<an::MAX_FRAME_SIZE> ClientFramer;
+        std::unique_ptr<ClientFramer> f = std::make_unique<ClientFramer>();
+        std::vector<std::string> got;
+        auto collect = [&got](an::PString p) { got.push_back(p.to_string()); };
+
+        std::string order = "type=LIMIT:id=1:origin=Client1:destination=ME:symbol=APPL:direction=BUY:shares=5:price=172.0";
+        std::string line;
+        while (line.size() <= 2 * an::MAX_FRAME_SIZE) {
+            line += order;
+        }
+        line += "\nquit\n";
+        std::size_t at = 0;
+        while (at < line.size()) {
+            // Read as client_handler does
+            const std::size_t bytes = std::min(f->writeSpace(), line.size() - at);
+            std::memcpy(f->writePtr(), line.data() + at, bytes);
+            f->commit(bytes);
+            at += bytes;
+            f->parse(collect);
+            if (f->overflow()) {
+                f->reset();
+            }
+        }
+        BOOST_REQUIRE(got.size() == 1);
+        BOOST_CHECK(got[0] == "quit");
+        BOOST_CHECK(f->overflows() == 1);
+        BOOST_CHECK(!f->discarding());
+    }
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(order_queue)
+    BOOST_AUTO_TEST_CASE(batch_01) {
+        an::OrderQueue q;
+        an::OrderQueue::batch_t batch;
+        q.push(std::make_unique<an::LimitOrder >(1,"Client1",an::ME,"APPL",an::SELL,5,172.0));
+        q.push(std::make_unique<an::CancelOrder>(1,"Client1",an::ME,"APPL"));
+        BOOST_CHECK(q.pop(batch));
+        BOOST_REQUIRE(batch.size() == 2); // Both in one batch, in order
+        BOOST_CHECK(batch[0]->orderId() == 1);
+        BOOST_CHECK(dynamic_cast<an::CancelOrder*>(batch[1].get()) != nullptr);
+        batch.clear();
+
+        std::thread consumer( [&]{
+            an::OrderQueue::batch_t b;
+            while (q.pop(b)) {
+                b.clear();
+            }
+        } );
+        q.push(std::make_unique<an::CancelOrder>(2,"Client1",an::ME,"APPL"));
+        q.stop();
+        consumer.join(); // Drained and returned
+        BOOST_CHECK(!q.pop(batch));
+    }
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(gateway)
+    BOOST_AUTO_TEST_CASE(cancel_on_disconnect_01) {
+        namespace ip = boost::asio::ip;
+        const std::uint16_t port = 5062;
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+        an::Gateway gateway(courier);
+        gateway.start(port);
+
+        boost::asio::io_context io;
+        ip::tcp::socket sock(io);
+        sock.connect(ip::tcp::endpoint(ip::address::from_string("127.0.0.1"), port));
+        const std::string orders =
+            "type=LOGIN:origin=Client1:destination=ME\n"
+            "type=LIMIT:id=1:origin=Client1:destination=ME:symbol=APPL:direction=BUY:shares=5:price=170.0\n"
+            "type=LIMIT:id=2:origin=Client1:destination=ME:symbol=IBM:direction=SELL:shares=5:price=160.0\n";
+        boost::asio::write(sock, boost::asio::buffer(orders));
+        sock.close(); // Dropped without cancelling
+
+        for (int i = 0; (i < 500) && (gateway.disconnects() == 0); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        gateway.stop(); // Applies everything queued
+        BOOST_CHECK(gateway.disconnects()    == 1);
+        an::engine_stats_t stats = me.stats();
+        BOOST_CHECK(stats.active_trades      == 0);
+        BOOST_CHECK(stats.cancels            == 2);
+        me.close();
+    }
+    BOOST_AUTO_TEST_CASE(throttle_01) {
+        namespace ip = boost::asio::ip;
+        const std::uint16_t port = 5063;
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+        an::Gateway gateway(courier);
+        an::throttle_t throttle;
+        throttle.session_rate = 1;
+        throttle.session_burst = 2;
+        gateway.throttle(throttle);
+        gateway.start(port);
+
+        boost::asio::io_context io;
+        ip::tcp::socket sock(io);
+        sock.connect(ip::tcp::endpoint(ip::address::from_string("127.0.0.1"), port));
+        const std::string orders =
+            "type=LOGIN:origin=Client1:destination=ME\n"
+            "type=LIMIT:id=1:origin=Client1:destination=ME:symbol=APPL:direction=BUY:shares=5:price=170.0\n"
+            "type=LIMIT:id=2:origin=Client1:destination=ME:symbol=APPL:direction=BUY:shares=5:price=169.0\n"
+            "type=LIMIT:id=3:origin=Client1:destination=ME:symbol=APPL:direction=BUY:shares=5:price=168.0\n";
+        boost::asio::write(sock, boost::asio::buffer(orders));
+
+        for (int i = 0; (i < 500) && (gateway.throttleStats().rejected == 0); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        gateway.stop();
+        an::throttle_stats_t throttled = gateway.throttleStats();
+        BOOST_CHECK(throttled.passed         == 2); // The burst
+        BOOST_CHECK(throttled.rejected       == 1);
+        BOOST_CHECK(me.stats().active_trades == 2);
+        me.close();
+    }
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(token_bucket)
+    BOOST_AUTO_TEST_CASE(refill_01) {
+        const an::TokenBucket::time_point_t start = std::chrono::steady_clock::now();
+        an::TokenBucket bucket(10, 3); // 10 a second, 3 back to back
+        bucket.refill(start);
+        for (int i = 0; i < 3; ++i) {
+            BOOST_REQUIRE(bucket.ready());
+            bucket.take();
+        }
+        BOOST_CHECK(!bucket.ready());
+        BOOST_CHECK(bucket.wait() == std::chrono::milliseconds(100));
+
+        bucket.refill(start + std::chrono::milliseconds(50));
+        BOOST_CHECK(!bucket.ready());
+        BOOST_CHECK(bucket.wait() == std::chrono::milliseconds(50));
+        bucket.refill(start + std::chrono::milliseconds(100));
+        BOOST_CHECK(bucket.ready());
+        bucket.take();
+        BOOST_CHECK(!bucket.ready());
+
+        // Long idle, capped at the burst
+        bucket.refill(start + std::chrono::hours(24));
+        int taken = 0;
+        while (bucket.ready() && (taken < 10)) {
+            bucket.take();
+            ++taken;
+        }
+        BOOST_CHECK(taken == 3);
+        BOOST_CHECK(an::TokenBucket().ready() && !an::TokenBucket().enabled());
+    }
+BOOST_AUTO_TEST_SUITE_END()
+
+an::market_data_t makeQuote(const an::symbol_t& symbol, an::price_t bid, an::price_t ask) {
+    an::market_data_t md = an::market_data_t();
+    md.symbol = symbol;
+    md.have_bid = true; md.bid = bid; md.bid_size = 100;
+    md.have_ask = true; md.ask = ask; md.ask_size = 200;
+    return md;
+}
+
+// Capture datagrams from the publisher, dropping some, and replay them into a receiver
+struct LossyFeed {
+    LossyFeed(std::uint16_t port)
+        : io(), sock(io, boost::asio::ip::udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port)) { }
+    std::string next() {
+        std::array<char, an::MD_MAX_PACKET> buf;
+        std::size_t len = sock.receive(boost::asio::buffer(buf));
+        return std::string(buf.data(), len);
+    }
+    boost::asio::io_context      io;
+    boost::asio::ip::udp::socket sock;
+};
+
+BOOST_AUTO_TEST_SUITE(market_data)
+    BOOST_AUTO_TEST_CASE(encode_01) {
+        char buf[an::MD_MAX_PACKET];
+        an::market_data_t md = makeQuote("VOD.L", 91.5, 91.75);
+        md.seq = 42;
+        md.have_last_trade = true; md.last_trade_price = 91.6; md.last_trade_shares = 50; md.volume = 4580.0;
+        std::size_t len = an::encodeMarketData(md, 0, buf, sizeof(buf));
+        BOOST_REQUIRE(len == an::MD_HEADER_SIZE + an::MD_SYMBOL_LEN + 7*8);
+
+        an::market_data_t got;
+        BOOST_REQUIRE(an::decodeMarketData(buf, len, got));
+        BOOST_CHECK(got.seq == 42);
+        BOOST_CHECK(got.symbol == "VOD.L");
+        BOOST_CHECK(got.have_bid && got.bid == 91.5 && got.bid_size == 100);
+        BOOST_CHECK(got.have_ask && got.ask == 91.75 && got.ask_size == 200);
+        BOOST_CHECK(got.have_last_trade && got.last_trade_price == 91.6 && got.last_trade_shares == 50);
+        BOOST_CHECK(got.volume == 4580.0);
+        BOOST_CHECK(!an::decodeMarketData(buf, len - 1, got)); // Truncated
+
+        // Trade only, no quote
+        an::market_data_t trade = an::market_data_t();
+        trade.symbol = "MSFT";
+        trade.have_last_trade = true; trade.last_trade_price = 0.0000001; trade.last_trade_shares = 7;
+        len = an::encodeMarketData(trade, 0, buf, sizeof(buf));
+        BOOST_REQUIRE(len == an::MD_HEADER_SIZE + an::MD_SYMBOL_LEN + 3*8);
+        BOOST_REQUIRE(an::decodeMarketData(buf, len, got));
+        BOOST_CHECK(!got.have_bid && !got.have_ask && got.have_last_trade);
+        BOOST_CHECK(got.last_trade_price == 0.0000001);
+
+        trade.symbol = "SYMBOL_TOO_LONG";
+        BOOST_CHECK(an::encodeMarketData(trade, 0, buf, sizeof(buf)) == 0);
+
+        // Depth level
+        an::level_delta_t delta{an::LEVEL_MODIFY, an::SELL, an::price_level_t{91.75, 300, 2}};
+        len = an::encodeLevel("VOD.L", delta, 0, buf, sizeof(buf));
+        BOOST_REQUIRE(len == an::MD_HEADER_SIZE + an::MD_SYMBOL_LEN + 2 + 3*8);
+        an::md_level_t level;
+        BOOST_REQUIRE(an::decodeLevel(buf, len, level));
+        BOOST_CHECK(level.symbol == "VOD.L");
+        BOOST_CHECK(level.delta.action == an::LEVEL_MODIFY && level.delta.direction == an::SELL);
+        BOOST_CHECK(level.delta.level.price == 91.75 && level.delta.level.shares == 300);
+        BOOST_CHECK(level.delta.level.orders == 2);
+        BOOST_CHECK(!an::decodeMarketData(buf, len, got));
+        BOOST_CHECK(!an::decodeLevel(buf, len - 1, level));
+    }
+
+    BOOST_AUTO_TEST_CASE(gap_01) {
+        using namespace boost::asio::ip;
+        LossyFeed net(5080);
+        an::MarketDataPublisher pub(udp::endpoint(make_address("127.0.0.1"), 5080), 8);
+        pub.start(5081);
+        an::MarketDataReceiver rx(udp::endpoint(make_address("127.0.0.1"), 5082),
+                                  tcp::endpoint(make_address("127.0.0.1"), 5081));
+        for (int i = 1; i <= 4; ++i) {
+            BOOST_CHECK(pub.publish(makeQuote("MSFT", 90.0 + i, 92.0)) == static_cast<an::sequence_t>(i));
+        }
+        std::vector<std::string> pkts;
+        for (int i = 0; i < 4; ++i) {
+            pkts.push_back(net.next());
+        }
+
+        std::vector<an::market_data_t> out;
+        rx.onPacket(pkts[0].data(), pkts[0].size(), out);
+        rx.onPacket(pkts[3].data(), pkts[3].size(), out); // 2 and 3 lost, retransmitted
+        BOOST_REQUIRE(out.size() == 4);
+        for (std::size_t i = 0; i < out.size(); ++i) {
+            BOOST_CHECK(out[i].seq == i + 1);
+        }
+        BOOST_CHECK(out[1].bid == 92.0);
+        rx.onPacket(pkts[2].data(), pkts[2].size(), out); // Late duplicate
+        BOOST_CHECK(out.size() == 4);
+        BOOST_CHECK(rx.expected() == 5);
+        BOOST_CHECK(rx.stats().gaps == 1);
+        BOOST_CHECK(rx.stats().recovered == 2);
+        BOOST_CHECK(rx.stats().duplicates == 1);
+        BOOST_CHECK(pub.stats().retransmit_requests == 1);
+        pub.stop();
+    }
+
+    BOOST_AUTO_TEST_CASE(snapshot_01) {
+        using namespace boost::asio::ip;
+        LossyFeed net(5083);
+        an::MarketDataPublisher pub(udp::endpoint(make_address("127.0.0.1"), 5083), 2);
+        pub.start(5084);
+        an::MarketDataReceiver rx(udp::endpoint(make_address("127.0.0.1"), 5085),
+                                  tcp::endpoint(make_address("127.0.0.1"), 5084));
+        pub.publish(makeQuote("MSFT", 91.0, 92.0)); // 1
+        pub.publish(makeQuote("VOD.L", 1.0, 2.0));  // 2
+        pub.publish(makeQuote("MSFT", 91.5, 92.0)); // 3
+        pub.publish(makeQuote("APPL", 170.0, 171.0)); // 4
+        pub.publish(makeQuote("MSFT", 91.5, 91.75)); // 5
+        std::string last;
+        for (int i = 0; i < 5; ++i) {
+            last = net.next();
+        }
+
+        // Only 4 and 5 are still in history, the snapshot restores VOD.L and MSFT
+        std::vector<an::market_data_t> out;
+        rx.onPacket(last.data(), last.size(), out);
+        BOOST_REQUIRE(out.size() == 3);
+        BOOST_CHECK(out[0].symbol == "VOD.L" && out[0].seq == 2);
+        BOOST_CHECK(out[1].symbol == "APPL" && out[1].seq == 4);
+        BOOST_CHECK(out[2].symbol == "MSFT" && out[2].seq == 5 && out[2].ask == 91.75);
+        BOOST_CHECK(rx.expected() == 6);
+        BOOST_CHECK(rx.stats().snapshots == 1);
+        BOOST_CHECK(pub.stats().snapshot_requests == 1);
+        pub.stop();
+    }
+
+    BOOST_AUTO_TEST_CASE(depth_01) { // Engine depth over the feed, recovered by snapshot
+        using namespace boost::asio::ip;
+        LossyFeed net(5086);
+        an::MarketDataPublisher pub(udp::endpoint(make_address("127.0.0.1"), 5086), 2);
+        pub.start(5087);
+        an::MarketDataReceiver rx(udp::endpoint(make_address("127.0.0.1"), 5088),
+                                  tcp::endpoint(make_address("127.0.0.1"), 5087));
+        std::map<std::pair<an::direction_t, an::price_t>, an::price_level_t> depth;
+        rx.depthTo( [&depth](const an::md_level_t& l) {
+            BOOST_CHECK(l.symbol == "APPL");
+            auto key = std::make_pair(l.delta.direction, l.delta.level.price);
+            if (l.delta.action == an::LEVEL_CLEAR) {
+                depth.clear();
+            } else if (l.delta.action == an::LEVEL_DELETE) {
+                depth.erase(key);
+            } else {
+                depth[key] = l.delta.level;
+            }
+        } );
+
+        an::TickLadder tickdb;
+        tickdb.loadData("NXT_ticksize.txt");
+        an::SecurityDatabase secdb(an::ME, tickdb);
+        secdb.loadData("security_database.csv");
+        an::Courier courier;
+        courier.deliverTo( [](const an::location_t&, const an::transport_msg_t&) { } );
+        courier.publishTo( [&pub](const an::market_data_t& md) { pub.publish(md); } );
+        courier.depthTo( [&pub](const an::symbol_t& symbol, const std::vector<an::level_delta_t>& deltas) {
+            pub.publish(symbol, deltas);
+        } );
+        an::MatchingEngine me(an::ME, secdb, courier, true);
+        me.applyOrder(std::make_unique<an::LimitOrder >(  1,"Client1", an::ME,"APPL",an::BUY,10,170.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  2,"Client2", an::ME,"APPL",an::BUY,5,170.0));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  3,"Client2", an::ME,"APPL",an::SELL,10,172.0));
+        courier.publish();
+        BOOST_CHECK(pub.lastSeq() == 1 + 2);
+        me.applyOrder(std::make_unique<an::CancelOrder>(  3,"Client2", an::ME,"APPL"));
+        me.applyOrder(std::make_unique<an::LimitOrder >(  4,"Client1", an::ME,"APPL",an::BUY,7,169.0));
+        courier.publish();
+        BOOST_REQUIRE(pub.lastSeq() == 1 + 2 + 1 + 2);
+        std::string last;
+        for (an::sequence_t i = 0; i < pub.lastSeq(); ++i) {
+            last = net.next();
+        }
+        an::md_level_t level;
+        BOOST_REQUIRE(an::decodeLevel(last.data(), last.size(), level));
+        BOOST_CHECK(level.seq == 6);
+
+        // Only the last two are in history, the snapshot rebuilds the book
+        // including the ask deleted in the gap
+        depth[std::make_pair(an::SELL, 172.0)] = an::price_level_t{172.0, 10, 1};
+        std::vector<an::market_data_t> out;
+        rx.onPacket(last.data(), last.size(), out);
+        BOOST_CHECK(rx.stats().snapshots == 1);
+        BOOST_CHECK(rx.expected() == 7);
+        BOOST_REQUIRE(out.size() == 1);
+        BOOST_CHECK(out[0].have_bid && out[0].bid == 170.0 && !out[0].have_ask);
+        BOOST_REQUIRE(depth.size() == 2);
+        BOOST_CHECK(depth[std::make_pair(an::BUY, 170.0)].shares == 15);
+        BOOST_CHECK(depth[std::make_pair(an::BUY, 170.0)].orders == 2);
+        BOOST_CHECK(depth[std::make_pair(an::BUY, 169.0)].shares == 7);
+        // 5 from history, then the quote and the two live levels, the delete is gone
+        BOOST_CHECK(pub.stats().retransmitted == 1 + 1 + 2);
+        me.close();
+        pub.stop();
+    }
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,7 +3,11 @@
 
 #include <boost/test/unit_test.hpp>
 #include "types.hpp"
+#include "format.hpp"
+#include "logger.hpp"
 #include <iostream>
+#include <limits>
+#include <random>
 
 BOOST_AUTO_TEST_SUITE(round_ok)
     BOOST_AUTO_TEST_CASE(floatDecimalPlaces_01) {
@@ -129,6 +133,30 @@ BOOST_AUTO_TEST_SUITE(round_ok)
     }
 BOOST_AUTO_TEST_SUITE_END()
 
+BOOST_AUTO_TEST_SUITE(dates)
+    BOOST_AUTO_TEST_CASE(parseDate_01) {
+        an::date_t d = 0;
+        BOOST_CHECK(an::parseDate("1970-01-01", 10, d));
+        BOOST_CHECK(d == 0);
+        BOOST_CHECK(an::parseDate("1999-12-31", 10, d));
+        BOOST_CHECK(d == 946598400);
+        BOOST_CHECK(an::parseDate("2000-02-29", 10, d)); // Leap year
+        BOOST_CHECK(an::dateToString(d) == "2000-02-29");
+        BOOST_CHECK(an::parseDate("1924-02-14", 10, d)); // Before epoch
+        BOOST_CHECK(an::dateToString(d) == "1924-02-14");
+        BOOST_CHECK(an::dateToTimeT("2018-03-12") == 1520812800);
+
+        d = 42;
+        BOOST_CHECK(!an::parseDate("1900-02-29", 10, d)); // Not a leap year
+        BOOST_CHECK(!an::parseDate("0000-00-00", 10, d));
+        BOOST_CHECK(!an::parseDate("2018-13-01", 10, d));
+        BOOST_CHECK(!an::parseDate("2018-1-01", 9, d));
+        BOOST_CHECK(!an::parseDate("2018/01/01", 10, d));
+        BOOST_CHECK(!an::parseDate("2018-0a-01", 10, d));
+        BOOST_CHECK(d == 42);
+    }
+BOOST_AUTO_TEST_SUITE_END()
+
 BOOST_AUTO_TEST_SUITE(pstring)
     BOOST_AUTO_TEST_CASE(pstring_01) {
         BOOST_CHECK_NO_THROW(an::PString p0);
@@ -278,3 +306,184 @@ BOOST_AUTO_TEST_SUITE(conv)
     }
 BOOST_AUTO_TEST_SUITE_END()
 
+
+BOOST_AUTO_TEST_SUITE(formatter)
+    std::string fixed(double value, int precision) {
+        char buf[512];
+        an::Formatter f(buf, sizeof(buf));
+        f.fixed(value, precision);
+        return f.str();
+    }
+    BOOST_AUTO_TEST_CASE(fixed_01) {
+        // Byte for byte the same as floatDecimalPlaces, including ties and the odd cases
+        const double odd[] = { 0.0, -0.0, 1.0/256, -1.0/256, 0.125, 2.5, 3.5, 1e-9, -1e-9, 170.0, 171.07,
+                               91.4999999, 99999.99999999, 1e15, 1.5e17, -2e19, 1e300,
+                               std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(),
+                               std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::denorm_min() };
+        for (double value : odd) {
+            for (int precision = 0; precision <= 10; ++precision) {
+                BOOST_CHECK_EQUAL(fixed(value, precision), an::floatDecimalPlaces(value, precision));
+            }
+        }
+        std::mt19937_64 rng(42);
+        std::uniform_real_distribution<double> price(-1000.0, 1000.0);
+        std::uniform_int_distribution<int> ticks(0, 10000000);
+        int mismatches = 0;
+        for (int i = 0; i < 100000; ++i) {
+            const double random = price(rng) * std::pow(10.0, static_cast<int>(rng() % 12) - 4);
+            const double tick = ticks(rng) / 10000.0; // On a price grid
+            const int precision = static_cast<int>(rng() % 10);
+            mismatches += (fixed(random, precision) != an::floatDecimalPlaces(random, precision));
+            mismatches += (fixed(tick, an::MAX_PRICE_PRECISION) != an::floatDecimalPlaces(tick, an::MAX_PRICE_PRECISION));
+        }
+        BOOST_CHECK(mismatches == 0);
+    }
+    BOOST_AUTO_TEST_CASE(integer_01) {
+        char buf[128];
+        an::Formatter f(buf, sizeof(buf));
+        f << std::int64_t(0) << ' ' << std::int64_t(-42) << ' ' << std::numeric_limits<std::int64_t>::min() << ' '
+          << std::numeric_limits<std::uint64_t>::max() << ' ' << 7u << ' ' << "x=" << std::string("abc") << ':';
+        std::ostringstream os;
+        os << 0 << ' ' << -42 << ' ' << std::numeric_limits<std::int64_t>::min() << ' '
+           << std::numeric_limits<std::uint64_t>::max() << ' ' << 7u << ' ' << "x=" << "abc" << ':';
+        BOOST_CHECK_EQUAL(f.str(), os.str());
+        BOOST_CHECK(!f.overflow());
+    }
+    BOOST_AUTO_TEST_CASE(overflow_01) {
+        char buf[8];
+        an::Formatter f(buf, 4);
+        f << "type=" << 12345;
+        BOOST_CHECK(f.overflow());
+        BOOST_CHECK(f.size() == 10); // What a retry needs
+        BOOST_CHECK(f.str() == "type");
+        f.clear();
+        f << "ok";
+        BOOST_CHECK(!f.overflow() && f.str() == "ok");
+    }
+    BOOST_AUTO_TEST_CASE(timestamp_01) {
+        // Same text as date::format("%T"), whether or not the second is cached
+        typedef an::TimestampFormatter::time_point_t time_point_t;
+        an::TimestampFormatter timestamp;
+        std::mt19937_64 rng(7);
+        time_point_t time = std::chrono::system_clock::now();
+        int mismatches = 0;
+        for (int i = 0; i < 20000; ++i) {
+            switch (rng() % 4) {
+                case 0: time += std::chrono::nanoseconds(rng() % 1000); break;         // Same second, mostly
+                case 1: time += std::chrono::milliseconds(rng() % 2000); break;
+                case 2: time -= std::chrono::milliseconds(rng() % 2000); break;        // Backwards
+                default: time = time_point_t(std::chrono::seconds(rng() % 4000000000)); // Anywhere
+            }
+            mismatches += (timestamp.to_string(time) != date::format("%T", time));
+        }
+        BOOST_CHECK(mismatches == 0);
+        const time_point_t before1970(std::chrono::milliseconds(-1500));
+        BOOST_CHECK_EQUAL(timestamp.to_string(before1970), date::format("%T", before1970));
+        BOOST_CHECK(an::TimestampFormatter::SIZE == date::format("%T", before1970).size());
+    }
+BOOST_AUTO_TEST_SUITE_END()
+
+
+BOOST_AUTO_TEST_SUITE(logger)
+    // Everything the logger writes until the sink is put back
+    struct capture_t {
+        capture_t() : text() {
+            an::Logger::instance().sinkTo( [this](const char* s, std::size_t n) { text.append(s, n); } );
+        }
+        ~capture_t() { an::Logger::instance().sinkTo(nullptr); }
+        std::string text;
+    };
+
+    BOOST_AUTO_TEST_CASE(format_01) {
+        capture_t capture;
+        const std::string symbol = "MSFT";
+        AN_INFO("order id={} symbol={} side={} shares={} price={}", 42ULL, symbol, 'B', -250, 91.53);
+        AN_WARN("no arguments");
+        AN_ERROR("extra", 7, "text");
+        AN_INFO("missing {} {}", 1);
+        an::Logger::instance().flush();
+        std::vector<std::string> lines;
+        boost::split(lines, capture.text, boost::is_any_of("\n"));
+        BOOST_REQUIRE_EQUAL(lines.size(), 5U);
+        BOOST_CHECK(lines[4].empty());
+        const std::size_t stamp = an::TimestampFormatter::SIZE + 1;
+        for (std::size_t i = 0; i < 4; ++i) {
+            BOOST_CHECK(lines[i].size() > stamp && lines[i][2] == ':' && lines[i][stamp - 1] == ' ');
+            lines[i].erase(0, stamp);
+        }
+        BOOST_CHECK_EQUAL(lines[0], "INFO order id=42 symbol=MSFT side=B shares=-250 price=91.53");
+        BOOST_CHECK_EQUAL(lines[1], "WARN no arguments");
+        BOOST_CHECK_EQUAL(lines[2], "ERROR extra 7 text");
+        BOOST_CHECK_EQUAL(lines[3], "INFO missing 1 {}");
+    }
+    BOOST_AUTO_TEST_CASE(level_01) {
+        capture_t capture;
+        AN_DEBUG("hidden at INFO");
+        an::Logger::setLevel(an::LOG_DEBUG);
+        AN_DEBUG("shown {}", 1);
+        an::Logger::setLevel(an::LOG_ERROR);
+        AN_WARN("hidden at ERROR");
+        AN_ERROR("shown {}", 2);
+        an::Logger::setLevel(an::LOG_INFO);
+        an::Logger::instance().flush();
+        BOOST_CHECK(capture.text.find("hidden") == std::string::npos);
+        BOOST_CHECK(capture.text.find("DEBUG shown 1") != std::string::npos);
+        BOOST_CHECK(capture.text.find("ERROR shown 2") != std::string::npos);
+    }
+    BOOST_AUTO_TEST_CASE(threads_01) {
+        // Each thread's records arrive whole and in order, nothing is dropped
+        capture_t capture;
+        const an::log_stats_t before = an::Logger::instance().stats();
+        const int records = 1000;
+        auto producer = [records](int id) {
+            for (int i = 0; i < records; ++i) {
+                AN_INFO("thread={} seq={}", id, i);
+                if (i % 100 == 99) {
+                    an::Logger::instance().flush(); // Stays well within the buffer
+                }
+            }
+        };
+        std::thread first(producer, 1);
+        std::thread second(producer, 2);
+        first.join();
+        second.join();
+        an::Logger::instance().flush();
+        const an::log_stats_t after = an::Logger::instance().stats();
+        BOOST_CHECK_EQUAL(after.dropped, before.dropped);
+        BOOST_CHECK_EQUAL(after.records - before.records, 2 * records);
+        std::istringstream is(capture.text);
+        std::string line;
+        int next[3] = { 0, 0, 0 };
+        int bad = 0;
+        while (std::getline(is, line)) {
+            int id = -1;
+            int seq = -1;
+            const std::size_t at = line.find("INFO thread=");
+            if ((at == std::string::npos) || (std::sscanf(line.c_str() + at, "INFO thread=%d seq=%d", &id, &seq) != 2) ||
+                (id < 1) || (id > 2) || (seq != next[id]++)) {
+                ++bad;
+            }
+        }
+        BOOST_CHECK_EQUAL(bad, 0);
+        BOOST_CHECK_EQUAL(next[1], records);
+        BOOST_CHECK_EQUAL(next[2], records);
+    }
+    BOOST_AUTO_TEST_CASE(buffer_full_01) {
+        // A producer the logger can't keep up with loses records, it doesn't wait
+        an::LogBuffer buffer;
+        std::size_t written = 0;
+        while (char* p = buffer.reserve(256)) {
+            std::memset(p, 0, 256);
+            const std::uint32_t mark[2] = { 256, 0 };
+            std::memcpy(p, mark, sizeof(mark));
+            buffer.commit(256);
+            ++written;
+        }
+        BOOST_CHECK_EQUAL(written, an::LOG_BUFFER_SIZE / 256);
+        BOOST_CHECK_EQUAL(buffer.dropped(), 1);
+        std::size_t read = buffer.drain( [](const char*) { } );
+        BOOST_CHECK_EQUAL(read, written);
+        BOOST_CHECK(buffer.empty());
+        BOOST_CHECK(buffer.reserve(256) != nullptr);
+    }
+BOOST_AUTO_TEST_SUITE_END()